@@ -0,0 +1,73 @@
+/* Which CPUs the host has, and which NUMA node each of them is on.
+
+   On a machine with more than one NUMA node, memory sits closer to some
+   cores than to others:  a VM whose RAM was allocated on one node but which
+   runs on another pays for a trip across the interconnect on every access.
+   TickScheduler uses this to pin its workers to CPUs node by node, so that
+   each worker's shard of a VMWorld, and the RAM pages it first touches,
+   stay on one node.
+
+   On Linux the layout comes from /sys/devices/system/node, limited to the
+   CPUs the process is allowed to run on.  Anywhere else, or if that can't
+   be read, the host is taken to be a single node holding every hardware
+   thread -- which is just what a single-socket machine is anyway.
+*/
+
+#ifndef HOSTTOPOLOGY_H
+#define HOSTTOPOLOGY_H
+
+#include <vector>
+
+class HostTopology {
+private:
+    std::vector<std::vector<unsigned int>> _nodes;  //!< CPU numbers on each node;  never empty, nor is any node
+
+public:
+    /** A made-up layout:  the CPU numbers on each node.  Nodes without any are
+        dropped, and no CPUs at all makes one node with CPU 0. */
+    explicit HostTopology(std::vector<std::vector<unsigned int>> nodes);
+
+    //! The host's own layout, found out the first time it's asked for
+    static const HostTopology& host();
+
+    //! Number of NUMA nodes
+    unsigned int nodes() const {
+        return static_cast<unsigned int>(_nodes.size());
+    }
+    //! CPU numbers on node \a node
+    const std::vector<unsigned int>& cpus(unsigned int node) const {
+        return _nodes[node];
+    }
+    //! Number of CPUs, over every node
+    unsigned int cpuCount() const;
+
+    /** Where worker number \a worker out of \a workers goes.  Workers are
+        spread evenly over the CPUs, taken node by node, so every node gets
+        its share of workers and neighbouring workers share a node.  With more
+        workers than CPUs, some of them share a CPU. */
+    void place(unsigned int worker, unsigned int workers, unsigned int& node, unsigned int& cpu) const;
+
+    //! Pin the calling thread to CPU \a cpu.  False if it couldn't be, ex: the host doesn't support pinning.
+    static bool pinThread(unsigned int cpu);
+};
+
+/** Pins the calling thread to a CPU for as long as it lives, then lets it run
+    wherever it could before.  For borrowing a thread that isn't ours. */
+class ScopedThreadPin {
+private:
+    std::vector<unsigned char> _saved;  //!< The thread's affinity from before, in the host's own format
+    bool _pinned;
+
+public:
+    explicit ScopedThreadPin(unsigned int cpu);
+    ~ScopedThreadPin();
+    ScopedThreadPin(const ScopedThreadPin&) = delete;
+    ScopedThreadPin& operator=(const ScopedThreadPin&) = delete;
+
+    //! Whether the thread did get pinned
+    bool pinned() const {
+        return _pinned;
+    }
+};
+
+#endif // HOSTTOPOLOGY_H
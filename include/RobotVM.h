@@ -12,15 +12,52 @@
 #define ROBOTVM_H
 
 #include <array>
+#include <cstdint>
 #include <memory>
 #include "VMInstr.h"
+#include "VMTrace.h"
+#include "VMDecodedRom.h"
+#include "VMJit.h"
+#include "VMMemory.h"
+#include "VMStateArena.h"
+#include "RomImage.h"
+#include "VMPort.h"
 
 #define VM_ROM_SIZE   (8 * 1024)
-#define VM_STACK_SIZE 256
-#define VM_RAM_SIZE   ((4 * 1024) - VM_STACK_SIZE)
+// VM_RAM_SIZE and VM_STACK_SIZE live in VMMemory.h
 
 class VMAssembler;
 
+/** Which execution engine run() uses.  All of them produce identical results;
+    they only differ in how fast they get there. */
+enum class VMEngine : unsigned char {
+    SWITCH,    //!< Fetch & decode raw ROM bytes every step, then switch on the opcode.  Reference implementation.
+    DECODED,   //!< Call each predecoded op's handler
+    THREADED,  //!< Threaded dispatch over the predecoded ops (computed goto where the compiler supports it)
+    JIT        //!< Native code for hot blocks (see VMJit.h), else THREADED.  Same as THREADED without VM_HAS_JIT.
+};
+
+/** Why RobotVM::runFor() returned */
+enum class VMStopReason : unsigned char {
+    BUDGET,    //!< Ran every instruction it was allowed to;  call again to carry on
+    HALT,      //!< Halted normally, by HALT_NIL or by running past the end of ROM
+    FAULT,     //!< Halted on an error;  see RobotVM::errorState()
+    WAIT_IO    //!< Stopped on a port that was empty (RECV_RB) or full (SEND_RB), or asleep (WAIT_W);  call again to retry.  See VMPort.h.
+};
+
+/** What a VM stopped with VMStopReason::WAIT_IO is waiting for */
+enum class VMWaitReason : unsigned char {
+    NONE,      //!< Not waiting
+    RECV,      //!< A word in RobotVM::waitPort(), or with an outbox, for VMWorld to hand it one
+    SEND,      //!< Room in RobotVM::waitPort(), or in the VM's outbox if it has one
+    SLEEP      //!< A WAIT_W to run out
+};
+
+//! Engine a freshly-constructed RobotVM will use.  May be overridden at build time.
+#ifndef VM_DEFAULT_ENGINE
+#define VM_DEFAULT_ENGINE VMEngine::THREADED
+#endif
+
 /**
  Structure for holding the state of all of a VM's registers.
  These should be sorted in the SAME ORDER as the registers
@@ -50,6 +87,8 @@ struct vm_regs_t {
 struct vm_errorstate_t {
     bool illegal_instruction = false; //!< CPU detected unrecognized opcode
     bool on_fire = false;             //!< Digital sapient entity owning the VM is on fire
+    bool memory_fault = false;        //!< An instruction tried to reach outside of RAM
+    bool bad_port = false;            //!< An instruction used a port that isn't open, or there are no ports
 
     vm_errorstate_t() {
     }
@@ -60,20 +99,59 @@ typedef void opresult_t;
 #define OPRESULT inline opresult_t
 
 class RobotVM {
+    friend struct VMOpHandlers;
+    friend class VMBatch;
+    friend class RobotVMPool;
+    friend class VMWorld;
+    friend class VMSnapshot;
+
 private:
-    std::unique_ptr<VMInstrEmitter> _emitter;
+    std::shared_ptr<VMStateArena> _ownArena;  //!< Arena for a VM constructed without one, shared with its fork()s
+    VMStateArena&              _arena;  //!< Where the state below lives
+    const VMStateArena::slot_t _slot;   //!< Our slot in _arena
 
-    byte_t _rom[VM_ROM_SIZE];        //!< Read-Only, code goes here
-    byte_t _ram[VM_RAM_SIZE];        //!< RAM, data & knowledge here
-    byte_t _stack[VM_STACK_SIZE];    //!< Stack is separate from RAM
-    vm_regs_t     _regs;             //!< VM's registers
-    vm_errorstate_t _errorstate;     //!< Various error flags
+    vm_regs_t&       _regs;          //!< VM's registers
+    vm_errorstate_t& _errorstate;    //!< Various error flags
+    bool&            _halt;          //!< run() will terminate when this == true
+    bool&            _wait;          //!< Stopped on a port.  _halt is set too, so every engine stops;  the next runFor() or step() retries.
+    vm_ram_t&        _ram;           //!< RAM, data & knowledge here:  VM_RAM_SIZE bytes, in pages allocated on first write.  Only ever touched through VMRamAccess.
+    vm_stack_t&      _stack;         //!< Stack is separate from RAM:  VM_STACK_SIZE bytes, one page allocated on first push
 
-    addr_t _rwp;   //!< ROM write pointer for burn()
-    bool  _halt;   //!< run() will terminate when this == true
+    std::shared_ptr<const RomImage> _rom;  //!< Read-Only, code goes here.  Shared with every VM running the same program.
+    addr_t _rwp;   //!< ROM write pointer for burn();  always _rom->size()
 
     bool _hexregs; //!< If true, printRegs() print Rs in Base 16, else decimal
 
+    VMTraceSink* _trace;  //!< Not owned.  nullptr (the default) means run silently.
+    VMPortMap*   _ports;  //!< Not owned.  nullptr (the default) means there are no ports.
+    VMOutbox*    _outbox; //!< Not owned.  If set, SEND_RB holds messages here instead of sending them straight to _ports, and RECV_RB waits to be handed a word.
+
+    VMWaitReason _waitFor;   //!< What _wait is for.  Stale once _wait is cleared.
+    byte_t       _waitPort;  //!< The port, when _waitFor is RECV or SEND
+    word_t       _sleep;     //!< Ticks (calls to runFor()) a WAIT_W has left to sleep
+    bool         _woke;      //!< The WAIT_W under PC has slept its time, so it carries on when retried
+    bool         _parked;    //!< Left out of its VMWorld's ticks until what it waits for happens.  Only VMWorld touches it.
+    unsigned int _shard;     //!< Which of its VMWorld's shards it's in.  Only VMWorld touches it.
+    std::size_t  _saved;     //!< Where it was in its VMWorld's last checkpoint, counting from 1;  0 if it's come along since.  Only VMSnapshot touches it.
+
+    //! stateHash(), with \a sleep ticks left to sleep in place of _sleep
+    std::uint64_t stateHash(word_t sleep) const;
+
+    std::shared_ptr<VMDecodedRom> _decoded;  //!< Predecoded _rom[0.._rwp], as our options have it, and its native code.  Null until needed.
+    VMEngine     _engine;   //!< Engine run() uses
+    bool         _superops; //!< Whether predecoding fuses superinstructions
+    bool         _fixedregs; //!< Whether predecoding picks fixed-register handlers
+    unsigned long _superhits[VM_SUPEROP_COUNT];  //!< Times each superinstruction ran in full
+
+    RobotVM(VMStateArena* arena, std::shared_ptr<VMStateArena> own);
+    /** Put everything back the way a newly constructed VM has it, retiring our
+        arena slot until RobotVMPool hands us out again.  Only undoes what was
+        actually changed:  RAM pages never written cost nothing. */
+    void recycle();
+    /** Become a copy of \a parent, which shares our arena:  same ROM, registers
+        and options, with RAM and stack shared until either of us writes them. */
+    void inherit(RobotVM& parent);
+
     //! Get _regs[] index pertaining to given register enum
     int getRegisterIndex(RegName reg) const;
 
@@ -89,6 +167,96 @@ private:
 	void halt() {
 		_halt = true;
 	}
+    //! Stop on \a port, or to sleep:  the instruction didn't happen, and leaves PC where it is
+    void waitIO(VMWaitReason why, byte_t port = 0) {
+        _wait = true;
+        _halt = true;
+        _waitFor = why;
+        _waitPort = port;
+    }
+    //! Let a VM stopped on a port try again, or a sleeping one count off another tick
+    void resume() {
+        if (_wait) {
+            if (_sleep) {
+                if (--_sleep)
+                    return;
+                _woke = true;
+            }
+            _wait = false;
+            _halt = false;
+        }
+    }
+    /** Finish the RECV_RB the VM is waiting on as if it had found \a value in
+        its port:  into the register, and on past the instruction.  How VMWorld
+        hands out words under deterministic messaging. */
+    void receive(word_t value);
+
+    //! Flag a memory fault and halt if \a fault is true, else do nothing.  Doesn't branch.
+    void ramFault(bool fault) {
+        _errorstate.memory_fault |= fault;
+        _halt |= fault;
+    }
+    //! Word in RAM at \a addr, as VM_MEM_POLICY sees it
+    word_t loadRamWord(addr_t addr) {
+        bool fault = false;
+        const word_t w = VMRamAccess::loadWord(_ram, addr, fault);
+        ramFault(fault);
+        return w;
+    }
+    //! Byte in RAM at \a addr, as VM_MEM_POLICY sees it
+    byte_t loadRamByte(addr_t addr) {
+        bool fault = false;
+        const byte_t b = VMRamAccess::loadByte(_ram, addr, fault);
+        ramFault(fault);
+        return b;
+    }
+    //! Store a word to RAM at \a addr, as VM_MEM_POLICY sees it
+    void storeRamWord(addr_t addr, word_t val) {
+        bool fault = false;
+        VMRamAccess::storeWord(_ram, addr, val, fault);
+        ramFault(fault);
+    }
+    //! Word on the stack at \a at
+    word_t loadStackWord(word_t at) const {
+        bool never = false;
+        return VMStackAccess::loadWord(_stack, at, never);
+    }
+    //! Store a word onto the stack at \a at
+    void storeStackWord(word_t at, word_t val) {
+        bool never = false;
+        VMStackAccess::storeWord(_stack, at, val, never);
+    }
+
+    //! step() for a given trace policy (either VMTraceSink or VMNullTraceSink)
+    template<class TraceT> void stepWith(TraceT& trace);
+    //! stepRaw() for a given trace policy (either VMTraceSink or VMNullTraceSink)
+    template<class TraceT> void stepRawWith(TraceT& trace);
+    //! exec() for a given trace policy (either VMTraceSink or VMNullTraceSink)
+    template<class TraceT> void execWith(const vm_instr_t& instr, TraceT& trace);
+    //! printf-style report of a non-fatal oddity to the attached trace sink, if any
+    void warn(const char* fmt, ...) const;
+
+    //! Decode the single instruction found at ROM address \a pc
+    vm_decoded_op_t decodeAt(word_t pc) const;
+    //! Point _decoded at the predecoded ROM, building it if nobody has yet
+    void predecode();
+    //! DECODED engine:  run up to \a maxsteps instructions, or until halted.
+    //! Returns the number of instructions executed.
+    unsigned long runDecoded(unsigned long maxsteps);
+    //! THREADED engine:  run up to \a maxsteps instructions, or until halted.
+    //! Returns the number of instructions executed.
+    unsigned long runThreaded(unsigned long maxsteps);
+#if VM_HAS_JIT
+    //! JIT engine:  run up to \a maxsteps instructions, or until halted.
+    //! Returns the number of instructions executed.
+    unsigned long runJit(unsigned long maxsteps);
+#endif
+    //! Raw instruction bytes found in ROM at \a pc
+    vm_instr_t instrAt(word_t pc) const {
+        return _rom->fetch(pc);
+    }
+    //! _rom, copied first if anyone else can see it, ready for burning into
+    RomImage& writableRom();
 
 protected:
     OPRESULT i_movrm(RegName reg, addr_t addr);
@@ -129,6 +297,9 @@ protected:
     OPRESULT i_pushb(byte_t b);
     OPRESULT i_popwr(RegName reg);
     OPRESULT i_popbr(RegName reg);
+    OPRESULT i_recvrb(RegName reg, byte_t port);
+    OPRESULT i_sendrb(RegName reg, byte_t port);
+    OPRESULT i_waitw(word_t ticks);
 
     OPRESULT i_bcrrr(RegName reg1ptr, RegName reg2ptr, RegName reg3bytes);
 
@@ -142,11 +313,65 @@ protected:
     OPRESULT i_hcfnil();
 
 public:
-    /** Default constructor */
+    /** Default constructor.  The VM gets an arena all of its own. */
     RobotVM();
+    /** Construct with state kept in a slot of \a arena, which must outlive the VM */
+    explicit RobotVM(VMStateArena& arena);
     /** Default destructor */
     virtual ~RobotVM();
 
+    RobotVM(const RobotVM&) = delete;
+    RobotVM& operator=(const RobotVM&) = delete;
+
+    /** A child VM, in the same arena, that's a copy of this one as it stands:
+        it runs the same ROM image and starts with the same registers, RAM and
+        stack.  Nothing is copied up front;  RAM and stack pages are shared
+        until either VM writes them, and ROM until either burns more.  The
+        child has no trace sink or outbox attached.  Not while either VM is running. */
+    std::unique_ptr<RobotVM> fork();
+
+    //! The arena this VM's state lives in
+    VMStateArena& arena() const {
+        return _arena;
+    }
+    //! This VM's slot in arena()
+    VMStateArena::slot_t slot() const {
+        return _slot;
+    }
+
+    //! Attach a trace sink (not owned), or nullptr to run silently at full speed.
+    void setTraceSink(VMTraceSink* sink) {
+        _trace = sink;
+    }
+    //! The currently attached trace sink, or nullptr if there is none.
+    VMTraceSink* traceSink() const {
+        return _trace;
+    }
+    //! Connect to the ports in \a ports (not owned), or nullptr for none.  See VMPort.h.
+    void setPorts(VMPortMap* ports) {
+        _ports = ports;
+    }
+    //! The ports this VM is connected to, or nullptr if there are none
+    VMPortMap* ports() const {
+        return _ports;
+    }
+    /** Hold messages sent in \a outbox (not owned) for delivering later, or
+        nullptr to send them straight away.  With an outbox, RECV_RB never takes
+        a word itself, but waits for VMWorld to hand it one between ticks. */
+    void setOutbox(VMOutbox* outbox) {
+        _outbox = outbox;
+    }
+    VMOutbox* outbox() const {
+        return _outbox;
+    }
+
+    //! The ROM image this VM runs.  Hand it to setRom() to have other VMs share it.
+    const std::shared_ptr<const RomImage>& rom() const {
+        return _rom;
+    }
+    //! Run \a image in place of whatever was burned so far, leaving the ROM Write Pointer at its end
+    void setRom(const std::shared_ptr<const RomImage>& image);
+
     //! Burn instruction to ROM at [_rwp++]
     bool burn(const vm_instr_t& instr);
     //! Burn array of bytes to ROM at [_rwp] and _rwp+=len
@@ -180,9 +405,8 @@ public:
     void putstr(addr_t ramloc, const char* const str);
 
     //! Returns a reference to the VMInstrEmitter object utilized by this object.
-    VMInstrEmitter& emitter() const {
-        return *_emitter;
-    }
+    //! It holds no state, so every RobotVM shares the same one.
+    VMInstrEmitter& emitter() const;
 
     //! Get the value of Program Counter
     word_t getPC() const {
@@ -195,22 +419,118 @@ public:
 
     const vm_regs_t& getRegs() const { return _regs; }
 
-    //! Runs step() until halt flag is true
+    /** Fingerprint of everything this VM goes on to do:  registers, flags,
+        what it's waiting for, RAM, stack and ROM (see VMStateHash.h).  VMs in
+        the same state hash the same, on any host, whichever engine runs them.
+        Pages not written since the last call aren't hashed again.  Not while
+        the VM is running.  A VM parked in a VMWorld doesn't count its sleep
+        down, so ask the world instead:  VMWorld::stateHash(index). */
+    std::uint64_t stateHash() const {
+        return stateHash(_sleep);
+    }
+
+    //! Select the engine used by run()
+    void setEngine(VMEngine engine) {
+        _engine = engine;
+    }
+    //! The engine used by run()
+    VMEngine engine() const {
+        return _engine;
+    }
+
+    //! Enable or disable fusing superinstructions (on by default)
+    void setSuperOps(bool enable) {
+        _superops = enable;
+        _decoded.reset();
+    }
+    //! True if predecoding fuses superinstructions
+    bool superOps() const {
+        return _superops;
+    }
+    //! Enable or disable handlers specialized on their register operands (on by default)
+    void setFixedRegHandlers(bool enable) {
+        _fixedregs = enable;
+        _decoded.reset();
+    }
+    //! True if predecoding picks handlers specialized on their register operands
+    bool fixedRegHandlers() const {
+        return _fixedregs;
+    }
+    //! Number of times \a sop ran in full, rather than being cut short by an instruction budget
+    unsigned long superOpHits(VMSuperOp sop) const {
+        return _superhits[static_cast<int>(sop)];
+    }
+    //! Zero all superinstruction hit counters
+    void resetSuperOpHits();
+    //! Human-readable name of a superinstruction, ex: "ADD_RW+JNZERO_RW"
+    static const char* superOpName(VMSuperOp sop);
+
+    //! Runs instructions until halt flag is true
     void run();
+    /** Runs at most \a budget instructions using the selected engine, returning
+        early if the VM halts.  Nothing is lost when the budget runs out: the
+        next call carries on from the very next instruction.  A halted VM runs
+        nothing and keeps reporting why it halted until reset().  Each call is a
+        tick as far as WAIT_W is concerned:  after WAIT n, the next n - 1 calls run
+        nothing and report VMStopReason::WAIT_IO, and the one after carries on.
+        \param executed If not nullptr, receives the number of instructions run */
+    VMStopReason runFor(unsigned long budget, unsigned long* executed = nullptr);
+    //! What runFor() would report right now without running anything
+    VMStopReason stopReason() const;
     //! Runs a single instruction and increments PC by the instruction's byte length.
     void step();
+    //! Same as step(), but fetches and decodes the raw ROM bytes instead of using
+    //! the predecoded ROM.  Slow; this is the reference every engine must match,
+    //! as checkEngines() (see VMSelfCheck.h) checks.
+    void stepRaw();
     //! Executes a single VM instruction
     void exec(const vm_instr_t& instr);
 
-    bool isHalted() const { return _halt; }
+    bool isHalted() const { return _halt && !_wait; }
+    //! True if stopped on a port or asleep, until runFor() or step() gets past it
+    bool isWaiting() const { return _wait; }
+    //! What the VM is waiting for, if isWaiting()
+    VMWaitReason waitReason() const {
+        return _wait ? _waitFor : VMWaitReason::NONE;
+    }
+    //! The port the VM is waiting on, if waitReason() is RECV or SEND
+    byte_t waitPort() const {
+        return _waitPort;
+    }
+    //! Ticks a sleeping VM has left before it carries on, counting the one it carries on in
+    word_t sleepTicks() const {
+        return _wait ? _sleep : 0;
+    }
+    //! Cut a WAIT_W short:  the next runFor() or step() carries on past it
+    void wake() {
+        if (_wait && _sleep)
+            _sleep = 1;
+    }
+
+    //! Error flags raised by the last run
+    const vm_errorstate_t& errorState() const { return _errorstate; }
+
+    //! The predecoded ROM, building it first if ROM changed since last time
+    const VMDecodedRom& decodedROM() {
+        if (!_decoded)
+            predecode();
+        return *_decoded;
+    }
 
 	//! Resets the PC, Rom Write Pointer, and general registers back to 0, and un-Halts the machine if it was Halted.
+	//! ROM is left empty, ready to burn a new program.
 	void reset()
 	{
+		_rom = RomImage::empty();
 		_rwp = 0;
+		_decoded.reset();
 		_regs.pc = 0;
 		_regs.setAllGeneralRegistersToZero();
+		_errorstate = vm_errorstate_t();
 		_halt = false;
+		_wait = false;
+		_sleep = 0;
+		_woke = false;
 	}
 };
 
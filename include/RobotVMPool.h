@@ -0,0 +1,71 @@
+/* Pooled RobotVMs, for worlds where robots are born and die all the time.
+
+   new RobotVM() costs a heap allocation for the VM and taking an arena slot,
+   and delete gives it all back again.  A RobotVMPool
+   keeps VMs that have been despawned, fully constructed, on a free list;
+   spawn() takes one off it and puts it straight back in use.  So after the
+   pool has grown to its high-water mark, spawning and despawning allocate
+   nothing at all.
+
+   VMs are constructed in place in blocks of storage that never move, their
+   state living in the pool's own VMStateArena.  Despawning resets only what
+   the VM changed:  RAM pages it never wrote cost nothing, and the native
+   code for its ROM stays with the ROM.  A spawned VM is indistinguishable
+   from a newly constructed one.
+
+   Not thread-safe;  spawn and despawn from one thread, ex: between ticks.
+*/
+
+#ifndef ROBOTVMPOOL_H
+#define ROBOTVMPOOL_H
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+#include "RobotVM.h"
+#include "VMStateArena.h"
+
+class RobotVMPool {
+private:
+    typedef std::aligned_storage<sizeof(RobotVM), alignof(RobotVM)>::type vm_storage_t;
+
+    VMStateArena _arena;   //!< State of every VM;  outlives them all
+    std::vector<std::unique_ptr<vm_storage_t[]>> _blocks;  //!< Where VMs are constructed
+    std::size_t  _blockVMs;     //!< VMs per block
+    std::size_t  _constructed;  //!< VMs constructed so far, live or not
+    std::vector<RobotVM*> _free;  //!< Despawned VMs, reused last-in first-out
+
+public:
+    //! \param blockVMs Number of VMs to make room for at a time
+    explicit RobotVMPool(std::size_t blockVMs = VM_ARENA_CHUNK);
+    ~RobotVMPool();
+    RobotVMPool(const RobotVMPool&) = delete;
+    RobotVMPool& operator=(const RobotVMPool&) = delete;
+
+    //! A VM just as if newly constructed, reusing a despawned one if there is any
+    RobotVM* spawn();
+    //! RobotVM::fork() of \a parent, had from this pool, reusing a despawned VM if there is any
+    RobotVM* fork(RobotVM& parent);
+    //! Hand back \a vm, had from this pool's spawn(), for reuse.  It mustn't be used after.
+    void despawn(RobotVM* vm);
+
+    //! Number of VMs spawned and not yet despawned
+    std::size_t live() const {
+        return _constructed - _free.size();
+    }
+    //! Number of VMs constructed so far, live or waiting for reuse
+    std::size_t constructed() const {
+        return _constructed;
+    }
+
+    //! The arena the pool's VMs keep their state in
+    VMStateArena& arena() {
+        return _arena;
+    }
+    const VMStateArena& arena() const {
+        return _arena;
+    }
+};
+
+#endif // ROBOTVMPOOL_H
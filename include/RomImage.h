@@ -0,0 +1,102 @@
+/* An immutable program image, shared between every RobotVM running it.
+
+   Most robots run one of a handful of programs, each only a few hundred
+   bytes long, so rather than every VM carrying a full VM_ROM_SIZE array a
+   VM points at a reference-counted RomImage holding just the bytes burned.
+   RobotVM::burn() copies the image first if anyone else is using it, so
+   nobody ever sees their ROM change underneath them.
+
+   The predecoded form of an image is built once and shared along with it,
+   one for each combination of predecoding options in use.
+*/
+
+#ifndef ROMIMAGE_H
+#define ROMIMAGE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "VMInstr.h"
+#include "VMDecodedRom.h"
+
+class RomImage {
+private:
+    std::vector<byte_t> _bytes;   //!< Everything burned so far
+
+    /** Predecoded forms, indexed by variant();  built on first use.  Not part
+        of the image's value, so they may be filled in on a const image. */
+    mutable std::shared_ptr<VMDecodedRom> _decoded[4];
+    mutable std::mutex _mutex;    //!< Guards _decoded
+    mutable std::atomic<std::uint64_t> _hash;  //!< hash(), once worked out;  0 until then
+
+public:
+    RomImage()
+        : _bytes(), _decoded(), _mutex(), _hash(0) {
+    }
+    //! Copy of \a other's bytes, without its predecoded forms
+    RomImage(const RomImage& other)
+        : _bytes(other._bytes), _decoded(), _mutex(), _hash(other._hash.load()) {
+    }
+    RomImage& operator=(const RomImage&) = delete;
+
+    //! The image every VM starts out with:  no code at all
+    static const std::shared_ptr<const RomImage>& empty();
+
+    //! Number of bytes burned
+    std::size_t size() const {
+        return _bytes.size();
+    }
+    const byte_t* data() const {
+        return _bytes.data();
+    }
+    //! Byte at \a addr, or 0 past the end
+    byte_t at(std::size_t addr) const {
+        return addr < _bytes.size() ? _bytes[addr] : 0;
+    }
+    //! The 4-byte window of ROM starting at \a addr, with 0s past the end
+    vm_instr_t fetch(std::size_t addr) const {
+        vm_instr_t instr;
+        byte_t* const raw = reinterpret_cast<byte_t*>(&instr);
+        if (addr + sizeof(instr) <= _bytes.size()) {
+            std::memcpy(raw, &_bytes[addr], sizeof(instr));
+        } else {
+            for (std::size_t i = 0; i < sizeof(instr); i++)
+                raw[i] = at(addr + i);
+        }
+        return instr;
+    }
+    //! True if both images hold the same bytes
+    bool sameBytes(const RomImage& other) const {
+        return _bytes.size() == other._bytes.size()
+               && std::memcmp(_bytes.data(), other._bytes.data(), _bytes.size()) == 0;
+    }
+
+    /** VMStateHash::bytes() of the bytes burned, never 0.  Worked out on first
+        use and kept;  safe to call from any number of threads at once. */
+    std::uint64_t hash() const;
+
+    /** Write \a len bytes at \a addr, growing the image as need be and
+        dropping its predecoded forms.  Only for an image nobody else can see
+        yet;  see RobotVM::burn(). */
+    void write(std::size_t addr, const byte_t* bytes, std::size_t len);
+
+    //! Index into the predecoded forms for a combination of predecoding options
+    static unsigned int variant(bool superops, bool fixedregs) {
+        return (superops ? 2u : 0u) | (fixedregs ? 1u : 0u);
+    }
+    /** Predecoded form number \a variant, calling \a build() to make it if
+        nobody has yet.  Safe to call from any number of threads at once. */
+    template<class BuildT>
+    std::shared_ptr<VMDecodedRom> decoded(unsigned int variant, BuildT build) const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_decoded[variant])
+            _decoded[variant] = build();
+        return _decoded[variant];
+    }
+};
+
+#endif // ROMIMAGE_H
@@ -0,0 +1,102 @@
+/* Picks a VMWorld's instruction budget tick by tick, so that ticks finish
+   inside a deadline.
+
+   A fixed budget per VM per tick is a guess:  too small and a frame's spare
+   time goes to waste, too big and ticks run late once enough robots are
+   alive.  Instead, the controller is told how long a tick may take, and
+   how often it may be late -- ex: 8 ms, 99% of the time.  Before each tick
+   it's asked for a budget for however many VMs are about to run, and
+   after it, told how long the tick took.
+
+   Its model is that a tick's time goes up in step with its budget and with
+   the VMs it runs.  Each tick gives a cost, seconds per instruction of
+   budget per VM, and the costs of the last few ticks are kept.  The next
+   budget is the one that the cost at the given percentile of those would
+   fit into the deadline, for the VMs about to run;  so a growing population
+   gets smaller budgets as it grows, not a tick late.  Whatever a tick
+   spends that doesn't grow with the budget, ex: VMs halting early, only
+   makes the model cautious.
+
+   The budget drops straight away when it has to, but rises by at most an
+   eighth per tick, so that a few quiet ticks don't have it leap back up
+   just before things get busy again.  It never goes outside the limits it
+   was given, even if that means ticks run late;  stats() says how often.
+*/
+
+#ifndef TICKBUDGETCONTROLLER_H
+#define TICKBUDGETCONTROLLER_H
+
+#include <cstddef>
+#include <vector>
+
+//! Default number of recent ticks a TickBudgetController looks at
+#define VM_BUDGET_WINDOW 128
+
+/** What a TickBudgetController has decided, and why */
+struct tick_budget_stats_t {
+    unsigned long budget = 0;      //!< Budget last decided on
+    std::size_t   vms = 0;         //!< VMs it was decided for
+    double        latency = 0.0;   //!< Seconds a tick took at the percentile aimed for, over the window
+    double        predicted = 0.0; //!< Seconds the tick on budget is expected to take, at that percentile
+    unsigned long ticks = 0;       //!< Ticks recorded
+    unsigned long late = 0;        //!< Ticks that took longer than the deadline
+    unsigned long cuts = 0;        //!< Ticks after which the budget went down
+    unsigned long raises = 0;      //!< Ticks after which the budget went up
+    unsigned long floored = 0;     //!< Ticks after which the budget was held at its minimum, still expected to run late
+};
+
+class TickBudgetController {
+private:
+    double        _deadline;    //!< Seconds a tick may take
+    double        _percentile;  //!< Fraction of ticks that should finish in time
+    unsigned long _min, _max;   //!< Limits on the budget
+    unsigned long _budget;      //!< Budget last decided on
+    std::size_t   _vms;         //!< VMs it was decided for
+    std::vector<double> _costs;   //!< Seconds per instruction of budget per VM, of the last ticks, round and round
+    std::vector<double> _latency; //!< Seconds taken, of the same ticks
+    std::vector<double> _scratch; //!< For finding percentiles without disturbing the others
+    std::size_t   _next;        //!< Where the next tick goes in _costs and _latency
+    tick_budget_stats_t _stats;
+
+    //! The value at _percentile of the first \a n of \a samples
+    double quantile(const std::vector<double>& samples, std::size_t n);
+
+public:
+    /** \param deadline Seconds a tick may take
+        \param minBudget, maxBudget Limits on the budget.  It starts at \a maxBudget.
+        \param percentile Fraction of ticks that should finish inside \a deadline, ex: 0.99
+        \param window Number of recent ticks to look at */
+    TickBudgetController(double deadline, unsigned long minBudget, unsigned long maxBudget,
+                         double percentile = 0.99, std::size_t window = VM_BUDGET_WINDOW);
+
+    //! Budget last decided on, by budgetFor()
+    unsigned long budget() const {
+        return _budget;
+    }
+    double deadline() const {
+        return _deadline;
+    }
+    double percentile() const {
+        return _percentile;
+    }
+    unsigned long minBudget() const {
+        return _min;
+    }
+    unsigned long maxBudget() const {
+        return _max;
+    }
+    //! Change the limits on the budget, pulling it inside them if it's not.  \a maxBudget wins if they cross.
+    void setLimits(unsigned long minBudget, unsigned long maxBudget);
+
+    /** Decide the budget for a tick about to run \a vms VMs.  Up to an eighth
+        more than the last one, or any amount less. */
+    unsigned long budgetFor(std::size_t vms);
+    //! The tick just run, on the budget from budgetFor(), took \a seconds
+    void record(double seconds);
+    //! Everything decided so far
+    const tick_budget_stats_t& stats() const {
+        return _stats;
+    }
+};
+
+#endif // TICKBUDGETCONTROLLER_H
@@ -0,0 +1,131 @@
+/* Thread pool that runs one world tick's worth of work and waits for all of
+   it to finish.
+
+   A tick's work is a range of items (VMs, as far as VMWorld is concerned)
+   cut into batches.  Every worker starts the tick with its own contiguous
+   share of the batches in a work-stealing deque;  once a worker runs out it
+   steals batches off the far end of the others' deques, so one share full
+   of expensive items doesn't hold up the whole tick.  run() returns only
+   once every batch is done:  that's the tick barrier, so nothing from the
+   next tick can ever overlap this one.  The thread calling run() works as
+   worker 0 rather than sitting idle.
+
+   Rather than dealing shares out evenly, run() may also be handed a shard
+   of items for each worker, ex: the VMs whose memory lives on its NUMA node.
+   A pinned scheduler ties each worker to a CPU of its own, node by node (see
+   HostTopology), worker 0 only while it's inside run().  Workers then steal
+   from others on their own node before going further afield.
+*/
+
+#ifndef TICKSCHEDULER_H
+#define TICKSCHEDULER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <vector>
+#include "HostTopology.h"
+#include "WorkStealingDeque.h"
+
+/** How one TickScheduler worker has spent its time, summed over every run()
+    since it was made or since resetWorkerStats() */
+struct tick_worker_stats_t {
+    unsigned long batches = 0;       //!< Batches run, its own and stolen
+    unsigned long steals = 0;        //!< Batches stolen off other workers
+    unsigned long remoteSteals = 0;  //!< Of those, batches stolen off workers on another NUMA node
+    unsigned long failedSteals = 0;  //!< Steal attempts that came back with nothing
+    double        busySeconds = 0.0; //!< Time spent running batches
+    double        idleSeconds = 0.0; //!< The rest of each tick:  looking for work, waking up, waiting at the barrier
+};
+
+class TickScheduler {
+public:
+    /** A batch of work:  items [begin, end), run by worker number \a worker.
+        Returns however much work it got done (ex: instructions executed). */
+    typedef std::function<unsigned long(std::size_t begin, std::size_t end, unsigned int worker)> job_t;
+
+private:
+    std::vector<std::thread> _threads;   //!< Workers 1..N-1;  worker 0 is whoever calls run()
+
+    std::mutex              _mutex;
+    std::condition_variable _wake;       //!< Workers wait here for the next tick
+    std::condition_variable _finished;   //!< run() waits here for the workers to finish
+    unsigned long           _generation; //!< Bumped once per run();  tells workers there's work
+    unsigned int            _pending;    //!< Workers yet to finish the current run()
+    bool                    _quit;
+    std::exception_ptr      _error;      //!< First exception a worker ran into this tick
+
+    // The current tick's work;  only changed while every worker is idle
+    const job_t* _job;
+    std::vector<std::size_t> _bounds;    //!< Batch b is items [_bounds[b], _bounds[b + 1])
+    bool         _pinned;                //!< Whether each worker is pinned to its cpu
+
+    /** Everything a worker touches while running a tick.  Each is allocated
+        on its own and padded out, so that workers never share a cache line. */
+    struct Worker {
+        WorkStealingDeque<std::size_t> batches;  //!< Batch numbers still to run
+        unsigned long       done;    //!< Sum of what the job returned this tick
+        double              busy;    //!< Seconds spent in the job this tick
+        tick_worker_stats_t stats;
+        unsigned int        node;    //!< NUMA node, per HostTopology::place()
+        unsigned int        cpu;     //!< CPU, if pinned
+        std::vector<unsigned int> victims;  //!< Every other worker, in the order to steal from them
+        char                pad[64];
+
+        Worker() : batches(), done(0), busy(0.0), stats(), node(0), cpu(0), victims(), pad() {
+        }
+    };
+    std::vector<std::unique_ptr<Worker>> _workers;
+
+    void workerLoop(unsigned int worker);
+    //! Run one batch as worker \a worker
+    void runBatch(Worker& self, unsigned int worker, std::size_t batch);
+    //! Run worker \a worker's own batches, then steal until there are none left anywhere
+    void runShare(unsigned int worker);
+
+public:
+    /** \param threads Number of workers, counting the caller of run().  0 means one per hardware thread.
+        \param pinned Whether to pin each worker to a CPU, spread over the host's NUMA nodes */
+    explicit TickScheduler(unsigned int threads = 0, bool pinned = false);
+    ~TickScheduler();
+    TickScheduler(const TickScheduler&) = delete;
+    TickScheduler& operator=(const TickScheduler&) = delete;
+
+    //! Number of workers, counting the caller of run()
+    unsigned int threads() const {
+        return static_cast<unsigned int>(_threads.size()) + 1;
+    }
+
+    /** Run \a job over items [0, \a count) in batches of \a batchSize,
+        spread over every worker, and wait for all of them to finish.  If a
+        batch throws, the first exception is rethrown here once every worker
+        is done.
+        \return The sum of what every batch returned */
+    unsigned long run(std::size_t count, std::size_t batchSize, const job_t& job);
+    /** Same, but over items [0, sum of \a shards), of which worker w starts
+        with the \a shards[w] following the ones before it.  \a shards has one
+        entry per worker. */
+    unsigned long run(const std::vector<std::size_t>& shards, std::size_t batchSize, const job_t& job);
+
+    //! Whether each worker is pinned to a CPU
+    bool pinned() const {
+        return _pinned;
+    }
+    //! NUMA node worker \a worker runs on, if pinned, or would otherwise
+    unsigned int workerNode(unsigned int worker) const {
+        return _workers[worker]->node;
+    }
+
+    //! How worker \a worker (0 is the caller of run()) has spent its time
+    const tick_worker_stats_t& workerStats(unsigned int worker) const {
+        return _workers[worker]->stats;
+    }
+    //! Zero every worker's stats
+    void resetWorkerStats();
+};
+
+#endif // TICKSCHEDULER_H
@@ -0,0 +1,89 @@
+/* Lockstep execution of many RobotVMs running the same ROM.
+
+   A colony is mostly robots running identical code, with their PCs more
+   often than not at the same address.  VMBatch keeps the general registers
+   and PCs of up to VM_BATCH_LANES VMs side by side (structure-of-arrays),
+   and when several of them sit at the same PC it runs that one instruction
+   for all of them at once with 16-bit SIMD ops.  Lanes whose PC differs wait
+   their turn;  the group with the lowest PC always goes first, which is what
+   lets lanes that fell behind catch back up with the others.
+
+   Register-only ALU ops and jumps run in SIMD.  Loads and stores stay in
+   lockstep too, but go lane by lane through each VM's own RAM.  Anything
+   else -- stack ops, BC_RRR, HALT_NIL and the like -- is handed to each
+   lane's own RobotVM, one instruction at a time.  Either way, results are
+   exactly what each VM would have come up with running alone.
+
+   Lanes are AVX2 registers (16 VMs) when the compiler targets AVX2, else SSE2
+   (8 VMs), else plain arrays the compiler can vectorize as it sees fit.
+*/
+
+#ifndef VMBATCH_H
+#define VMBATCH_H
+
+#include <vector>
+#include "VMInstr.h"
+#include "VMDecodedRom.h"
+
+#if defined(__AVX2__)
+#define VM_BATCH_LANES 16
+#else
+#define VM_BATCH_LANES 8
+#endif
+
+class RobotVM;
+
+/** How much of a VMBatch's work actually ran in lockstep */
+struct vm_batch_stats_t {
+    unsigned long lockstepOps = 0;    //!< Instructions run in SIMD, once per group of lanes
+    unsigned long lockstepInstr = 0;  //!< VM instructions those accounted for
+    unsigned long scalarInstr = 0;    //!< VM instructions that had to be run by their own VM
+};
+
+/** A set of VMs to run in lockstep.  The VMs aren't owned, and are left
+    alone between runFor() calls:  burn, reset or inspect them freely. */
+class VMBatch {
+private:
+    std::vector<RobotVM*> _vms;
+    std::vector<RobotVM*> _lanes;   //!< runFor()'s scratch list of VMs to run in lockstep
+    vm_batch_stats_t _stats;
+
+    //! RAM ops run lane by lane;  see VMBatch.cpp
+    static bool execRam(const vm_decoded_op_t& op, RobotVM* const* vms,
+                        sword_t (*reg)[VM_BATCH_LANES], sword_t* pc, const sword_t* mask);
+    //! Run \a count VMs starting at \a vms as a single set of lanes
+    unsigned long runLanes(RobotVM* const* vms, unsigned int count, unsigned long budget);
+
+public:
+    VMBatch()
+        : _vms(), _lanes(), _stats() {
+    }
+
+    //! Add \a vm to the batch
+    void add(RobotVM& vm) {
+        _vms.push_back(&vm);
+    }
+    //! Remove every VM from the batch
+    void clear() {
+        _vms.clear();
+    }
+    //! Number of VMs in the batch
+    std::size_t size() const {
+        return _vms.size();
+    }
+
+    /** Same as calling runFor(\a budget) on every VM in the batch.  VMs whose
+        ROM matches the first VM's run in lockstep with each other;  others,
+        and any with a VMTraceSink attached, simply run on their own.
+        \return The total number of instructions executed */
+    unsigned long runFor(unsigned long budget);
+
+    const vm_batch_stats_t& stats() const {
+        return _stats;
+    }
+    void resetStats() {
+        _stats = vm_batch_stats_t();
+    }
+};
+
+#endif // VMBATCH_H
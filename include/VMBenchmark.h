@@ -0,0 +1,30 @@
+/* Micro-benchmarks for the VM.  Not part of the VM proper;  the dashboard
+   runs these and prints the results when started with --bench. */
+
+#ifndef VMBENCHMARK_H
+#define VMBENCHMARK_H
+
+#include <cstdio>
+
+//! Time every VMEngine on a few sample programs and print instructions/sec to \a out
+void benchEngines(std::FILE* out);
+
+//! Time a VMBatch against running the same VMs one at a time, printing results to \a out
+void benchBatch(std::FILE* out);
+
+//! Time ticking a VMWorld on one thread and on every hardware thread, evenly and unevenly
+//! loaded, scanning a big world for halted VMs, and ticking a growing one to a deadline,
+//! printing results and how busy each worker was to \a out
+void benchWorld(std::FILE* out);
+
+//! Time spawning and despawning VMs with new and delete against a RobotVMPool, and forking
+//! them, printing VMs per second to \a out
+void benchSpawn(std::FILE* out);
+
+//! Time saving and restoring a whole VMWorld with VMSnapshot, printing results to \a out
+void benchSnapshot(std::FILE* out);
+
+//! Run every benchmark there is, printing results to \a out
+void runBenchmarks(std::FILE* out);
+
+#endif // VMBENCHMARK_H
@@ -0,0 +1,131 @@
+/* Predecoded form of a RobotVM's ROM.
+
+   Robots re-run the same few hundred bytes of ROM over and over, so rather
+   than re-fetching and re-decoding the raw instruction bytes each time, the
+   ROM gets decoded once into an array of fixed-size vm_decoded_op_t's.  The
+   array has one entry per ROM *byte* address (not per instruction), so that
+   any jump target, however odd, can be looked up directly by PC.
+*/
+
+#ifndef VMDECODEDROM_H
+#define VMDECODEDROM_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "VMInstr.h"
+#include "VMJit.h"
+
+class RobotVM;
+struct vm_decoded_op_t;
+
+//! Executes a single predecoded instruction on a VM
+typedef void (*vm_op_handler_t)(RobotVM& vm, const vm_decoded_op_t& op);
+
+/** Superinstructions:  short runs of ops common enough in robot code that
+    predecoding fuses them into a single op, saving a dispatch per fused
+    instruction.  Only ever fused along straight-line code, and never across
+    an instruction some jump lands on. */
+enum class VMSuperOp : byte_t {
+    MOVRM_ADDRR_MOVMR,   //!< MOV Rx,[m] / ADD Rx,Ry / MOV [m],Rx -- read-modify-write of a RAM variable
+    ADDRW_JNZERORW,      //!< ADD Rx,w / JNZERO Rx,loop -- bottom of a countdown loop
+    MULRW_JMPW,          //!< MUL Rx,w / JMP loop
+    MOVRPRR_ADDRW,       //!< MOVRP Rx,Ry / ADD Rx,w -- store through a pointer, then advance it
+    ADDRW_ADDRW,         //!< ADD Rx,w / ADD Ry,w
+    MOVRM_MOVRM,         //!< MOV Rx,[m] / MOV Ry,[n] -- loading both sides of a swap
+    MOVMR_MOVMR,         //!< MOV [m],Rx / MOV [n],Ry -- storing both sides of a swap
+    COUNT                //!< Not a real superinstruction.  Used for sizing tables.
+};
+
+#define VM_SUPEROP_COUNT  (static_cast<int>(VMSuperOp::COUNT))
+
+// vm_decoded_op_t::kind values.  Below these, a kind is simply its Opcode.
+#define VM_OPKIND_ILLEGAL (static_cast<byte_t>(Opcode::NUM_OPCODES))  //!< Unknown opcode or bad register operand
+#define VM_OPKIND_HCF     (VM_OPKIND_ILLEGAL + 1)  //!< Halt and catch fire
+#define VM_OPKIND_SUPER   (VM_OPKIND_HCF + 1)      //!< First superinstruction;  VM_OPKIND_SUPER + VMSuperOp
+#define VM_OPKIND_COUNT   (VM_OPKIND_SUPER + VM_SUPEROP_COUNT)  //!< Not a real kind.  Used for sizing tables.
+
+/** A single instruction, decoded ahead of time. */
+struct vm_decoded_op_t {
+    vm_op_handler_t handler;  //!< Function implementing the instruction
+    const void* thread;       //!< Threaded engine's label for this op; set by VMDecodedRom::bindThreaded()
+    word_t  w;                //!< Word operand (literal, memory address, or jump target)
+    word_t  next;             //!< Address of the instruction following this one
+    byte_t  r1;               //!< First register operand, as an index into vm_regs_t::r[]
+    byte_t  r2;               //!< Second register operand
+    byte_t  r3;               //!< Third register operand
+    byte_t  b;                //!< Byte operand
+    Opcode  opcode;           //!< Opcode this was decoded from
+    byte_t  len;              //!< Length of the instruction in bytes
+    byte_t  kind;             //!< What the op does, for engines that don't call the handler.
+                              //!< A superinstruction's kind says what the whole fused run does,
+                              //!< while its handler, operands etc. still describe just the first op.
+};
+
+/** Decoded ops for every address in [0, ROM Write Pointer].  Built by
+    RobotVM and shared, through its RomImage, by every VM running the same
+    ROM with the same predecoding options.  So it never changes once built,
+    bar bindThreaded() filling in the ops' threads and jit() making their
+    native code, both thread-safe. */
+class VMDecodedRom {
+private:
+    std::vector<vm_decoded_op_t> _ops;  //!< Indexed by PC
+    std::atomic<bool> _threaded;        //!< true once bindThreaded() filled in every op's thread
+    std::mutex        _bindMutex;       //!< Serializes bindThreaded() and making _jit
+#if VM_HAS_JIT
+    std::unique_ptr<VMJit> _jit;        //!< Native code for the ops;  made on first use
+    std::atomic<bool> _jitted;          //!< true once _jit is made
+#endif
+
+public:
+    //! Take ownership of a freshly decoded set of ops
+    explicit VMDecodedRom(std::vector<vm_decoded_op_t>&& ops)
+        : _ops(std::move(ops)), _threaded(false), _bindMutex()
+#if VM_HAS_JIT
+          , _jit(), _jitted(false)
+#endif
+    {
+    }
+    VMDecodedRom(const VMDecodedRom&) = delete;
+    VMDecodedRom& operator=(const VMDecodedRom&) = delete;
+
+    //! True once bindThreaded() has been called
+    bool threaded() const {
+        return _threaded.load(std::memory_order_acquire);
+    }
+    //! Point every op's thread at \a labels[op.kind], unless that's been done already
+    void bindThreaded(const void* const* labels) {
+        std::lock_guard<std::mutex> lock(_bindMutex);
+        if (_threaded.load(std::memory_order_relaxed))
+            return;
+        for (vm_decoded_op_t& op : _ops)
+            op.thread = labels[op.kind];
+        _threaded.store(true, std::memory_order_release);
+    }
+#if VM_HAS_JIT
+    //! Native code for the ops, made on first use, for every VM running them to share
+    VMJit& jit() {
+        if (!_jitted.load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> lock(_bindMutex);
+            if (!_jit)
+                _jit.reset(new VMJit(*this));
+            _jitted.store(true, std::memory_order_release);
+        }
+        return *_jit;
+    }
+#endif
+
+    //! Number of decoded addresses
+    std::size_t size() const {
+        return _ops.size();
+    }
+    const vm_decoded_op_t* data() const {
+        return _ops.data();
+    }
+    const vm_decoded_op_t& operator[](word_t pc) const {
+        return _ops[pc];
+    }
+};
+
+#endif // VMDECODEDROM_H
@@ -3,10 +3,7 @@
 
 #include <string>
 #include <cstdint>
-#include <unordered_map>
 #include <vector>
-#include <list>
-#include <utility>
 
 std::string printHumanOpcodeStrings();
 
@@ -113,11 +110,13 @@ enum class Opcode : unsigned char {
     POPB_R,     //!< Pop BYTE from stack into REG   **
     POPW_R,     //!< Pop WORD from stack into REG   **
 
-    RECV_RB,    //!< \todo Receive WORD from port id (BYTE) and load into REG
-    SEND_RB,    //!< \todo Send value of REG to port id (BYTE)
+    RECV_RB,    //!< Receive WORD from port id (BYTE) and load into REG.  See VMPort.h.
+    SEND_RB,    //!< Send value of REG to port id (BYTE).  See VMPort.h.
 
     BC_RRR,     //!< string copy from ram[reg1ptr] to ram[reg2ptr] for reg3 bytes, up to MAX_BC_BYTES
 
+    WAIT_W,     //!< Sleep for WORD ticks, carrying on in the WORDth tick from now.  WAIT 0 does nothing.  See RobotVM::runFor().
+
     // CADD,     //!< Cascading Add:  R3 += R4 ; R2 += R3; R1 += R2
     // possible gameplay-world instructions
     // TURN_R,     //!< turn left if register is +, else turn right if -
@@ -175,8 +174,9 @@ enum class HumanOpcode : unsigned char {
 
     BC,          //!< Block Copy chunk of data from one RAM location to another.
 
-    RECV,        //!< \todo Implement this
-    SEND,        //!< \todo Implement this
+    RECV,        //!< Receive from a port
+    SEND,        //!< Send to a port
+    WAIT,        //!< Sleep for a number of ticks
 
     NUM_HUMANOPCODES, //!< Not a real opcode, duh. Used for loops, etc.
 
@@ -270,62 +270,24 @@ struct vm_instr_emit_info_t {
     }
 };
 
-// uuugh
-// this trouble just to use it as a hashtable key
-namespace std {
-template<>
-struct hash<HumanOpcode> {
-    typedef HumanOpcode argument_type;
-    typedef size_t result_type;
-
-    result_type operator () (const argument_type& x) const {
-        using type = typename std::underlying_type<argument_type>::type;
-        return std::hash<type>()(static_cast<type>(x));
-    }
-};
-}
-
 /** A VM Instruction Transcoder translates between this program's internal human-facing
     representations of things, and actual VM internal representations of those same
-    instructions. */
-class VMInstrTranscoder {
-private:
-    std::vector<OperandType> _opcodeByteToOperandTypeTable; //!< Gets initialized from data in the
-    //!< vmsetup_opc_instr_types table.
-    //!< @see vmsetup_opc_instr_types
-
-    mutable std::vector<int> _operandTypeLengthTable; //!< Table initialized with information about how
-    //!< many bytes an instruction is be depending on what
-    //!< parameters its operand takes.
-    mutable std::unordered_map<HumanOpcode,
-            std::list<std::pair<OperandType,Opcode>>>
-            _operandValidityTable;  //!< Table initialized with information about what possible ACTUAL Opcodes can be emitted by a HumanOpcode depending on what the given parameters to that HumanOpcode are.
-
-    void initOpcodeByteToOperandTypeTable();
-    void initOperandValidityTable();
-    void initOperandTypeLengthTable();
-
-    void populateTables() {
-        initOpcodeByteToOperandTypeTable();
-        initOperandTypeLengthTable();
-        initOperandValidityTable();
-    }
+    instructions.
 
+    Holds no state of its own:  all opcode metadata comes from the compile-time
+    tables in VMOpcodeTypes.h. */
+class VMInstrTranscoder {
 public:
     Opcode byteToOpcode(byte_t byte) const; //!< Returns a (VM) Opcode enum based on a given byte..  Will return Opcode::INVALID on a bogus byte.
     byte_t opcodeToByte(Opcode opc) const;  //!< Returns a byte representation of a VM Opcode enum.
-    OperandType getOperandTypeOfOpcode(Opcode opc); //!< Return the OperandType of a VM Opcode
-    HumanOpcode opcodeToHumanOpcode(Opcode) const;  //!< \todo This function is not yet implemented
+    OperandType getOperandTypeOfOpcode(Opcode opc) const; //!< Return the OperandType of a VM Opcode
+    HumanOpcode opcodeToHumanOpcode(Opcode) const;  //!< Returns the HumanOpcode a VM Opcode is assembled from, or HumanOpcode::INVALID
     HumanOpcode stringToHumanOpcode(std::string str) const;
     RegName stringToRegister(std::string& str) const;
     Opcode getVMOpcodeFromHumanOpcode(HumanOpcode opc, OperandType ot) const;
     int instructionLengthOfOperandType(OperandType opt) const; //!< Returns length an instruction would be if its Opcode were of given OperandType.
 
-    VMInstrTranscoder()
-        : _opcodeByteToOperandTypeTable(static_cast<int>(Opcode::NUM_OPCODES)),
-          _operandTypeLengthTable(static_cast<int>(OperandType::NUM_OPERAND_TYPES)),
-          _operandValidityTable() {
-        populateTables();
+    VMInstrTranscoder() {
     }
 
     virtual ~VMInstrTranscoder() {
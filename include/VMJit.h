@@ -0,0 +1,93 @@
+/* JIT tier for RobotVM:  translates basic blocks of predecoded ops into
+   native x86-64 code.
+
+   A block starts wherever execution happens to be and runs straight-line
+   until the first jump (included), or the first op the JIT doesn't handle
+   (excluded).  While a block runs, R1..R4 live in host registers, and every
+   RAM access is checked against the end of RAM and looked up in the VM's
+   page table.  Anything the JIT can't do natively -- HALT_NIL, stack ops,
+   BC_RRR, illegal instructions, a RAM access that would run off the end or
+   straddle two pages, a store into a page not yet allocated -- hands control
+   back to the interpreter, which leaves it up to VM_MEM_POLICY (see
+   VMMemory.h) and VMPagePool.
+
+   Only built when VM_JIT is defined, and only on x86-64 hosts.  Elsewhere
+   VM_HAS_JIT is 0 and VMEngine::JIT quietly runs the threaded interpreter.
+*/
+
+#ifndef VMJIT_H
+#define VMJIT_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "VMInstr.h"
+#include "VMMemory.h"
+
+#if defined(VM_JIT) && (defined(__x86_64__) || defined(_M_X64))
+#define VM_HAS_JIT 1
+#else
+#define VM_HAS_JIT 0
+#endif
+
+#if VM_HAS_JIT
+
+class VMDecodedRom;
+
+/** Compiled block entry point.  Takes vm_regs_t::r[] and the VM's RAM pages, and
+    returns the PC to continue at in its low 16 bits, and the number of
+    instructions executed in its high 16 bits. */
+typedef std::uint32_t (*vm_jit_fn_t)(sword_t* regs, vm_ram_t* ram);
+
+/** A compiled basic block */
+struct vm_jit_block_t {
+    vm_jit_fn_t fn;      //!< nullptr if the op at this address can't be compiled
+    unsigned int len;    //!< Number of instructions the block runs, unless it bails out early
+};
+
+/** Native code for the blocks of one predecoded ROM, compiled on demand.
+    Belongs to the VMDecodedRom (see VMDecodedRom::jit()), so every VM running
+    the same ROM with the same options shares it, and any number of threads
+    may run it at once:  each block is compiled just once, under a lock, and
+    looked up without one. */
+class VMJit {
+private:
+    struct CodeChunk {
+        byte_t* mem;
+        std::size_t size;
+        std::size_t used;
+    };
+
+    const VMDecodedRom&         _rom;      //!< What gets compiled
+    std::vector<vm_jit_block_t> _blocks;   //!< Indexed by PC;  each filled in before _compiled says so, and never again
+    std::vector<std::atomic<bool>> _compiled;  //!< Whether _blocks[pc] has been looked at yet
+    std::vector<CodeChunk>      _chunks;   //!< Executable memory holding the code
+    bool                        _failed;   //!< Host refused to give us executable memory
+    std::mutex                  _mutex;    //!< Serializes compiling, and so _blocks, _chunks and _failed
+
+    //! Copy \a code into executable memory, returning where it went (nullptr on failure)
+    const byte_t* install(const std::vector<byte_t>& code);
+    //! Translate the block starting at \a pc
+    vm_jit_block_t compile(word_t pc);
+    //! Compile the block at \a pc, unless another thread just has, recording it for next time
+    const vm_jit_block_t& compileAt(word_t pc);
+
+public:
+    //! Native code for \a rom, which must outlive it
+    explicit VMJit(const VMDecodedRom& rom);
+    ~VMJit();
+    VMJit(const VMJit&) = delete;
+    VMJit& operator=(const VMJit&) = delete;
+
+    //! The block starting at \a pc, an address in the ROM, compiling it first if need be
+    const vm_jit_block_t& blockAt(word_t pc) {
+        if (_compiled[pc].load(std::memory_order_acquire))
+            return _blocks[pc];
+        return compileAt(pc);
+    }
+};
+
+#endif // VM_HAS_JIT
+
+#endif // VMJIT_H
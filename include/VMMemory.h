@@ -0,0 +1,232 @@
+/* Bounds-safe access to a RobotVM's RAM and stack.
+
+   VM code can hand any 16-bit address to a memory instruction, but RAM is
+   much smaller than that.  Every load and store goes through VMMemory, which
+   turns a wild address into a safe one according to a VMMemPolicy picked at
+   build time, without a single branch:  the policy is a template parameter,
+   and what's left is a mask or a conditional move.
+
+   Words are stored little-endian, one byte at a time as far as C++ is
+   concerned, so there's no alignment requirement and no dependence on the
+   host's byte order.  Compilers still turn these into plain 16-bit moves.
+
+   RAM and stack are both made of pages allocated on first write (see
+   VMPagePool.h), accessed through VMPagedMemory, which applies the very same
+   policies as VMMemory does to flat memory.  The stack is a single page.
+*/
+
+#ifndef VMMEMORY_H
+#define VMMEMORY_H
+
+#include <cstring>
+#include "VMInstr.h"
+#include "VMPagePool.h"
+
+/** What happens when VM code reaches outside of RAM */
+enum class VMMemPolicy : unsigned char {
+    WRAP,    //!< Addresses wrap around modulo the (power of two) size of RAM, like cheap address decoding would
+    CLAMP,   //!< Addresses past the end get pinned to the last byte(s) of RAM
+    FAULT    //!< The access goes nowhere, and the VM halts with vm_errorstate_t::memory_fault
+};
+
+//! Policy every RobotVM's RAM uses.  May be overridden at build time.
+#ifndef VM_MEM_POLICY
+#define VM_MEM_POLICY VMMemPolicy::WRAP
+#endif
+
+/** Loads and stores into a SIZE byte memory under \a POLICY.  Memory must be
+    allocated with GUARD spare bytes past SIZE, which is where FAULT sends
+    accesses that are out of bounds. */
+template <VMMemPolicy POLICY, unsigned int SIZE>
+struct VMMemory {
+    static_assert(POLICY != VMMemPolicy::WRAP || (SIZE & (SIZE - 1)) == 0,
+                  "WRAP needs a power of two sized memory");
+
+    //! Spare bytes needed past the end of memory
+    static constexpr unsigned int GUARD = 2;
+    //! True if an access can ever report a fault
+    static constexpr bool FAULTS = POLICY == VMMemPolicy::FAULT;
+
+    /*! Offset of the first byte of a \a width byte access at \a addr.  WRAP
+        only wraps that first byte;  it's up to the caller to wrap the rest.
+        Sets \a fault if FAULT sent the access into the guard bytes. */
+    static unsigned int index(addr_t addr, unsigned int width, bool& fault) {
+        const unsigned int last = SIZE - width;
+        switch (POLICY) {
+        case VMMemPolicy::WRAP:
+            return addr & (SIZE - 1);
+        case VMMemPolicy::CLAMP:
+            return addr <= last ? addr : last;
+        case VMMemPolicy::FAULT:
+        default:
+            fault |= addr > last;
+            return addr <= last ? addr : SIZE;
+        }
+    }
+
+    static byte_t loadByte(const byte_t* mem, addr_t addr, bool& fault) {
+        return mem[index(addr, 1, fault)];
+    }
+    static void storeByte(byte_t* mem, addr_t addr, byte_t val, bool& fault) {
+        mem[index(addr, 1, fault)] = val;
+    }
+
+    static word_t loadWord(const byte_t* mem, addr_t addr, bool& fault) {
+        if (POLICY == VMMemPolicy::WRAP)   // the high byte may wrap to address 0
+            return static_cast<word_t>(mem[addr & (SIZE - 1)] | (mem[(addr + 1) & (SIZE - 1)] << 8));
+        const byte_t* at = &mem[index(addr, 2, fault)];
+        return static_cast<word_t>(at[0] | (at[1] << 8));
+    }
+    static void storeWord(byte_t* mem, addr_t addr, word_t val, bool& fault) {
+        if (POLICY == VMMemPolicy::WRAP) {
+            mem[addr & (SIZE - 1)] = static_cast<byte_t>(val);
+            mem[(addr + 1) & (SIZE - 1)] = static_cast<byte_t>(val >> 8);
+            return;
+        }
+        byte_t* at = &mem[index(addr, 2, fault)];
+        at[0] = static_cast<byte_t>(val);
+        at[1] = static_cast<byte_t>(val >> 8);
+    }
+
+    /*! Copy \a amt bytes from \a src to \a dst, which may overlap.  This one
+        does branch, but it's only used by BC_RRR, which loops anyway.
+        \return false if FAULT refused to copy, since part of either range lies
+                outside of memory */
+    static bool copy(byte_t* mem, addr_t dst, addr_t src, unsigned int amt) {
+        if (amt > SIZE)
+            amt = SIZE;
+        const bool inside = src + amt <= SIZE && dst + amt <= SIZE;
+
+        switch (POLICY) {
+        case VMMemPolicy::WRAP:
+            if (!inside) {
+                byte_t tmp[SIZE];
+                for (unsigned int i = 0; i < amt; i++)
+                    tmp[i] = mem[(src + i) & (SIZE - 1)];
+                for (unsigned int i = 0; i < amt; i++)
+                    mem[(dst + i) & (SIZE - 1)] = tmp[i];
+                return true;
+            }
+            break;
+        case VMMemPolicy::CLAMP:
+            if (src > SIZE - amt) src = SIZE - amt;
+            if (dst > SIZE - amt) dst = SIZE - amt;
+            break;
+        case VMMemPolicy::FAULT:
+            if (!inside)
+                return false;
+            break;
+        }
+        std::memmove(&mem[dst], &mem[src], amt);
+        return true;
+    }
+};
+
+/** VMMemory's loads and stores, for a SIZE byte memory made of pages in a
+    VMPageTable.  Loads and stores within a page cost one extra lookup;  a
+    word straddling two pages is put together a byte at a time. */
+template <VMMemPolicy POLICY, unsigned int SIZE>
+struct VMPagedMemory {
+    static_assert(SIZE % VM_RAM_PAGE_SIZE == 0, "memory must be a whole number of pages");
+
+    //! Works out which byte an access lands on, exactly as flat memory would
+    typedef VMMemory<POLICY, SIZE> Flat;
+    static constexpr unsigned int PAGE = VM_RAM_PAGE_SIZE;
+    static constexpr unsigned int PAGES = SIZE / PAGE;
+    typedef VMPageTable<PAGES> table_t;
+
+    //! True if an access can ever report a fault
+    static constexpr bool FAULTS = Flat::FAULTS;
+
+    //! Offset \a i, wrapped around under WRAP
+    static unsigned int wrap(unsigned int i) {
+        return POLICY == VMMemPolicy::WRAP ? i & (SIZE - 1) : i;
+    }
+    //! Offset of the byte after offset \a i
+    static unsigned int after(unsigned int i) {
+        return wrap(i + 1);
+    }
+
+    static byte_t loadByte(const table_t& mem, addr_t addr, bool& fault) {
+        const unsigned int i = Flat::index(addr, 1, fault);
+        return mem.read[i / PAGE][i % PAGE];
+    }
+    static void storeByte(table_t& mem, addr_t addr, byte_t val, bool& fault) {
+        bool outside = false;
+        const unsigned int i = Flat::index(addr, 1, outside);
+        fault |= outside;
+        if (FAULTS && outside)
+            return;
+        mem.writable(i / PAGE)[i % PAGE] = val;
+    }
+
+    static word_t loadWord(const table_t& mem, addr_t addr, bool& fault) {
+        const unsigned int i = Flat::index(addr, 2, fault);
+        const byte_t* at = mem.read[i / PAGE] + i % PAGE;
+        if (i % PAGE != PAGE - 1)
+            return static_cast<word_t>(at[0] | (at[1] << 8));
+        const unsigned int j = after(i);
+        return static_cast<word_t>(at[0] | (mem.read[j / PAGE][j % PAGE] << 8));
+    }
+    static void storeWord(table_t& mem, addr_t addr, word_t val, bool& fault) {
+        bool outside = false;
+        const unsigned int i = Flat::index(addr, 2, outside);
+        fault |= outside;
+        if (FAULTS && outside)
+            return;
+        byte_t* at = mem.writable(i / PAGE) + i % PAGE;
+        at[0] = static_cast<byte_t>(val);
+        if (i % PAGE != PAGE - 1) {
+            at[1] = static_cast<byte_t>(val >> 8);
+        } else {
+            const unsigned int j = after(i);
+            mem.writable(j / PAGE)[j % PAGE] = static_cast<byte_t>(val >> 8);
+        }
+    }
+
+    //! VMMemory::copy(), for paged memory
+    static bool copy(table_t& mem, addr_t dst, addr_t src, unsigned int amt) {
+        if (amt > SIZE)
+            amt = SIZE;
+        const bool inside = src + amt <= SIZE && dst + amt <= SIZE;
+
+        switch (POLICY) {
+        case VMMemPolicy::WRAP:
+            break;
+        case VMMemPolicy::CLAMP:
+            if (src > SIZE - amt) src = static_cast<addr_t>(SIZE - amt);
+            if (dst > SIZE - amt) dst = static_cast<addr_t>(SIZE - amt);
+            break;
+        case VMMemPolicy::FAULT:
+            if (!inside)
+                return false;
+            break;
+        }
+
+        // every byte is in range by now, bar WRAP's, which wrap() takes care of
+        byte_t tmp[SIZE];
+        for (unsigned int i = 0; i < amt; i++) {
+            const unsigned int at = wrap(src + i);
+            tmp[i] = mem.read[at / PAGE][at % PAGE];
+        }
+        for (unsigned int i = 0; i < amt; i++) {
+            const unsigned int at = wrap(dst + i);
+            mem.writable(at / PAGE)[at % PAGE] = tmp[i];
+        }
+        return true;
+    }
+};
+
+#define VM_STACK_SIZE 256
+#define VM_RAM_SIZE   (4 * 1024)   // power of two, so VMMemPolicy::WRAP is a mask
+
+//! Accessor for RAM, under whichever policy the build picked
+typedef VMPagedMemory<VM_MEM_POLICY, VM_RAM_SIZE> VMRamAccess;
+//! A RobotVM's RAM
+typedef VMRamAccess::table_t vm_ram_t;
+//! Accessor for the stack.  SP never leaves the stack, so the policy is moot.
+typedef VMPagedMemory<VMMemPolicy::WRAP, VM_STACK_SIZE> VMStackAccess;
+//! A RobotVM's stack
+typedef VMStackAccess::table_t vm_stack_t;
+
+#endif // VMMEMORY_H
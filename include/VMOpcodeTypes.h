@@ -1,63 +1,164 @@
-/* To be used in VMInstr.cpp when populating tables */
+/* Compile-time opcode metadata.
+
+   Everything the VM, the transcoder and the assembler need to know about an
+   opcode -- its operand type, its length in bytes, and which HumanOpcode it
+   is assembled from -- comes from the one vmsetup_opc_instr_types table
+   below.  The lookup tables derived from it are built by the compiler, so
+   lookups are plain array reads and nothing gets built at runtime.
+*/
 
 #ifndef VMOPCODETYPES_H_INCLUDED
 #define VMOPCODETYPES_H_INCLUDED
 
-// enum-to-byte
-#define EB(x) (static_cast<byte_t>(x))
-#define TPAIR(x, y)  { EB(x), EB(y) }
+#include "VMInstr.h"
+
+/** One row of vmsetup_opc_instr_types */
+struct vm_opc_setup_t {
+    Opcode      opcode;
+    HumanOpcode human;   //!< What the assembler emits this from;  HumanOpcode::INVALID if it can't yet
+    OperandType type;
+};
+
+#define TSETUP(opc, human, type)  { Opcode::opc, HumanOpcode::human, OperandType::type }
 
 /** Table for specifying the parameter fingerprints of various opcodes. */
-byte_t vmsetup_opc_instr_types[][2] = {
-    TPAIR(Opcode::MOV_RM,   OperandType::RM ),
-    TPAIR(Opcode::MOV_MR,   OperandType::MR ),
-    TPAIR(Opcode::MOV_RR,   OperandType::RR ),
-    TPAIR(Opcode::MOV_RW,   OperandType::RW ),
-    TPAIR(Opcode::MOVRP_RR, OperandType::RR ),
-    TPAIR(Opcode::MOVPR_RR, OperandType::RR ),
-    TPAIR(Opcode::MOVB_RM,  OperandType::RM ),
-    TPAIR(Opcode::SWAP_RR,  OperandType::RR ),
-    TPAIR(Opcode::SWAP_RM,  OperandType::RM ),
-    TPAIR(Opcode::BC_RRR,   OperandType::RRR),
-    TPAIR(Opcode::ZERO_NIL, OperandType::NIL),
-    TPAIR(Opcode::DUP_R,    OperandType::R  ),
-    TPAIR(Opcode::ADD_RW,   OperandType::RW ),
-    TPAIR(Opcode::HALT_NIL, OperandType::NIL),
-//      TPAIR(Opcode::ADDW_RM,  OperandType::RM ),
-//      TPAIR(Opcode::ADDB_RM,  OperandType::RM ),
-    TPAIR(Opcode::ADD_RR,   OperandType::RR ),
-    TPAIR(Opcode::ADD_RRR,  OperandType::RRR),
-    TPAIR(Opcode::MUL_RW,   OperandType::RW ),
-    TPAIR(Opcode::MUL_RR,   OperandType::RR ),
-    TPAIR(Opcode::NEG_R,    OperandType::R  ),
-    TPAIR(Opcode::SUB_RR,   OperandType::RR ),
-    TPAIR(Opcode::JMP_W,    OperandType::P  ),
-    TPAIR(Opcode::JNEG_RW,  OperandType::RW ),
-    TPAIR(Opcode::JPOS_RW,  OperandType::RW ),
-    TPAIR(Opcode::JZERO_RW, OperandType::RW ),
-    TPAIR(Opcode::JNZERO_RW,OperandType::RW ),
-    TPAIR(Opcode::AND_RR,   OperandType::RR ),
-    TPAIR(Opcode::AND_RW,   OperandType::RW ),
-    TPAIR(Opcode::OR_RR,    OperandType::RR ),
-    TPAIR(Opcode::OR_RW,    OperandType::RW ),
-    TPAIR(Opcode::XOR_RR,   OperandType::RR ),
-    TPAIR(Opcode::XOR_RW,   OperandType::RW ),
-    TPAIR(Opcode::NOT_R,    OperandType::R  ),
-    TPAIR(Opcode::BSL_R,    OperandType::R  ),
-    TPAIR(Opcode::BSR_R,    OperandType::R  ),
-    TPAIR(Opcode::ROL_R,    OperandType::R  ),
-    TPAIR(Opcode::ROR_R,    OperandType::R  ),
-    TPAIR(Opcode::PUSH_R,   OperandType::R  ),
-    TPAIR(Opcode::PUSH_W,   OperandType::W  ),
-    TPAIR(Opcode::PUSH_B,   OperandType::B  ),
-    TPAIR(Opcode::POPB_R,   OperandType::R  ),
-    TPAIR(Opcode::POPW_R,   OperandType::R  ),
-    TPAIR(Opcode::RECV_RB,  OperandType::RB ),
-    TPAIR(Opcode::SEND_RB,  OperandType::RB ),
-
-    /* ALWAYS keep NOP at end of this array to tell
-       table-builder to stop crawling after this one */
-    TPAIR(Opcode::NOP,      OperandType::NIL)
+constexpr vm_opc_setup_t vmsetup_opc_instr_types[] = {
+    TSETUP(MOV_RM,    MOV,     RM ),
+    TSETUP(MOV_MR,    MOV,     MR ),
+    TSETUP(MOV_RR,    MOV,     RR ),
+    TSETUP(MOV_RW,    MOV,     RW ),
+    TSETUP(MOVRP_RR,  MOVRP,   RR ),
+    TSETUP(MOVPR_RR,  MOVPR,   RR ),
+    TSETUP(MOVB_RM,   MOVB,    RM ),
+    TSETUP(SWAP_RR,   SWAP,    RR ),
+    TSETUP(SWAP_RM,   SWAP,    RM ),
+    TSETUP(BC_RRR,    BC,      RRR),
+    TSETUP(ZERO_NIL,  ZERO,    NIL),
+    TSETUP(DUP_R,     DUP,     R  ),
+    TSETUP(ADD_RW,    ADD,     RW ),
+    TSETUP(HALT_NIL,  HALT,    NIL),
+//  TSETUP(ADDW_RM,   ADD,     RM ),
+//  TSETUP(ADDB_RM,   ADD,     RM ),
+    TSETUP(ADD_RR,    ADD,     RR ),
+    TSETUP(ADD_RRR,   ADD,     RRR),
+    TSETUP(MUL_RW,    MUL,     RW ),
+    TSETUP(MUL_RR,    MUL,     RR ),
+    TSETUP(NEG_R,     NEG,     R  ),
+    TSETUP(SUB_RR,    SUB,     RR ),
+    TSETUP(JMP_W,     JMP,     W  ),
+    TSETUP(JNEG_RW,   JNEG,    RW ),
+    TSETUP(JPOS_RW,   JPOS,    RW ),
+    TSETUP(JZERO_RW,  JZERO,   RW ),
+    TSETUP(JNZERO_RW, JNZERO,  RW ),
+    TSETUP(AND_RR,    AND,     RR ),
+    TSETUP(AND_RW,    AND,     RW ),
+    TSETUP(OR_RR,     OR,      RR ),
+    TSETUP(OR_RW,     OR,      RW ),
+    TSETUP(XOR_RR,    XOR,     RR ),
+    TSETUP(XOR_RW,    XOR,     RW ),
+    TSETUP(NOT_R,     NOT,     R  ),
+    TSETUP(BSL_R,     BSL,     R  ),
+    TSETUP(BSR_R,     BSR,     R  ),
+    TSETUP(ROL_R,     ROL,     R  ),
+    TSETUP(ROR_R,     ROR,     R  ),
+    TSETUP(PUSH_R,    PUSH,    R  ),
+    TSETUP(PUSH_W,    PUSH,    W  ),
+    TSETUP(PUSH_B,    PUSH,    B  ),
+    TSETUP(POPB_R,    POPB,    R  ),
+    TSETUP(POPW_R,    POPW,    R  ),
+    TSETUP(RECV_RB,   RECV,    RB ),
+    TSETUP(SEND_RB,   SEND,    RB ),
+    TSETUP(WAIT_W,    WAIT,    W  ),
+    TSETUP(NOP,       NOP,     NIL)
 };
 
-#endif // VMOPCODELENGTHS_H_INCLUDED
+#undef TSETUP
+
+#define VM_NUM_OPCODES       (static_cast<int>(Opcode::NUM_OPCODES))
+#define VM_NUM_HUMANOPCODES  (static_cast<int>(HumanOpcode::NUM_HUMANOPCODES))
+#define VM_NUM_OPERANDTYPES  (static_cast<int>(OperandType::NUM_OPERAND_TYPES))
+
+/** Lookup tables derived from vmsetup_opc_instr_types.  Only ever built by
+    the compiler;  use the VMOpcodeInfo functions rather than these directly. */
+struct vm_opcode_tables_t {
+    OperandType typeOf[VM_NUM_OPCODES];     //!< Opcode -> OperandType
+    int         lengthOf[VM_NUM_OPCODES];   //!< Opcode -> instruction length in bytes
+    Opcode      byHuman[VM_NUM_HUMANOPCODES][VM_NUM_OPERANDTYPES];  //!< HumanOpcode + OperandType -> Opcode
+    bool        complete;                   //!< Every opcode got an entry in vmsetup_opc_instr_types
+
+    //! Length of an instruction whose Opcode takes operands of type \a opt, or -1 if there is none
+    static constexpr int operandTypeLength(OperandType opt) {
+        switch (opt) {
+        case OperandType::NIL: return 1;
+        case OperandType::RM:  return 4;
+        case OperandType::MR:  return 4;
+        case OperandType::RR:  return 3;
+        case OperandType::RRR: return 4;
+        case OperandType::RW:  return 4;
+        case OperandType::RB:  return 3;
+        case OperandType::P:   return 3;
+        case OperandType::R:   return 2;
+        case OperandType::BBB: return 4;
+        case OperandType::BB:  return 3;
+        case OperandType::B:   return 2;
+        case OperandType::BW:  return 4;
+        case OperandType::WB:  return 4;
+        case OperandType::W:   return 3;
+        default:               return -1;
+        }
+    }
+
+    constexpr vm_opcode_tables_t()
+        : typeOf(), lengthOf(), byHuman(), complete(true) {
+        for (int i = 0; i < VM_NUM_OPCODES; i++) {
+            typeOf[i] = OperandType::INVALID;
+            lengthOf[i] = -1;
+        }
+        for (int h = 0; h < VM_NUM_HUMANOPCODES; h++)
+            for (int t = 0; t < VM_NUM_OPERANDTYPES; t++)
+                byHuman[h][t] = Opcode::INVALID;
+
+        for (const vm_opc_setup_t& row : vmsetup_opc_instr_types) {
+            typeOf[static_cast<int>(row.opcode)] = row.type;
+            lengthOf[static_cast<int>(row.opcode)] = operandTypeLength(row.type);
+            if (row.human != HumanOpcode::INVALID)
+                byHuman[static_cast<int>(row.human)][static_cast<int>(row.type)] = row.opcode;
+        }
+
+        for (int i = 0; i < VM_NUM_OPCODES; i++)
+            if (typeOf[i] == OperandType::INVALID)
+                complete = false;
+    }
+};
+
+/** Compile-time lookups of opcode metadata.  All of them are safe to call
+    with bogus values, which get INVALID / -1 back. */
+struct VMOpcodeInfo {
+    static constexpr vm_opcode_tables_t tables = vm_opcode_tables_t();
+
+    //! OperandType of a VM Opcode
+    static constexpr OperandType operandType(Opcode opc) {
+        return static_cast<int>(opc) < VM_NUM_OPCODES ? tables.typeOf[static_cast<int>(opc)]
+               : OperandType::INVALID;
+    }
+    //! Length in bytes of an instruction starting with \a opc
+    static constexpr int length(Opcode opc) {
+        return static_cast<int>(opc) < VM_NUM_OPCODES ? tables.lengthOf[static_cast<int>(opc)] : -1;
+    }
+    //! Length in bytes of an instruction whose Opcode takes operands of type \a opt
+    static constexpr int operandTypeLength(OperandType opt) {
+        return vm_opcode_tables_t::operandTypeLength(opt);
+    }
+    //! The Opcode assembled from \a hopc when given operands of type \a opt
+    static constexpr Opcode fromHuman(HumanOpcode hopc, OperandType opt) {
+        return (static_cast<int>(hopc) < VM_NUM_HUMANOPCODES
+                && static_cast<int>(opt) >= 0 && static_cast<int>(opt) < VM_NUM_OPERANDTYPES)
+               ? tables.byHuman[static_cast<int>(hopc)][static_cast<int>(opt)]
+               : Opcode::INVALID;
+    }
+};
+
+// Please check vmsetup_opc_instr_types if this fires.
+static_assert(VMOpcodeInfo::tables.complete, "An opcode is missing from vmsetup_opc_instr_types");
+
+#endif // VMOPCODETYPES_H_INCLUDED
@@ -0,0 +1,230 @@
+/* RAM pages for RobotVMs, allocated on first write.
+
+   Most robots only ever touch a few dozen bytes of their RAM, so rather than
+   every VM owning (and zeroing) all of it up front, RAM is split into
+   VM_RAM_PAGE_SIZE byte pages.  Until a page is first written it's backed by
+   one shared, read-only page of zeros;  the first store into it takes a real
+   page, zeroed, from a VMPagePool.  So spawning a VM costs next to nothing,
+   and resident memory follows what robots actually use.
+
+   A VMPageTable keeps two views of its pages:  one to read through, where
+   untouched pages are the zero page, and one to write through, where they're
+   nullptr.  Loads never branch;  a store only has to check for nullptr.
+
+   Pages may be shared between tables, which is how RobotVM::fork() gives a
+   child its parent's memory without copying any of it.  A shared page is
+   readable by each of them but writable by none, so whichever stores into
+   it first gets a copy of its own, the same way an untouched page gets a
+   page of zeros.
+
+   The same nullptr doubles as a cheap way of noticing which pages get
+   written.  markClean() takes away a table's write view of its own pages
+   too, so the first store into each one afterwards goes through
+   materialize(), which hands the page straight back and marks it dirty.
+   Stores after that run as fast as ever, and a table that's never marked
+   clean pays nothing at all.  VMSnapshot uses this to write out only the
+   pages changed since the last checkpoint.  pageHash() does the same to
+   keep each page's hash (see VMStateHash.h) until the page is next written.
+*/
+
+#ifndef VMPAGEPOOL_H
+#define VMPAGEPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "VMInstr.h"
+#include "VMStateHash.h"
+
+//! Bytes per page of VM RAM
+#define VM_RAM_PAGE_SIZE 256
+
+/** Hands out zeroed pages, carving them out of bigger slabs.  Thread-safe:
+    VMs take pages from whichever worker thread happens to run them. */
+class VMPagePool {
+private:
+    static const std::size_t SLAB_PAGES = 64;   //!< Pages allocated from the host at a time
+
+    mutable std::mutex _mutex;
+    std::vector<std::unique_ptr<byte_t[]>> _slabs;
+    std::vector<byte_t*> _free;
+    std::unordered_map<const byte_t*, unsigned int> _sharers;  //!< Owners past the first, of pages that have any
+    std::size_t _inUse;
+
+    byte_t* take();
+
+public:
+    VMPagePool();
+    VMPagePool(const VMPagePool&) = delete;
+    VMPagePool& operator=(const VMPagePool&) = delete;
+
+    //! The shared page of zeros that stands in for every page not yet written
+    static const byte_t* zeroPage();
+    //! VMStateHash::bytes() of zeroPage()
+    static std::uint64_t zeroPageHash();
+
+    //! A page of zeros, all our own
+    byte_t* allocate();
+    //! A page of our own, holding a copy of \a from
+    byte_t* allocate(const byte_t* from);
+    //! Add another owner to \a page, had from allocate()
+    void share(const byte_t* page);
+    //! Drop an owner of \a page, had from allocate(), reusing it once it has none
+    void release(const byte_t* page);
+
+    //! Number of pages handed out and not yet released by every owner
+    std::size_t pagesInUse() const;
+    //! Number of pages got from the host so far, in use or not
+    std::size_t pagesAllocated() const;
+};
+
+/** Where each of a VM's PAGES pages of RAM is */
+template <unsigned int PAGES>
+struct VMPageTable {
+    static_assert(PAGES <= 32, "dirty and clean pages are kept as 32-bit masks");
+
+
+    //! Each page as read:  its own page, or the zero page until first written.
+    //! The extra one at the end is always the zero page;  VMMemPolicy::FAULT points stray loads there.
+    const byte_t* read[PAGES + 1];
+    //! Each page as written:  its own page, or nullptr until first written (or while shared, or clean)
+    byte_t*       write[PAGES];
+    //! Where pages come from
+    VMPagePool*   pool;
+    //! Pages stored into, or shared with another table, since markClean():  bit n for page n
+    std::uint32_t dirty;
+    //! Pages of our own that markClean() or pageHash() took the write view of, and no store has given back
+    std::uint32_t clean;
+    //! Pages whose hash is in hashes, and still right
+    std::uint32_t hashed;
+    std::uint64_t hashes[PAGES];
+
+    //! Every page back to zeros, taking new pages from \a from.  Only for a table with nothing allocated.
+    void init(VMPagePool& from) {
+        for (unsigned int i = 0; i <= PAGES; i++)
+            read[i] = VMPagePool::zeroPage();
+        for (unsigned int i = 0; i < PAGES; i++)
+            write[i] = nullptr;
+        pool = &from;
+        dirty = 0;
+        clean = 0;
+        hashed = 0;
+    }
+    //! Give back every page allocated or shared, leaving all memory zero again
+    void clear() {
+        for (unsigned int i = 0; i < PAGES; i++) {
+            if (read[i] != VMPagePool::zeroPage()) {
+                pool->release(read[i]);
+                write[i] = nullptr;
+                read[i] = VMPagePool::zeroPage();
+            }
+        }
+        dirty = 0;
+        clean = 0;
+        hashed = 0;
+    }
+    /** Share every page of \a from, taking pages from its pool from now on.
+        Neither table may write a shared page any more, so both copy it on
+        their next store.  Only for a table with nothing allocated. */
+    void share(VMPageTable& from) {
+        pool = from.pool;
+        for (unsigned int i = 0; i < PAGES; i++) {
+            if (from.read[i] != VMPagePool::zeroPage()) {
+                from.pool->share(from.read[i]);
+                from.write[i] = nullptr;
+                from.dirty |= 1u << i;   // so the next checkpoint has them shared as well
+            }
+            read[i] = from.read[i];
+            hashes[i] = from.hashes[i];
+        }
+        from.clean = 0;
+        hashed = from.hashed;
+    }
+    /** Start noticing stores afresh:  clear dirty, and take away the write
+        view of every page of our own, so the next store into each goes
+        through materialize() and marks it dirty again. */
+    void markClean() {
+        for (unsigned int i = 0; i < PAGES; i++) {
+            if (write[i]) {
+                write[i] = nullptr;
+                clean |= 1u << i;
+            }
+        }
+        dirty = 0;
+    }
+
+    //! Page \a page, ready to store into
+    byte_t* writable(unsigned int page) {
+        byte_t* p = write[page];
+        return p ? p : materialize(page);
+    }
+    /** Give page \a page a page of its own:  zeros if it had none, a copy of
+        the one it shared, or back the one it had if it's only clean.  Marks it dirty. */
+    byte_t* materialize(unsigned int page) {
+        const byte_t* const was = read[page];
+        const std::uint32_t bit = 1u << page;
+        dirty |= bit;
+        hashed &= ~bit;
+        byte_t* p;
+        if (clean & bit) {
+            clean &= ~bit;
+            p = const_cast<byte_t*>(was);
+        } else if (was == VMPagePool::zeroPage()) {
+            p = pool->allocate();
+        } else {
+            p = pool->allocate(was);
+            pool->release(was);
+        }
+        write[page] = p;
+        read[page] = p;
+        return p;
+    }
+
+    /** VMStateHash::bytes() of page \a page, zeros or not.  Kept until the page
+        is next written, which this has come through materialize() to notice. */
+    std::uint64_t pageHash(unsigned int page) {
+        const std::uint32_t bit = 1u << page;
+        if (read[page] == VMPagePool::zeroPage())
+            return VMPagePool::zeroPageHash();
+        if (!(hashed & bit)) {
+            hashes[page] = VMStateHash::bytes(read[page], VM_RAM_PAGE_SIZE);
+            hashed |= bit;
+            if (write[page]) {
+                write[page] = nullptr;
+                clean |= bit;
+            }
+        }
+        return hashes[page];
+    }
+
+    //! Whether page \a page has a page all its own, clean or not
+    bool owns(unsigned int page) const {
+        return write[page] || (clean >> page & 1);
+    }
+    //! Pages with a page of their own, or a share of one:  bit n for page n
+    std::uint32_t residentMask() const {
+        std::uint32_t mask = 0;
+        for (unsigned int i = 0; i < PAGES; i++)
+            mask |= static_cast<std::uint32_t>(read[i] != VMPagePool::zeroPage()) << i;
+        return mask;
+    }
+    //! Number of pages with a page of their own, or a share of one
+    unsigned int resident() const {
+        unsigned int n = 0;
+        for (unsigned int i = 0; i < PAGES; i++)
+            n += read[i] != VMPagePool::zeroPage();
+        return n;
+    }
+    //! Number of pages shared with some other table, as far as this one knows
+    unsigned int shared() const {
+        unsigned int n = 0;
+        for (unsigned int i = 0; i < PAGES; i++)
+            n += read[i] != VMPagePool::zeroPage() && !owns(i);
+        return n;
+    }
+};
+
+#endif // VMPAGEPOOL_H
@@ -0,0 +1,205 @@
+/* Ports:  how RobotVMs talk to each other, and to the host.
+
+   SEND_RB Rx, p sends the word in Rx to port p;  RECV_RB Rx, p takes the
+   oldest word waiting at port p into Rx.  Which port each number means is
+   up to the VMPortMap the VM is connected to, so any number of VMs may share
+   a set of ports, and the host can send and receive on the same ports they
+   do.
+
+   A port is a bounded ring buffer which any number of VMs and threads may
+   send into and receive from at once, though typically each robot gets a
+   port of its own to listen on.  Neither end ever takes a lock or blocks,
+   so robots being ticked on different worker threads can talk freely, and
+   each word sent is received exactly once, whichever ROM asks for it.
+
+   When a RECV finds its port empty, or a SEND finds it full, the instruction
+   doesn't happen.  The VM stops where it is, PC still on the instruction,
+   and runFor() reports VMStopReason::WAIT_IO;  the next runFor() tries the
+   instruction again.  The thread running it moves on to other VMs meanwhile.
+
+   Sent straight to the port, a message may or may not reach a VM on another
+   thread within the same tick, depending on which of them runs first, and
+   when several VMs receive on one port, which gets which word depends on
+   the order they run in.  For results that never depend on thread timing,
+   give each VM a VMOutbox:  its SENDs then go there instead, and its RECVs
+   wait to be handed a word.  Once the tick is over, VMWorld delivers every
+   outbox, VM by VM in index order, then hands each VM waiting on a RECV the
+   oldest word at its port, again in index order.  Ports only change between
+   ticks, and who gets what only on the VMs' order, so a replay comes out
+   bit-identical however many threads run it.
+*/
+
+#ifndef VMPORT_H
+#define VMPORT_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "VMInstr.h"
+
+//! Number of ports a VMPortMap has room for:  one for each value of a byte
+#define VM_PORT_COUNT 256
+//! Words a port holds unless told otherwise
+#define VM_PORT_DEFAULT_CAPACITY 64
+//! Messages a VMOutbox holds unless told otherwise
+#define VM_OUTBOX_CAPACITY 16
+
+/** A bounded multi-producer multi-consumer queue of words.  Each slot has a
+    sequence number saying whose turn it is:  a sender claims a slot by
+    moving the tail along, writes it, then hands it to the receivers through
+    the sequence number;  a receiver claims it by moving the head along,
+    reads it, then hands it back to the senders a lap on.  Neither end waits
+    on the other, and a receive never sees a half-written word. */
+class VMPort {
+private:
+    struct Slot {
+        std::atomic<std::size_t> seq;
+        word_t value;
+    };
+
+    std::unique_ptr<Slot[]> _slots;
+    const std::size_t _mask;          //!< Capacity - 1
+    char _pad0[64];                   //!< Keeps senders' and receivers' counters off each other's cache lines
+    std::atomic<std::size_t> _tail;   //!< Next slot to send into;  shared by every sender
+    char _pad1[64];
+    std::atomic<std::size_t> _head;   //!< Next slot to receive from;  shared by every receiver
+
+public:
+    //! \param capacity Words the port can hold, rounded up to a power of two (and at least 2)
+    explicit VMPort(std::size_t capacity = VM_PORT_DEFAULT_CAPACITY);
+    VMPort(const VMPort&) = delete;
+    VMPort& operator=(const VMPort&) = delete;
+
+    //! Queue \a value, unless the port is full.  Safe from any number of threads at once.
+    bool trySend(word_t value) {
+        std::size_t pos = _tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = _slots[pos & _mask];
+            const std::size_t seq = slot.seq.load(std::memory_order_acquire);
+            const std::intptr_t diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+            if (diff == 0) {
+                if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.value = value;
+                    slot.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;   // the receiver hasn't got to this slot yet:  full
+            } else {
+                pos = _tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    //! Take the oldest word into \a value, unless the port is empty.  Safe from any number of threads at once.
+    bool tryRecv(word_t& value) {
+        std::size_t pos = _head.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = _slots[pos & _mask];
+            const std::size_t seq = slot.seq.load(std::memory_order_acquire);
+            const std::intptr_t diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = slot.value;
+                    slot.seq.store(pos + _mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;   // nothing sent, or still being written:  empty
+            } else {
+                pos = _head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    //! Words the port can hold
+    std::size_t capacity() const {
+        return _mask + 1;
+    }
+    //! Words waiting, as of some moment during the call
+    std::size_t size() const {
+        const std::size_t head = _head.load(std::memory_order_relaxed);
+        const std::size_t tail = _tail.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+    //! Append every word waiting to \a out, oldest first, without taking any.  Only while nothing sends or receives.
+    void peek(std::vector<word_t>& out) const {
+        const std::size_t tail = _tail.load(std::memory_order_acquire);
+        for (std::size_t pos = _head.load(std::memory_order_relaxed); pos < tail; pos++)
+            out.push_back(_slots[pos & _mask].value);
+    }
+};
+
+/** Which VMPort each port number means.  Open every port before any VM
+    connected to the map runs;  using an unopened port halts the VM with
+    vm_errorstate_t::bad_port. */
+class VMPortMap {
+private:
+    std::unique_ptr<VMPort> _ports[VM_PORT_COUNT];
+
+public:
+    VMPortMap();
+    VMPortMap(const VMPortMap&) = delete;
+    VMPortMap& operator=(const VMPortMap&) = delete;
+
+    //! Open port \a id with room for \a capacity words, replacing whatever was there.  Not while connected VMs run.
+    VMPort& open(byte_t id, std::size_t capacity = VM_PORT_DEFAULT_CAPACITY);
+    //! Close port \a id.  Not while connected VMs run.
+    void close(byte_t id);
+    //! Port \a id, or nullptr if it isn't open
+    VMPort* at(byte_t id) const {
+        return _ports[id].get();
+    }
+};
+
+/** A message held in a VMOutbox */
+struct vm_message_t {
+    word_t value;
+    byte_t port;
+};
+
+/** Messages one VM has sent, held back until they're delivered.  Only ever
+    touched by the thread running its VM, or between ticks, so it needs no
+    synchronization.  When it's full, SEND_RB waits just as it would on a
+    full port. */
+class VMOutbox {
+private:
+    std::vector<vm_message_t> _msgs;  //!< In the order sent
+    std::size_t _capacity;
+
+public:
+    explicit VMOutbox(std::size_t capacity = VM_OUTBOX_CAPACITY);
+
+    //! Hold \a value for \a port, unless the outbox is full
+    bool push(byte_t port, word_t value) {
+        if (_msgs.size() >= _capacity)
+            return false;
+        _msgs.push_back(vm_message_t{value, port});
+        return true;
+    }
+    //! Messages waiting to be delivered
+    std::size_t size() const {
+        return _msgs.size();
+    }
+    //! The messages themselves, in the order sent
+    const std::vector<vm_message_t>& messages() const {
+        return _msgs;
+    }
+    std::size_t capacity() const {
+        return _capacity;
+    }
+    //! Throw away everything not yet delivered
+    void clear() {
+        _msgs.clear();
+    }
+
+    /** Send everything held to its port in \a ports, in the order it was sent.
+        Stops at the first port that's full, keeping that message and all after
+        it for next time, so messages never overtake one another.  Messages for
+        a port that has since been closed are dropped.
+        \return Number of messages that reached a port */
+    std::size_t deliver(const VMPortMap& ports);
+};
+
+#endif // VMPORT_H
@@ -0,0 +1,24 @@
+/* Self-checks for the VM.  Not part of the VM proper;  the dashboard runs
+   these and prints what they find when started with --check, exiting
+   non-zero if anything disagrees. */
+
+#ifndef VMSELFCHECK_H
+#define VMSELFCHECK_H
+
+#include <cstdio>
+
+//! Run \a programs random programs on every VMEngine, with and without superinstructions
+//! and fixed-register handlers, comparing each with RobotVM::stepRaw() running the same
+//! program.  Prints each mismatch to \a out and returns how many there were.
+int checkEngines(std::FILE* out, int programs);
+
+//! Tick a world whose VMs, forks among them, send and receive on shared ports under
+//! deterministic messaging, on one thread and on several, comparing
+//! VMWorld::stateHash() after every tick.  Prints each mismatch to \a out and returns
+//! how many there were.
+int checkWorldThreads(std::FILE* out);
+
+//! Run every self-check there is, printing results to \a out.  Returns the number of failures.
+int runSelfChecks(std::FILE* out);
+
+#endif // VMSELFCHECK_H
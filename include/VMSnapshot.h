@@ -0,0 +1,187 @@
+/* Whole-world checkpoints, in a file.
+
+   VMSnapshot::save() writes out everything a VMWorld needs to carry on from
+   exactly where it was:  every VM's registers, flags, error state, RAM,
+   stack and ROM, the words waiting in each open port and in each VM's
+   outbox, and the world's tick count, budget and messaging mode.
+   VMSnapshot::restore() puts a world back the way it was from one.
+
+   The file is a vm_snapshot_header_t followed by sections, each an array of
+   fixed-size records starting on a 64-byte boundary:
+
+     ROM directory, ROM bytes   each distinct RomImage once, however many VMs run it
+     VMs                        a vm_snapshot_vm_t for each VM, in index order
+     page references, pages     each RAM and stack page in use, once however many VMs share it
+     ports, port words          each open port and the words waiting in it
+     outboxes, messages         each outbox with anything in it
+
+   Pages never written aren't in the file at all, so robots that only use a
+   little of their RAM make a small snapshot.  Each section is written in
+   one go (pages a few thousand at a time), and restore() maps the file and
+   reads the records straight out of it, so checkpointing costs little more
+   than the disk does.  A restored world shares ROM images and pages between
+   its VMs just as the saved one did.
+
+   Most robots only rewrite a few bytes of their RAM between one checkpoint
+   and the next, so there's no need to write all of it every time.
+   VMSnapshot::checkpoint() saves the whole world as save() does, then has
+   each VM's page tables note which pages get stored into from then on (see
+   VMPageTable::markClean()).  checkpointChanges() then saves only the pages
+   written since the last checkpoint, of either kind, along with the rest of
+   the world as usual, which is small.  Each file says which checkpoint it
+   follows on from, so a chain of them is restored, to the tick of any one,
+   by restoring the whole one it starts with and each after it in turn up to
+   that one.  A VM's unchanged pages come from whichever file in the chain
+   last had them.  Restoring leaves the world noting changes from the last
+   file of the chain, so checkpoints can carry on from there.
+
+   Records are in the host's own byte order;  a snapshot from a host that
+   differs, or of another version of the format, is refused rather than
+   misread, as is one that's been cut short or is otherwise inconsistent.
+   Not saved, as they belong to the host rather than to the world:  trace
+   sinks, JIT code and predecoded ROM (rebuilt as needed), superinstruction
+   hit counts, worker stats, which shard each VM is in, and the tick deadline.
+*/
+
+#ifndef VMSNAPSHOT_H
+#define VMSNAPSHOT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "VMSnapshotException.h"
+
+class VMWorld;
+
+//! Version of the snapshot format VMSnapshot writes, and the only one it reads
+#define VM_SNAPSHOT_VERSION 2
+
+/** Where a section is in a snapshot file */
+struct vm_snapshot_section_t {
+    std::uint64_t offset;  //!< Bytes from the start of the file
+    std::uint64_t count;   //!< Number of records
+};
+
+/** The start of every snapshot file */
+struct vm_snapshot_header_t {
+    char          magic[8];       //!< "RBHSNAP", then a 0
+    std::uint32_t version;        //!< VM_SNAPSHOT_VERSION
+    std::uint32_t byteOrder;      //!< 0x01020304, as the host that wrote it stores it
+    std::uint32_t pageSize;       //!< VM_RAM_PAGE_SIZE
+    std::uint32_t ramPages;       //!< Pages of RAM per VM;  after them comes one of stack
+    std::uint64_t fileSize;       //!< Bytes in the whole file
+    std::uint64_t ticks;          //!< VMWorld::ticks()
+    std::uint64_t budget;         //!< VMWorld::budget()
+    std::uint64_t batchSize;      //!< VMWorld::batchSize()
+    std::uint32_t deterministic;  //!< VMWorld::deterministicMessaging()
+    std::uint32_t reserved;
+    std::uint64_t id;             //!< Which checkpoint this is, never 0
+    std::uint64_t base;           //!< The checkpoint this one has only the changes since, or 0 if it has everything
+    vm_snapshot_section_t roms;       //!< vm_snapshot_rom_t
+    vm_snapshot_section_t romBytes;   //!< Bytes of every ROM image, one after the other
+    vm_snapshot_section_t vms;        //!< vm_snapshot_vm_t
+    vm_snapshot_section_t pageRefs;   //!< uint32_t:  for each VM in turn, the page number of each of its pages in use
+    vm_snapshot_section_t pages;      //!< VM_RAM_PAGE_SIZE bytes each
+    vm_snapshot_section_t ports;      //!< vm_snapshot_port_t
+    vm_snapshot_section_t portWords;  //!< uint16_t:  every word waiting in a port, oldest first
+    vm_snapshot_section_t outboxes;   //!< vm_snapshot_outbox_t
+    vm_snapshot_section_t messages;   //!< vm_snapshot_message_t
+};
+
+/** A ROM image */
+struct vm_snapshot_rom_t {
+    std::uint64_t offset;  //!< Into the ROM bytes
+    std::uint32_t size;    //!< Bytes burned
+    std::uint32_t reserved;
+};
+
+/** A VM */
+struct vm_snapshot_vm_t {
+    std::int16_t  r[4];       //!< vm_regs_t
+    std::uint16_t pc, sp, ix;
+    std::uint8_t  halted;
+    std::uint8_t  waiting;
+    std::uint8_t  errors;     //!< vm_errorstate_t, a bit per flag in the order declared
+    std::uint8_t  waitFor;    //!< VMWaitReason
+    std::uint8_t  waitPort;
+    std::uint8_t  woke;
+    std::uint8_t  engine;     //!< VMEngine
+    std::uint8_t  options;    //!< VM_SNAPSHOT_SUPEROPS, VM_SNAPSHOT_FIXEDREGS and VM_SNAPSHOT_HEXREGS
+    std::uint16_t sleep;      //!< Ticks a WAIT_W has left to sleep
+    std::uint32_t rom;        //!< Into the ROM directory
+    std::uint32_t pages;      //!< Which pages are in use:  bit n for RAM page n, then a bit for the stack
+    std::uint32_t changed;    //!< Which of those are in this file;  the rest are as the base had them
+    std::uint32_t previous;   //!< This VM's index in the base, or VM_SNAPSHOT_NEW
+    std::uint32_t reserved;
+    std::uint64_t firstPage;  //!< Into the page references, where this VM's changed pages begin
+};
+
+//! vm_snapshot_vm_t::previous for a VM not in the base, or in a snapshot that has everything
+#define VM_SNAPSHOT_NEW 0xffffffffu
+
+//! vm_snapshot_vm_t::options:  RobotVM::superOps()
+#define VM_SNAPSHOT_SUPEROPS  1
+//! vm_snapshot_vm_t::options:  RobotVM::fixedRegHandlers()
+#define VM_SNAPSHOT_FIXEDREGS 2
+//! vm_snapshot_vm_t::options:  RobotVM::hexRegs()
+#define VM_SNAPSHOT_HEXREGS   4
+
+/** An open port */
+struct vm_snapshot_port_t {
+    std::uint32_t id;
+    std::uint32_t capacity;
+    std::uint64_t firstWord;  //!< Into the port words
+    std::uint64_t words;      //!< Number waiting
+};
+
+/** An outbox with messages waiting */
+struct vm_snapshot_outbox_t {
+    std::uint64_t vm;            //!< Index of the VM it belongs to
+    std::uint64_t firstMessage;  //!< Into the messages
+    std::uint64_t messages;      //!< Number waiting
+};
+
+/** A message waiting in an outbox */
+struct vm_snapshot_message_t {
+    std::uint16_t value;
+    std::uint8_t  port;
+    std::uint8_t  reserved;
+};
+
+class VMSnapshot {
+private:
+    //! Write \a world to \a path as checkpoint \a id:  everything, or if \a base isn't 0, the changes since checkpoint \a base
+    static void write(const VMWorld& world, const char* path, std::uint64_t id, std::uint64_t base);
+    //! Have \a world note changes from checkpoint \a id, which it's just been saved as or restored from
+    static void markSaved(VMWorld& world, std::uint64_t id);
+
+public:
+    /** Write the whole of \a world to the file at \a path, replacing it.  Only
+        between ticks.  Throws VMSnapshotException if the file can't be written. */
+    static void save(const VMWorld& world, const char* path);
+    /** save(), then note which pages are written from now on, for
+        checkpointChanges().  If the file can't be written, throws
+        VMSnapshotException and keeps noting changes since the last one. */
+    static void checkpoint(VMWorld& world, const char* path);
+    /** Write \a world to the file at \a path, replacing it, with only the pages
+        written since the last checkpoint() or checkpointChanges() of it, or
+        restore() into it.  Throws VMSnapshotException if there hasn't been
+        one, or if the file can't be written, in which case changes are still
+        noted since the last one. */
+    static void checkpointChanges(VMWorld& world, const char* path);
+
+    /** Replace everything in \a world with the snapshot in the file at \a path:
+        VMs, ports and outboxes, tick count, budget, batch size and messaging
+        mode.  VMs are dealt out to shards as if newly spawned.  Only between
+        ticks.  Throws VMSnapshotException, leaving \a world as it was, if the
+        file can't be read, isn't a snapshot this version can read, or only
+        has the changes since another checkpoint. */
+    static void restore(VMWorld& world, const char* path);
+    /** restore() \a world to the last of the files in \a chain, the first of
+        which has everything and each of the rest the changes since the one
+        before it.  Throws VMSnapshotException, leaving \a world as it was, if
+        any of them can't be read, or they aren't such a chain. */
+    static void restore(VMWorld& world, const std::vector<std::string>& chain);
+};
+
+#endif // VMSNAPSHOT_H
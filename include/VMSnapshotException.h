@@ -0,0 +1,15 @@
+#ifndef VMSNAPSHOTEXCEPTION_H
+#define VMSNAPSHOTEXCEPTION_H
+
+#include <stdexcept>
+#include <string>
+
+//! Thrown by VMSnapshot when a snapshot can't be written, or read back
+class VMSnapshotException : public std::runtime_error {
+public:
+    explicit VMSnapshotException(const std::string& msg)
+        : std::runtime_error(msg) {
+    }
+};
+
+#endif // VMSNAPSHOTEXCEPTION_H
@@ -0,0 +1,116 @@
+/* Storage for the state of many RobotVMs at once.
+
+   Each VM owns a slot.  The hot state of every slot (registers, halt, wait
+   and fault flags) is kept in structure-of-arrays form:  a scan over the whole
+   population, like "how many robots are halted", walks a few small dense
+   arrays instead of hopping through kilobytes of each VM.  Page tables for
+   RAM and stack live alongside, their pages coming from the arena's
+   VMPagePool as VMs first write them.  On a NUMA host the arena may keep a
+   pool per node instead, so that a VM placed on a node gets pages first
+   touched, and so allocated, by threads running there.
+
+   Slots are handed out from chunks that never move once allocated, so a
+   RobotVM may keep plain pointers into its slot for as long as it lives.
+   A freed slot goes back on a free list for the next VM.  A slot may also be
+   retired without being freed, keeping it for a VM that a RobotVMPool holds
+   on to for reuse.
+
+   Acquiring and releasing slots isn't thread-safe;  a VM may of course use
+   its own slot from whichever thread is running it.
+*/
+
+#ifndef VMSTATEARENA_H
+#define VMSTATEARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "VMInstr.h"
+#include "VMMemory.h"
+#include "VMPagePool.h"
+
+struct vm_regs_t;
+struct vm_errorstate_t;
+
+//! Slots per chunk a VMStateArena allocates by default
+#define VM_ARENA_CHUNK 256
+
+class VMStateArena {
+public:
+    typedef std::size_t slot_t;
+
+private:
+    struct Chunk;
+    std::vector<std::unique_ptr<Chunk>> _chunks;
+    std::vector<slot_t> _free;     //!< Released slots, reused last-in first-out
+    std::size_t _chunkSlots;       //!< Slots per chunk
+    std::size_t _live;             //!< Slots currently acquired
+    std::vector<std::unique_ptr<VMPagePool>> _pools;  //!< Where RAM pages come from, one pool per NUMA node
+
+    Chunk& chunkOf(slot_t slot) const {
+        return *_chunks[slot / _chunkSlots];
+    }
+    //! Zero \a slot's registers and flags
+    void clearState(slot_t slot);
+
+public:
+    //! \param chunkSlots Number of slots to allocate at a time.  Use 1 for an arena holding a single VM.
+    explicit VMStateArena(std::size_t chunkSlots = VM_ARENA_CHUNK);
+    ~VMStateArena();
+    VMStateArena(const VMStateArena&) = delete;
+    VMStateArena& operator=(const VMStateArena&) = delete;
+
+    //! Take a free slot, with its registers, flags, RAM and stack cleared
+    slot_t acquire();
+    //! Hand \a slot back for reuse
+    void release(slot_t slot);
+    /** Stop counting \a slot as in use, without handing it back:  its RAM and
+        stack pages go back to the pool and its registers and flags are cleared,
+        but it stays reserved until revive() or release(). */
+    void retire(slot_t slot);
+    //! Put a slot retired with retire() back in use
+    void revive(slot_t slot);
+
+    //! Number of slots there's room for without allocating another chunk
+    std::size_t capacity() const {
+        return _chunks.size() * _chunkSlots;
+    }
+    //! Number of slots currently acquired
+    std::size_t live() const {
+        return _live;
+    }
+    //! Whether \a slot is currently acquired.  \a slot must be < capacity().
+    bool inUse(slot_t slot) const;
+
+    vm_regs_t&       regs(slot_t slot);
+    bool&            halted(slot_t slot);
+    //! Whether the VM is stopped on a port;  see VMPort.h
+    bool&            waiting(slot_t slot);
+    vm_errorstate_t& errors(slot_t slot);
+    //! VM_RAM_SIZE bytes of RAM, in pages
+    vm_ram_t&        ram(slot_t slot);
+    //! VM_STACK_SIZE bytes of stack, as a page
+    vm_stack_t&      stack(slot_t slot);
+
+    //! Number of acquired slots whose VM is halted, not counting those waiting on a port
+    std::size_t countHalted() const;
+    //! Number of acquired slots whose VM is waiting on a port
+    std::size_t countWaiting() const;
+    //! Keep a separate page pool for each of \a nodes NUMA nodes.  Never fewer than there were.
+    void setNodes(unsigned int nodes);
+    //! Number of page pools, one per NUMA node
+    unsigned int nodes() const {
+        return static_cast<unsigned int>(_pools.size());
+    }
+    /** Have \a slot take RAM and stack pages from node \a node's pool.  Only
+        for a slot with no pages yet;  acquire() starts every slot on node 0. */
+    void place(slot_t slot, unsigned int node);
+    //! Where RAM and stack pages on node \a node come from, ex: to see how many are in use
+    const VMPagePool& pagePool(unsigned int node = 0) const {
+        return *_pools[node];
+    }
+    //! Number of RAM and stack pages in use, over every node
+    std::size_t pagesInUse() const;
+};
+
+#endif // VMSTATEARENA_H
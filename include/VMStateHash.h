@@ -0,0 +1,76 @@
+/* Fingerprints of VM state, cheap enough to take every tick.
+
+   Two runs of the same world, on whatever host and however many threads,
+   should stay bit-identical;  comparing a hash of each VM, or of the whole
+   world (see RobotVM::stateHash() and VMWorld::stateHash()), is a quick way
+   to spot the tick where they part, or to find VMs in the same state.
+   These are checksums, not cryptographic hashes.
+
+   Bytes are hashed 32 at a time in eight independent 32-bit lanes, each a
+   multiply and a rotate per word, which compilers turn into a few vector
+   instructions per round.  Words are read little-endian whatever the host,
+   so hashes are the same everywhere.  A VM's RAM and stack are hashed a
+   page at a time, and each page's hash kept until the page is next written
+   (see VMPageTable::pageHash()), so hashing a VM that's only touched one
+   page since last time costs hashing one page.
+*/
+
+#ifndef VMSTATEHASH_H
+#define VMSTATEHASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "VMInstr.h"
+
+class VMStateHash {
+private:
+    static const unsigned int LANES = 8;           //!< 32-bit lanes hashed side by side
+    static const unsigned int BLOCK = LANES * 4;   //!< Bytes per round
+    static const std::uint32_t PRIME1 = 0x9E3779B1u;
+    static const std::uint32_t PRIME2 = 0x85EBCA77u;
+
+    static std::uint32_t load(const byte_t* p) {
+        return static_cast<std::uint32_t>(p[0]) | static_cast<std::uint32_t>(p[1]) << 8
+               | static_cast<std::uint32_t>(p[2]) << 16 | static_cast<std::uint32_t>(p[3]) << 24;
+    }
+    static void round(std::uint32_t (&acc)[LANES], const byte_t* block) {
+        for (unsigned int i = 0; i < LANES; i++) {
+            const std::uint32_t x = acc[i] + load(block + 4 * i) * PRIME2;
+            acc[i] = ((x << 13) | (x >> 19)) * PRIME1;
+        }
+    }
+
+public:
+    //! Every bit of \a x stirred into every other
+    static std::uint64_t finish(std::uint64_t x) {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+    //! \a h with \a v folded in after it, so that order matters
+    static std::uint64_t mix(std::uint64_t h, std::uint64_t v) {
+        return finish(h ^ (v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2)));
+    }
+
+    //! Hash of the \a len bytes at \a data
+    static std::uint64_t bytes(const byte_t* data, std::size_t len, std::uint64_t seed = 0) {
+        std::uint32_t acc[LANES];
+        for (unsigned int i = 0; i < LANES; i++)
+            acc[i] = static_cast<std::uint32_t>(seed) + PRIME1 * (i + 1);
+        std::size_t at = 0;
+        for (; at + BLOCK <= len; at += BLOCK)
+            round(acc, data + at);
+        if (at < len) {
+            byte_t tail[BLOCK] = { 0 };
+            std::memcpy(tail, data + at, len - at);
+            round(acc, tail);
+        }
+        std::uint64_t h = seed ^ len;
+        for (unsigned int i = 0; i < LANES; i += 2)
+            h = mix(h, static_cast<std::uint64_t>(acc[i]) << 32 | acc[i + 1]);
+        return h;
+    }
+};
+
+#endif // VMSTATEHASH_H
@@ -0,0 +1,94 @@
+/* Trace sinks for observing a RobotVM while it burns and executes code.
+
+   A RobotVM has no sink attached by default, in which case it runs its
+   instructions through VMNullTraceSink:  a do-nothing policy whose inline
+   methods the compiler throws away entirely.  Attach a VMTextTraceSink to
+   get the old register/stack dump on stdout after every instruction, or a
+   VMBinaryTraceSink to record fixed-size trace records for tooling.
+*/
+
+#ifndef VMTRACE_H
+#define VMTRACE_H
+
+#include <cstdio>
+#include <vector>
+#include "VMInstr.h"
+
+class RobotVM;
+
+/** Interface for anything wanting to observe a RobotVM.  Attach one with
+    RobotVM::setTraceSink(). */
+class VMTraceSink {
+public:
+    //! Called after \a instr, fetched from address \a pcbefore, was executed.
+    virtual void traceExec(const RobotVM& vm, const vm_instr_t& instr, word_t pcbefore) = 0;
+    //! Called after burn() wrote \a len bytes into ROM at address \a at.
+    virtual void traceBurn(const RobotVM& vm, addr_t at, unsigned int len) = 0;
+    //! Called when the VM ran into something odd but non-fatal (ex: POP on an empty stack).
+    virtual void traceWarning(const RobotVM& vm, const char* msg) = 0;
+
+    virtual ~VMTraceSink() {
+    }
+};
+
+/** Compile-time stand-in used by RobotVM when no VMTraceSink is attached.
+    Intentionally NOT derived from VMTraceSink so calls never go through a vtable. */
+struct VMNullTraceSink {
+    void traceExec(const RobotVM&, const vm_instr_t&, word_t) const {
+    }
+    void traceBurn(const RobotVM&, addr_t, unsigned int) const {
+    }
+    void traceWarning(const RobotVM&, const char*) const {
+    }
+};
+
+/** Prints registers and stack to stdout after every instruction, exactly like
+    RobotVM always used to before trace sinks existed. */
+class VMTextTraceSink : public VMTraceSink {
+public:
+    void traceExec(const RobotVM& vm, const vm_instr_t& instr, word_t pcbefore) override;
+    void traceBurn(const RobotVM& vm, addr_t at, unsigned int len) override;
+    void traceWarning(const RobotVM& vm, const char* msg) override;
+};
+
+/** One executed instruction, as written by VMBinaryTraceSink.  Fixed-size and
+    in host byte order so external tools can simply fread an array of these. */
+struct vm_trace_record_t {
+    word_t  pc;          //!< Address the instruction was fetched from
+    byte_t  instr[4];    //!< Raw instruction window (opcode + 3 operand bytes)
+    sword_t r[4];        //!< General registers after execution
+    word_t  sp;          //!< Stack Pointer after execution
+    word_t  nextpc;      //!< Program Counter after execution (before step()'s auto-increment)
+};
+
+/** Appends a vm_trace_record_t per executed instruction to a FILE*.  Records
+    are buffered and written out in large chunks.  Burns and warnings are
+    ignored. */
+class VMBinaryTraceSink : public VMTraceSink {
+private:
+    std::FILE* _out;                          //!< Not owned
+    std::vector<vm_trace_record_t> _buffer;   //!< Pending records
+    unsigned long _written;                   //!< Total records written so far
+
+public:
+    explicit VMBinaryTraceSink(std::FILE* out, std::size_t bufferedRecords = 4096);
+    VMBinaryTraceSink(const VMBinaryTraceSink&) = delete;
+    VMBinaryTraceSink& operator=(const VMBinaryTraceSink&) = delete;
+
+    void traceExec(const RobotVM& vm, const vm_instr_t& instr, word_t pcbefore) override;
+    void traceBurn(const RobotVM&, addr_t, unsigned int) override {
+    }
+    void traceWarning(const RobotVM&, const char*) override {
+    }
+
+    //! Write out any buffered records
+    void flush();
+    //! Number of records handed to the FILE* so far
+    unsigned long written() const {
+        return _written;
+    }
+
+    virtual ~VMBinaryTraceSink();
+};
+
+#endif // VMTRACE_H
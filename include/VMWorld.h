@@ -0,0 +1,275 @@
+/* A population of RobotVMs, ticked all together across every core.
+
+   Each tick() runs every VM for up to its instruction budget, VMs being
+   split into batches that a TickScheduler spreads over its worker threads.
+   tick() returns once every VM is done, so between ticks the whole world
+   may be looked at or changed from a single thread without any locking.
+
+   Each VM belongs to a shard, one per worker, which that worker starts
+   every tick with;  spawned VMs go to the smallest shard, forks to their
+   parent's.  A pinned world pins each worker to a CPU, spread over the
+   host's NUMA nodes, and has its shard's VMs take their RAM and stack pages
+   from a pool on that node.  Pages are first written by the worker running
+   the VM, so the OS puts them on the worker's node, and the VM's memory
+   stays local to where it runs unless another worker has to steal it.
+
+   Every VM's registers, flags, RAM and stack live in the world's
+   VMStateArena, so scanning the whole population stays cheap.  VMs come
+   from a RobotVMPool, so despawning and spawning robots every tick doesn't
+   touch the heap.
+
+   Every VM spawned is connected to the world's VMPortMap, through which VMs
+   and the host may message each other, even during a tick.  With
+   deterministic messaging on, messages sent during a tick are only
+   delivered at its end instead, and handed to the VMs waiting on their
+   ports in index order (see VMPort.h), so that a world ticked on any number
+   of threads behaves exactly the same.
+
+   A VM left waiting at the end of a tick, on a port or asleep on WAIT_W, is
+   parked:  ticks skip it altogether, rather than having it find its port
+   empty again and again, until its port has a word (or room) for it or its
+   sleep runs out.  Checking costs a look at each port with VMs parked on it
+   and at the earliest wake-up time, however many VMs are parked.
+
+   A world may be given a deadline for each tick instead of a fixed budget,
+   in which case a TickBudgetController picks each tick's budget from how
+   long the last ones took, never above budget().  Its decisions are in
+   budgetStats(), and each tick's stats say what budget it ran on.
+
+   Between ticks, the whole world may be saved to a file and restored from
+   it with VMSnapshot, whole or, once checkpointed, just what's changed since.
+   stateHash() fingerprints the whole world, VMs and messages in flight, and
+   each tick may do so too, so that two runs that ought to be identical can
+   be checked tick by tick.
+
+   Otherwise VMs in
+   a world run concurrently with each other, so while a tick is in progress
+   they must not share anything mutable:  in particular, don't attach the
+   same VMTraceSink to more than one of them.
+*/
+
+#ifndef VMWORLD_H
+#define VMWORLD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "RobotVM.h"
+#include "RobotVMPool.h"
+#include "TickBudgetController.h"
+#include "TickScheduler.h"
+#include "VMPort.h"
+#include "VMStateArena.h"
+
+//! Default instruction budget per VM per tick
+#define VM_WORLD_DEFAULT_BUDGET 1000
+//! Default number of VMs in a batch
+#define VM_WORLD_DEFAULT_BATCH  64
+//! Default least instruction budget per VM per tick, when ticking to a deadline
+#define VM_WORLD_MIN_BUDGET     16
+
+/** What happened during one VMWorld::tick() */
+struct vm_tick_stats_t {
+    unsigned long tick = 0;          //!< Which tick this was, counting from 1
+    unsigned long instructions = 0;  //!< Instructions executed, over every VM
+    unsigned long budget = 0;        //!< Instructions each VM was allowed
+    double        seconds = 0.0;     //!< Wall-clock time the tick took
+    unsigned long messages = 0;      //!< Messages delivered at the end of the tick, under deterministic messaging
+    std::size_t   ran = 0;           //!< VMs run:  every VM but those parked
+    std::size_t   woken = 0;         //!< Parked VMs woken up to run this tick
+    std::size_t   parked = 0;        //!< VMs parked at the end of the tick, woken or not
+    std::uint64_t hash = 0;          //!< VMWorld::stateHash() at the end of the tick, if setTickHashing() is on
+};
+
+class VMWorld {
+    friend class VMSnapshot;
+
+private:
+    RobotVMPool     _pool;       //!< Owns every VM and its state
+    std::vector<RobotVM*> _vms;  //!< VMs in the world, as spawned from _pool
+    VMPortMap       _ports;      //!< Every VM is connected to these
+    bool            _deterministic;  //!< Whether VMs send through _outboxes
+    std::vector<std::unique_ptr<VMOutbox>> _outboxes;  //!< Each VM's, by index, under deterministic messaging
+    std::vector<std::vector<RobotVM*>> _runnable;  //!< VMs the next tick runs, by shard:  all but the parked ones, in no particular order
+    bool            _reschedule;  //!< _runnable has VMs no longer in the world, and needs building again
+    std::vector<std::size_t> _population;  //!< VMs in each shard, parked or not
+    std::vector<RobotVM*> _ticking;        //!< The VMs a tick is running, shard after shard
+    std::vector<std::size_t> _tickShards;  //!< How many of _ticking are in each shard
+    std::vector<RobotVM*> _parkedOn[VM_PORT_COUNT];  //!< VMs parked on a RECV_RB or SEND_RB, by port
+    std::vector<std::pair<unsigned long, RobotVM*>> _sleepers;  //!< VMs parked on a WAIT_W, as a heap by the tick to wake them in
+    std::size_t     _parked;     //!< VMs parked
+    TickScheduler   _scheduler;
+    unsigned long   _budget;     //!< Instructions per VM per tick, or the most there may be when ticking to a deadline
+    std::unique_ptr<TickBudgetController> _deadline;  //!< Picks each tick's budget, if ticking to a deadline
+    std::size_t     _batchSize;  //!< VMs per batch handed to a worker
+    unsigned long   _ticks;      //!< Ticks run so far
+    std::uint64_t   _checkpoint; //!< The last checkpoint VMSnapshot saved of the world or restored it from, 0 if none
+    bool            _tickHashing;  //!< Whether each tick ends with stateHash()
+    std::vector<std::uint64_t> _hashes;  //!< Each VM's stateHash(), by index, while stateHash() works them out
+
+    //! A blank VM from _pool, its state placed for the shard spawn() would put it in, which goes in \a shard
+    RobotVM* create(unsigned int& shard);
+    //! Add \a vm, just spawned from _pool, to the end of the world, in shard \a shard
+    RobotVM& adopt(RobotVM* vm, unsigned int shard);
+    //! Deliver every VM's outbox, in index order, returning the number of messages delivered
+    unsigned long deliver();
+    //! Hand each VM waiting on a RECV_RB the oldest word at its port, in index order, waking those parked
+    void handOut();
+    //! Take \a vm, which is waiting, out of the ticks until what it waits for happens
+    void park(RobotVM* vm);
+    //! Take \a vm off whichever list park() put it on
+    void unpark(RobotVM* vm);
+    //! Move every parked VM that has something to do back into its shard of _runnable, returning how many did
+    std::size_t wakeParked();
+    //! Ticks \a vm has left to sleep:  for one parked on a WAIT_W, whose own count stands still, till the world wakes it
+    word_t sleepLeft(const RobotVM& vm) const;
+    /** Each VM's sleep left, by index:  its own count, or for one parked on a
+        WAIT_W, whose own count stands still, the ticks till the world wakes it */
+    std::vector<word_t> sleepsLeft() const;
+
+public:
+    /** \param threads Worker threads to tick with.  0 means one per hardware thread.
+        \param pinned Whether to pin workers to CPUs and keep each shard's memory on its node */
+    explicit VMWorld(unsigned int threads = 0, bool pinned = false);
+    VMWorld(const VMWorld&) = delete;
+    VMWorld& operator=(const VMWorld&) = delete;
+
+    //! Create a new, blank VM, connected to ports().  It gets index size() - 1.
+    RobotVM& spawn();
+    //! Create a new VM running \a rom, shared with every other VM running it.  It gets index size() - 1.
+    RobotVM& spawn(const std::shared_ptr<const RomImage>& rom);
+    /** Create a copy of VM number \a index (see RobotVM::fork()), sharing its RAM
+        and stack until either writes them.  It gets index size() - 1.  Not while
+        a tick is in progress. */
+    RobotVM& fork(std::size_t index);
+    /** Remove VM number \a index from the world, handing it back to the pool.
+        The last VM moves into its place, so only index size() - 1 changes.
+        Not while a tick is in progress. */
+    void despawn(std::size_t index);
+    //! Number of VMs in the world
+    std::size_t size() const {
+        return _vms.size();
+    }
+    RobotVM& operator[](std::size_t index) {
+        return *_vms[index];
+    }
+    const RobotVM& operator[](std::size_t index) const {
+        return *_vms[index];
+    }
+
+    //! Set the number of instructions each VM may run per tick:  the most they may, when ticking to a deadline
+    void setBudget(unsigned long budget);
+    unsigned long budget() const {
+        return _budget;
+    }
+    /** Pick each tick's budget so that a fraction \a percentile of ticks take no
+        longer than \a seconds, somewhere between \a minBudget and budget().  0
+        seconds goes back to running every tick on budget().  Either way, starts
+        from budget(). */
+    void setTickDeadline(double seconds, double percentile = 0.99,
+                         unsigned long minBudget = VM_WORLD_MIN_BUDGET);
+    //! Seconds a tick may take, or 0 if ticks run on budget()
+    double tickDeadline() const {
+        return _deadline ? _deadline->deadline() : 0.0;
+    }
+    //! What's been decided about budgets since setTickDeadline(), if ticking to a deadline
+    tick_budget_stats_t budgetStats() const {
+        return _deadline ? _deadline->stats() : tick_budget_stats_t();
+    }
+    //! Set the number of VMs a worker runs per batch
+    void setBatchSize(std::size_t vms) {
+        _batchSize = vms ? vms : 1;
+    }
+    std::size_t batchSize() const {
+        return _batchSize;
+    }
+    //! Number of worker threads ticking the world
+    unsigned int threads() const {
+        return _scheduler.threads();
+    }
+    //! Whether workers are pinned to CPUs, and shards' memory to their nodes
+    bool pinned() const {
+        return _scheduler.pinned();
+    }
+    //! Number of shards:  one per worker thread
+    unsigned int shards() const {
+        return static_cast<unsigned int>(_population.size());
+    }
+    //! Number of VMs in shard \a shard, parked or not
+    std::size_t shardSize(unsigned int shard) const {
+        return _population[shard];
+    }
+    //! NUMA node shard \a shard's worker runs on
+    unsigned int shardNode(unsigned int shard) const {
+        return _scheduler.workerNode(shard);
+    }
+    //! Number of VMs that are halted.  Only looks at the arena, so it's quick even for big worlds.
+    std::size_t halted() const {
+        return _pool.arena().countHalted();
+    }
+    //! Number of VMs stopped on a port or asleep
+    std::size_t waiting() const {
+        return _pool.arena().countWaiting();
+    }
+    //! Number of VMs the ticks are skipping until what they wait for happens
+    std::size_t parked() const {
+        return _parked;
+    }
+    /** Put VM number \a index back into the ticks, if it's parked, cutting any
+        WAIT_W short.  Parked VMs wake up by themselves when there's something
+        for them;  this is for VMs the host changed, ex: reset(), or wants to
+        hurry along.  Not while a tick is in progress. */
+    void wake(std::size_t index);
+    //! The ports every VM in the world is connected to.  Open them before ticking.
+    VMPortMap& ports() {
+        return _ports;
+    }
+    /** Turn deterministic messaging on or off (it starts off).  When on, each
+        VM's SENDs during a tick are held in an outbox of its own, and delivered
+        VM by VM in index order once every VM is done;  then each VM waiting on
+        a RECV_RB is handed the oldest word at its port, in index order, and
+        carries on past it next tick.  Turning it off delivers whatever is
+        still held.  Not while a tick is in progress. */
+    void setDeterministicMessaging(bool enable);
+    bool deterministicMessaging() const {
+        return _deterministic;
+    }
+    //! Bytes of RAM and stack the world's VMs have actually written to, in whole pages, each shared page counted once
+    std::size_t residentRam() const {
+        return _pool.arena().pagesInUse() * VM_RAM_PAGE_SIZE;
+    }
+    //! Number of ticks run so far
+    unsigned long ticks() const {
+        return _ticks;
+    }
+    /** Fingerprint of the world:  the tick count, every VM's stateHash(index)
+        in index order, worked out on every worker, and the messages in flight,
+        words waiting in ports and held in outboxes.  The same on any host and
+        however many threads tick it.  Not while a tick is in progress. */
+    std::uint64_t stateHash();
+    /** RobotVM::stateHash() of VM number \a index, counting a parked sleeper's
+        sleep down as the world does.  Not while a tick is in progress. */
+    std::uint64_t stateHash(std::size_t index) const;
+    //! Have each tick end with stateHash(), in its stats (it starts off)
+    void setTickHashing(bool enable) {
+        _tickHashing = enable;
+    }
+    bool tickHashing() const {
+        return _tickHashing;
+    }
+    //! How worker thread \a worker has spent its time over the ticks so far
+    const tick_worker_stats_t& workerStats(unsigned int worker) const {
+        return _scheduler.workerStats(worker);
+    }
+    //! Zero every worker's stats
+    void resetWorkerStats() {
+        _scheduler.resetWorkerStats();
+    }
+
+    /** Run every VM that isn't parked for up to budget() instructions, or
+        whatever budget the deadline leaves room for, returning once all are done */
+    vm_tick_stats_t tick();
+};
+
+#endif // VMWORLD_H
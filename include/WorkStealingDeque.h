@@ -0,0 +1,105 @@
+/* Chase-Lev work-stealing deque.
+
+   The owning thread pushes and pops at the bottom, like a stack;  any other
+   thread may steal from the top.  Only stealing, and popping the very last
+   item, ever take a compare-and-swap.  Memory orderings follow Le, Pop,
+   Cohen & Zappa Nardelli, "Correct and Efficient Work-Stealing for Weak
+   Memory Models" (PPoPP '13).
+
+   The buffer doesn't grow:  reset() it with room for everything that will
+   be pushed before other threads start stealing.  TickScheduler knows exactly
+   how many batches a tick has, so that's no hardship.
+*/
+
+#ifndef WORKSTEALINGDEQUE_H
+#define WORKSTEALINGDEQUE_H
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+
+//! Outcome of WorkStealingDeque::steal()
+enum class StealResult : unsigned char {
+    STOLEN,   //!< Got an item
+    EMPTY,    //!< Nothing there to steal
+    LOST      //!< Lost a race for the top item to another thief or the owner;  worth trying again
+};
+
+template <class T>
+class WorkStealingDeque {
+private:
+    std::atomic<std::int64_t> _top;
+    std::atomic<std::int64_t> _bottom;
+    std::unique_ptr<std::atomic<T>[]> _buffer;
+    std::int64_t _mask;   //!< capacity - 1;  capacity is a power of two
+
+public:
+    WorkStealingDeque()
+        : _top(0), _bottom(0), _buffer(), _mask(-1) {
+    }
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    /*! Empty the deque and make room for at least \a capacity items.  Owner
+        only, and only while no other thread can be stealing. */
+    void reset(std::size_t capacity) {
+        std::size_t cap = 1;
+        while (cap < capacity)
+            cap <<= 1;
+        if (static_cast<std::int64_t>(cap) - 1 != _mask) {
+            _buffer.reset(new std::atomic<T>[cap]);
+            _mask = static_cast<std::int64_t>(cap) - 1;
+        }
+        _top.store(0, std::memory_order_relaxed);
+        _bottom.store(0, std::memory_order_relaxed);
+    }
+
+    //! Push \a item onto the bottom.  Owner only.
+    void push(T item) {
+        const std::int64_t b = _bottom.load(std::memory_order_relaxed);
+        assert(b - _top.load(std::memory_order_acquire) <= _mask);
+        _buffer[b & _mask].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        _bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    //! Pop the bottom item into \a item.  Owner only.  False if there was none.
+    bool pop(T& item) {
+        const std::int64_t b = _bottom.load(std::memory_order_relaxed) - 1;
+        _bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t t = _top.load(std::memory_order_relaxed);
+
+        if (t > b) {   // was already empty
+            _bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        item = _buffer[b & _mask].load(std::memory_order_relaxed);
+        if (t == b) {
+            // last item:  race any thieves for it
+            const bool won = _top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                             std::memory_order_relaxed);
+            _bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    //! Steal the top item into \a item.  Any thread.
+    StealResult steal(T& item) {
+        std::int64_t t = _top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const std::int64_t b = _bottom.load(std::memory_order_acquire);
+
+        if (t >= b)
+            return StealResult::EMPTY;
+        item = _buffer[t & _mask].load(std::memory_order_relaxed);
+        if (!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                          std::memory_order_relaxed))
+            return StealResult::LOST;
+        return StealResult::STOLEN;
+    }
+};
+
+#endif // WORKSTEALINGDEQUE_H
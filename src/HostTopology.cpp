@@ -0,0 +1,174 @@
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include "HostTopology.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+namespace {
+
+#if defined(__linux__)
+/** Read a sysfs list like "0-3,8,10-11" from \a path into \a out.
+    False if there's no such file. */
+bool readList(const char* path, std::vector<unsigned int>& out) {
+    std::FILE* f = std::fopen(path, "r");
+    if (!f)
+        return false;
+    unsigned int first, last;
+    for (;;) {
+        if (std::fscanf(f, "%u", &first) != 1)
+            break;
+        last = first;
+        int c = std::fgetc(f);
+        if (c == '-') {
+            if (std::fscanf(f, "%u", &last) != 1)
+                break;
+            c = std::fgetc(f);
+        }
+        for (unsigned int i = first; i <= last; i++)
+            out.push_back(i);
+        if (c != ',')
+            break;
+    }
+    std::fclose(f);
+    return true;
+}
+#endif
+
+//! Every hardware thread on one node:  the layout of a host that can't say any better
+std::vector<std::vector<unsigned int>> oneNode() {
+    unsigned int n = std::thread::hardware_concurrency();
+    std::vector<unsigned int> cpus;
+    for (unsigned int i = 0; i < n; i++)
+        cpus.push_back(i);
+    return std::vector<std::vector<unsigned int>>(1, cpus);
+}
+
+std::vector<std::vector<unsigned int>> discover() {
+#if defined(__linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return oneNode();
+
+    std::vector<std::vector<unsigned int>> nodes;
+    std::vector<unsigned int> online;
+    if (readList("/sys/devices/system/node/online", online)) {
+        for (unsigned int node : online) {
+            char path[64];
+            std::snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+            std::vector<unsigned int> cpus, usable;
+            readList(path, cpus);
+            for (unsigned int cpu : cpus) {
+                if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+                    usable.push_back(cpu);
+            }
+            nodes.push_back(usable);
+        }
+    }
+    // no NUMA support in the kernel:  one node, of whatever we may run on
+    if (nodes.empty()) {
+        std::vector<unsigned int> cpus;
+        for (unsigned int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed))
+                cpus.push_back(cpu);
+        }
+        nodes.push_back(cpus);
+    }
+    return nodes;
+#else
+    return oneNode();
+#endif
+}
+
+} // namespace
+
+HostTopology::HostTopology(std::vector<std::vector<unsigned int>> nodes)
+    : _nodes() {
+    for (std::vector<unsigned int>& cpus : nodes) {
+        if (!cpus.empty())
+            _nodes.push_back(std::move(cpus));
+    }
+    if (_nodes.empty())
+        _nodes.push_back(std::vector<unsigned int>(1, 0));
+}
+
+const HostTopology& HostTopology::host() {
+    static const HostTopology topology(discover());
+    return topology;
+}
+
+unsigned int HostTopology::cpuCount() const {
+    unsigned int n = 0;
+    for (const std::vector<unsigned int>& cpus : _nodes)
+        n += static_cast<unsigned int>(cpus.size());
+    return n;
+}
+
+void HostTopology::place(unsigned int worker, unsigned int workers, unsigned int& node, unsigned int& cpu) const {
+    // the worker's CPU, counting through every node's CPUs in turn
+    unsigned long long i = static_cast<unsigned long long>(worker) * cpuCount() / (workers ? workers : 1);
+    for (node = 0; node < nodes() - 1 && i >= _nodes[node].size(); node++)
+        i -= _nodes[node].size();
+    cpu = _nodes[node][i % _nodes[node].size()];
+}
+
+bool HostTopology::pinThread(unsigned int cpu) {
+#if defined(__linux__)
+    if (cpu >= CPU_SETSIZE)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+    if (cpu >= sizeof(DWORD_PTR) * 8)
+        return false;
+    return SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpu) != 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+ScopedThreadPin::ScopedThreadPin(unsigned int cpu)
+    : _saved(), _pinned(false) {
+#if defined(__linux__)
+    cpu_set_t before;
+    if (pthread_getaffinity_np(pthread_self(), sizeof(before), &before) != 0)
+        return;
+    _saved.resize(sizeof(before));
+    std::memcpy(_saved.data(), &before, sizeof(before));
+    _pinned = HostTopology::pinThread(cpu);
+#elif defined(_WIN32)
+    if (cpu >= sizeof(DWORD_PTR) * 8)
+        return;
+    const DWORD_PTR before = SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpu);
+    if (before == 0)
+        return;
+    _saved.resize(sizeof(before));
+    std::memcpy(_saved.data(), &before, sizeof(before));
+    _pinned = true;
+#else
+    (void)cpu;
+#endif
+}
+
+ScopedThreadPin::~ScopedThreadPin() {
+    if (!_pinned)
+        return;
+#if defined(__linux__)
+    cpu_set_t before;
+    std::memcpy(&before, _saved.data(), sizeof(before));
+    pthread_setaffinity_np(pthread_self(), sizeof(before), &before);
+#elif defined(_WIN32)
+    DWORD_PTR before;
+    std::memcpy(&before, _saved.data(), sizeof(before));
+    SetThreadAffinityMask(GetCurrentThread(), before);
+#endif
+}
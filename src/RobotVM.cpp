@@ -1,11 +1,15 @@
 #include <cstdio>
+#include <cstdarg>
 #include <cstring>
 #include <cassert>
 #include <sstream>
 #include <iomanip>
 #include <string>
+#include <utility>
 #include "RobotVM.h"
 #include "VMInstr.h"
+#include "VMStateHash.h"
+#include "VMOpcodeTypes.h"
 #include "Typedefs.h"
 
 #include <exception>
@@ -20,16 +24,109 @@ inline int mod (int a, int b) {
 }
 
 RobotVM::RobotVM()
-    : _emitter(new VMInstrEmitter()), _regs(), _errorstate(), _rwp(0), _halt(false),
-      _hexregs(false) {
-    memset(&_rom[0],   0,  NELEMS(_rom));
-    memset(&_ram[0],   0,  NELEMS(_ram));
-    memset(&_stack[0], 0,  NELEMS(_stack));
-    _regs.setAllGeneralRegistersToZero();
+    : RobotVM(nullptr, std::make_shared<VMStateArena>(1)) {
+}
+
+RobotVM::RobotVM(VMStateArena& arena)
+    : RobotVM(&arena, nullptr) {
+}
+
+RobotVM::RobotVM(VMStateArena* arena, std::shared_ptr<VMStateArena> own)
+    : _ownArena(std::move(own)), _arena(arena ? *arena : *_ownArena), _slot(_arena.acquire()),
+      _regs(_arena.regs(_slot)), _errorstate(_arena.errors(_slot)), _halt(_arena.halted(_slot)),
+      _wait(_arena.waiting(_slot)),
+      _ram(_arena.ram(_slot)), _stack(_arena.stack(_slot)), _rom(RomImage::empty()), _rwp(0),
+      _hexregs(false), _trace(nullptr), _ports(nullptr), _outbox(nullptr),
+      _waitFor(VMWaitReason::NONE), _waitPort(0), _sleep(0), _woke(false), _parked(false), _shard(0), _saved(0), _decoded(), _engine(VM_DEFAULT_ENGINE),
+      _superops(true), _fixedregs(true), _superhits() {
+}
+
+VMInstrEmitter& RobotVM::emitter() const {
+    static VMInstrEmitter em;
+    return em;
 }
 
 RobotVM::~RobotVM() {
-    printf("RobotVM::~RobotVM() ...\n");
+    _arena.release(_slot);
+}
+
+std::unique_ptr<RobotVM> RobotVM::fork() {
+    std::unique_ptr<RobotVM> child(new RobotVM(&_arena, _ownArena));
+    child->inherit(*this);
+    return child;
+}
+
+void RobotVM::inherit(RobotVM& parent) {
+    assert(&parent._arena == &_arena);
+    _regs = parent._regs;
+    _errorstate = parent._errorstate;
+    _halt = parent._halt;
+    _wait = parent._wait;
+    _waitFor = parent._waitFor;
+    _waitPort = parent._waitPort;
+    _sleep = parent._sleep;
+    _woke = parent._woke;
+    _ram.share(parent._ram);
+    _stack.share(parent._stack);
+    _rom = parent._rom;
+    _rwp = parent._rwp;
+    _hexregs = parent._hexregs;
+    _ports = parent._ports;
+    _decoded = parent._decoded;
+    _engine = parent._engine;
+    _superops = parent._superops;
+    _fixedregs = parent._fixedregs;
+}
+
+std::uint64_t RobotVM::stateHash(word_t sleep) const {
+    std::uint64_t regs = 0;
+    for (int r = 0; r < 4; r++)
+        regs |= static_cast<std::uint64_t>(static_cast<word_t>(_regs.r[r])) << (16 * r);
+    const std::uint64_t pointers = _regs.pc | static_cast<std::uint64_t>(_regs.sp) << 16
+                                   | static_cast<std::uint64_t>(_regs.ix) << 32;
+    // what it waited for is left behind once it stops waiting, and no longer counts
+    const std::uint64_t waiting = !_wait ? 0 : static_cast<std::uint64_t>(_waitFor)
+                                               | static_cast<std::uint64_t>(_waitPort) << 8
+                                               | static_cast<std::uint64_t>(sleep) << 16;
+    const std::uint64_t flags = static_cast<std::uint64_t>(_halt) | static_cast<std::uint64_t>(_wait) << 1
+                                | static_cast<std::uint64_t>(_woke) << 2
+                                | static_cast<std::uint64_t>(_errorstate.illegal_instruction) << 3
+                                | static_cast<std::uint64_t>(_errorstate.on_fire) << 4
+                                | static_cast<std::uint64_t>(_errorstate.memory_fault) << 5
+                                | static_cast<std::uint64_t>(_errorstate.bad_port) << 6
+                                | waiting << 8;
+
+    std::uint64_t h = VMStateHash::mix(_rom->hash(), regs);
+    h = VMStateHash::mix(h, pointers);
+    h = VMStateHash::mix(h, flags);
+    // pages of zeros, written or not, are left out, so most of RAM costs a compare
+    const unsigned int pages = VM_RAM_SIZE / VM_RAM_PAGE_SIZE;
+    for (unsigned int i = 0; i <= pages; i++) {
+        const std::uint64_t page = i < pages ? _ram.pageHash(i) : _stack.pageHash(0);
+        if (page != VMPagePool::zeroPageHash())
+            h = VMStateHash::mix(h, page + i);
+    }
+    return h;
+}
+
+void RobotVM::recycle() {
+    _arena.retire(_slot);
+    if (_rom != RomImage::empty())
+        _rom = RomImage::empty();
+    _rwp = 0;
+    _decoded.reset();
+    _hexregs = false;
+    _trace = nullptr;
+    _ports = nullptr;
+    _outbox = nullptr;
+    _sleep = 0;
+    _woke = false;
+    _parked = false;
+    _saved = 0;
+    _engine = VM_DEFAULT_ENGINE;
+    _superops = true;
+    _fixedregs = true;
+    resetSuperOpHits();
 }
 
 int RobotVM::getRegisterIndex(RegName reg) const {
@@ -51,19 +148,34 @@ int RobotVM::getRegisterIndex(RegName reg) const {
     }
 }
 
+RomImage& RobotVM::writableRom() {
+    if (_rom.use_count() != 1)
+        _rom = std::make_shared<RomImage>(*_rom);
+    // every RomImage starts out non-const, and nobody else can see this one
+    return const_cast<RomImage&>(*_rom);
+}
+
+void RobotVM::setRom(const std::shared_ptr<const RomImage>& image) {
+    _rom = image ? image : RomImage::empty();
+    _rwp = static_cast<addr_t>(_rom->size());
+    _decoded.reset();
+}
+
 bool RobotVM::burn(const vm_instr_t& instr) {
     const byte_t* srcbytes = reinterpret_cast<const byte_t*>(&instr);
-    byte_t*       dstbytes = &_rom[_rwp];
-    VMInstrEmitter&     em = *_emitter;
     Opcode          opcode = instr.opcode;
-    unsigned int       len = em.instructionLengthOfOperandType(em.getOperandTypeOfOpcode(opcode));
+    unsigned int       len = VMOpcodeInfo::length(opcode);
 
     assert(len <= sizeof(instr));
+    if (_rwp + len >= VM_ROM_SIZE)
+        return false;
 
-    memcpy(dstbytes, srcbytes, len);
-    _rwp += len;
+    writableRom().write(_rwp, srcbytes, len);
+    _decoded.reset();
 
-    printf("burn(): burned %d bytes...\n", len);
+    if (_trace)
+        _trace->traceBurn(*this, _rwp, len);
+    _rwp += len;
 
     return true;
 }
@@ -72,10 +184,9 @@ bool RobotVM::burn(const std::vector<byte_t>& bytes) {
     if (_rwp + bytes.size() >= VM_ROM_SIZE)
         return false;
 
-    for ( const byte_t byte : bytes ) {
-        _rom[_rwp] = byte;
-        _rwp++;
-    }
+    writableRom().write(_rwp, bytes.data(), bytes.size());
+    _rwp += static_cast<addr_t>(bytes.size());
+    _decoded.reset();
 
     return true;
 }
@@ -84,11 +195,13 @@ bool RobotVM::burn(const std::vector<word_t>& words) {
     if (_rwp + (2 * words.size()) >= VM_ROM_SIZE)
         return false;
 
-    word_t* dst = reinterpret_cast<word_t*>(&_rom[0]);
+    RomImage& rom = writableRom();
     for ( const word_t word : words ) {
-        dst[_rwp] = word;
-        _rwp += 2;;
+        const byte_t le[2] = { static_cast<byte_t>(word & 0xFF), static_cast<byte_t>(word >> 8) };
+        rom.write(_rwp, le, 2);
+        _rwp += 2;
     }
+    _decoded.reset();
 
     return true;
 }
@@ -99,7 +212,7 @@ void RobotVM::printROM() const {
     for (i = 0; i < _rwp; i++) {
         if (mod (i, 16) == 0)
             printf("%04x : ", i);
-        printf("%02x ", _rom[i]);
+        printf("%02x ", _rom->at(i));
         if (mod(i+1, 16) == 0)
             printf("\n");
     }
@@ -117,7 +230,7 @@ std::string RobotVM::printROMToString() const {
     for (i = 0; i < _rwp; i++) {
         if (mod (i, 16) == 0)
             res << std::setw(4) << i << " : ";
-        res << std::setw(2) << static_cast<int>(_rom[i]) << " ";
+        res << std::setw(2) << static_cast<int>(_rom->at(i)) << " ";
         if (mod(i+1, 16) == 0)
             res << std::endl;
     }
@@ -131,10 +244,11 @@ std::string RobotVM::printROMToString() const {
 
 void RobotVM::printRAM(unsigned int count) const {
     printf("RAM:\n");
+    bool ignored = false;
     for (unsigned int i = 0; i < count; i++) {
         if (mod (i, 16) == 0)
             printf("%04x : ", i);
-        printf("%02x ", _ram[i]);
+        printf("%02x ", VMRamAccess::loadByte(_ram, static_cast<addr_t>(i), ignored));
         if (mod(i+1, 16) == 0)
             printf("\n");
     }
@@ -151,7 +265,7 @@ void RobotVM::printStack() const {
     for (i=0; i < static_cast<unsigned int>(_regs.sp); i++) {
         if (mod (i, 16) == 0)
             printf("    ST%02x:", i);
-        printf("%02x ", _stack[i]);
+        printf("%02x ", _stack.read[0][i]);
         if (mod(i+1, 16) == 0)
             printf("\n");
     }
@@ -174,15 +288,81 @@ void RobotVM::printRegs(vm_regs_t regs) const {
                (word_t)(regs.r4));
 }
 
+//! Length in bytes of an instruction starting with \a opc.  Bogus opcodes
+//! are treated as 1 byte long, since they are never going to be executed.
+static constexpr int instrLengthOf(Opcode opc) {
+    return VMOpcodeInfo::length(opc) < 0 ? 1 : VMOpcodeInfo::length(opc);
+}
+
+/*! Check that whichever operand bytes exec() is going to treat as registers
+    actually name one of R1..R4.  Anything else would index past the end of
+    vm_regs_t::r[].
+
+    \note MR instructions are checked at params[1], because that is where
+    exec() currently fetches their register from. */
+static bool registerOperandsValid(Opcode opc, const volatile byte_t* params) {
+    if (static_cast<int>(opc) >= static_cast<int>(Opcode::NUM_OPCODES))
+        return true;   // caught elsewhere as an illegal instruction
+
+    const byte_t maxreg = static_cast<byte_t>(RegName::R4);
+    typedef OperandType OT;
+    switch (VMOpcodeInfo::operandType(opc)) {
+    case OT::RRR:
+        if (params[2] > maxreg) return false;
+    // fall through
+    case OT::RR:
+        if (params[1] > maxreg) return false;
+    // fall through
+    case OT::RM:
+    case OT::RW:
+    case OT::RB:
+    case OT::R:
+        return params[0] <= maxreg;
+    case OT::MR:
+        return params[1] <= maxreg;
+    default:
+        return true;
+    }
+}
+
+void RobotVM::warn(const char* fmt, ...) const {
+    if (!_trace)
+        return;
+
+    char msg[128];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, args);
+    va_end(args);
+    _trace->traceWarning(*this, msg);
+}
+
 void RobotVM::exec(const vm_instr_t& instr) {
+    if (_trace)
+        execWith(instr, *_trace);
+    else {
+        VMNullTraceSink nulltrace;
+        execWith(instr, nulltrace);
+    }
+}
+
+template<class TraceT>
+void RobotVM::execWith(const vm_instr_t& instr, TraceT& trace) {
     volatile const byte_t* const params = const_cast<volatile const byte_t*>(&(instr.bytes[0]));
 
+    if (!registerOperandsValid(instr.opcode, params)) {
+        warn("illegal register operand for opcode #%02d", static_cast<int>(instr.opcode));
+        _errorstate.illegal_instruction = true;
+        halt();
+        return;
+    }
+
     // syntactic sugar time.  most of these will go to waste.
     const byte_t         b1    = *(params);
 
-    // Uncomment when BB and BBB-type operands are used.
+    // Uncomment when BBB-type operands are used.
     // Commented out for now to eliminate compiler warnings.
-    // const byte_t         b2    = *(params+1);
+    const byte_t         b2    = *(params+1);
     // const byte_t         b3    = *(params+2);
 
     // unfortunately, can't simply reinterpret_cast from byte_t to RegName,
@@ -332,8 +512,15 @@ void RobotVM::exec(const vm_instr_t& instr) {
     case Opcode::POPB_R:
         i_popbr(*reg1p);
         goto good;
-    case Opcode::RECV_RB:  // todo
-    case Opcode::SEND_RB:  // todo
+    case Opcode::RECV_RB:
+        i_recvrb(*reg1p, b2);
+        goto good;
+    case Opcode::SEND_RB:
+        i_sendrb(*reg1p, b2);
+        goto good;
+    case Opcode::WAIT_W:
+        i_waitw(w1);
+        goto good;
     case Opcode::NUM_OPCODES:
     case Opcode::INVALID:
         i_hcfnil();
@@ -342,21 +529,22 @@ void RobotVM::exec(const vm_instr_t& instr) {
         // cases for this enum and warn about them
     }
 
-    printf("unknown opcode #%02d\n", static_cast<int>(instr.opcode));
+    warn("unknown opcode #%02d", static_cast<int>(instr.opcode));
+    _errorstate.illegal_instruction = true;
+    halt();
     return;
 
 good:
-    vm_regs_t printregs = _regs;
-    printregs.pc = pcbefore;
-    printRegs(printregs);
-    printStack();
+    trace.traceExec(*this, instr, pcbefore);
     return;
 }
 
 void RobotVM::putstr(addr_t ramloc, const char* const str) {
-    char* absloc = reinterpret_cast<char*>(&_ram[ramloc]);
-	memcpy((void*)absloc, (void*)str, strlen(str));
-	//strncpy_s(absloc, str, strlen(str));
+    // Bytes VM_MEM_POLICY won't let VM code write are dropped;  that's no
+    // reason to halt the VM though.
+    bool fault = false;
+    for (const char* c = str; *c; c++)
+        VMRamAccess::storeByte(_ram, ramloc++, static_cast<byte_t>(*c), fault);
 }
 
 /*! Execute single instruction located at ROM[pc].
@@ -366,40 +554,146 @@ void RobotVM::putstr(addr_t ramloc, const char* const str) {
     the Program Counter. It will, however, always
     increment the Program Counter unconditionally. */
 void RobotVM::step() {
-    VMInstrEmitter& em = *_emitter;
+    resume();
+    if (_engine == VMEngine::SWITCH) {
+        stepRaw();
+        return;
+    }
+
+    if (!_decoded)
+        predecode();
+
+    // only reachable by step()ing a VM that already halted by running off its ROM
+    if (static_cast<addr_t>(_regs.pc) > _rwp) {
+        halt();
+        return;
+    }
+
+    if (_trace)
+        stepWith(*_trace);
+    else {
+        VMNullTraceSink nulltrace;
+        stepWith(nulltrace);
+    }
+}
+
+template<class TraceT>
+void RobotVM::stepWith(TraceT& trace) {
+    vm_regs_t& regs = _regs;
+    const vm_decoded_op_t& op = (*_decoded)[regs.pc];
+
+    word_t oldpc = regs.pc;
+    op.handler(*this, op);
+    trace.traceExec(*this, instrAt(oldpc), oldpc);
+
+    // see stepRawWith() for why PC only advances when it's unchanged
+    if (oldpc == regs.pc && !_wait)
+        regs.pc = op.next;
+
+    if (static_cast<addr_t>(regs.pc) > _rwp) {
+        warn("PC exceeded ROM Write Pointer");
+        halt();
+    }
+}
+
+/*! Execute single instruction located at ROM[pc], straight from ROM.
+    Same rules as step(). */
+void RobotVM::stepRaw() {
+    resume();
+    if (_trace)
+        stepRawWith(*_trace);
+    else {
+        VMNullTraceSink nulltrace;
+        stepRawWith(nulltrace);
+    }
+}
+
+template<class TraceT>
+void RobotVM::stepRawWith(TraceT& trace) {
     vm_regs_t& regs = _regs;
-    const byte_t* const romptr = &_rom[0];
 
     // 32-bit "window" starting at an address in ROM, the
     // address being the value of the (P)rogram (C)ounter register
-    const vm_instr_t* const instr = reinterpret_cast<const vm_instr_t*>(romptr+regs.pc);
+    const vm_instr_t instr = _rom->fetch(regs.pc);
 
-    Opcode opc = instr->opcode;
-    OperandType opt = em.getOperandTypeOfOpcode(opc);
-    int len = em.instructionLengthOfOperandType(opt);
+    int len = instrLengthOf(instr.opcode);
 
     word_t oldpc = regs.pc;
-    exec(*instr);
+    execWith(instr, trace);
 
     // auto-increment program counter iff previous instruction
-    // did not already alter the PC on its own
+    // did not already alter the PC on its own, and didn't stop on a port
     //
     // consequently, this means "addr: JMP addr" will not lock
     // up the machine in an infinite loop.  but that is such
     // an unsignificant edge-case, I see no need to "solve" it.
-    if (oldpc == regs.pc)
+    if (oldpc == regs.pc && !_wait)
         regs.pc = regs.pc + len;
 
-	if (static_cast<addr_t>(regs.pc) > _rwp)
-	{
-		printf("PC exceeded ROM Write Pointer\n");
-		halt();
-	}
+    if (static_cast<addr_t>(regs.pc) > _rwp) {
+        warn("PC exceeded ROM Write Pointer");
+        halt();
+    }
 }
 
 void RobotVM::run() {
     _halt = false;
-    while (!_halt) step();
+    while (runFor(~0UL) == VMStopReason::BUDGET)
+        ;
+}
+
+VMStopReason RobotVM::runFor(unsigned long budget, unsigned long* executed) {
+    unsigned long done = 0;
+    resume();
+
+    if (_halt || budget == 0) {
+        // nothing to do
+    } else if (_engine == VMEngine::SWITCH) {
+        // pick the trace policy once, rather than once per instruction
+        if (_trace) {
+            VMTraceSink& trace = *_trace;
+            for (; done < budget && !_halt; done++) stepRawWith(trace);
+        } else {
+            VMNullTraceSink nulltrace;
+            for (; done < budget && !_halt; done++) stepRawWith(nulltrace);
+        }
+    } else {
+        if (!_decoded)
+            predecode();
+
+        if (static_cast<addr_t>(_regs.pc) > _rwp) {
+            halt();
+        } else if (_trace) {
+            // a trace sink wants to see every single instruction, so never thread those
+            VMTraceSink& trace = *_trace;
+            for (; done < budget && !_halt; done++) stepWith(trace);
+        } else if (_engine == VMEngine::DECODED) {
+            done = runDecoded(budget);
+        } else if (_engine == VMEngine::JIT) {
+#if VM_HAS_JIT
+            done = runJit(budget);
+#else
+            done = runThreaded(budget);
+#endif
+        } else {
+            done = runThreaded(budget);
+        }
+    }
+
+    if (executed)
+        *executed = done;
+    return stopReason();
+}
+
+VMStopReason RobotVM::stopReason() const {
+    if (_errorstate.illegal_instruction || _errorstate.on_fire || _errorstate.memory_fault
+            || _errorstate.bad_port)
+        return VMStopReason::FAULT;
+    if (_wait)
+        return VMStopReason::WAIT_IO;
+    if (_halt)
+        return VMStopReason::HALT;
+    return VMStopReason::BUDGET;
 }
 
 // === CPU STUFF! ===
@@ -410,20 +704,17 @@ void RobotVM::run() {
 #define REGVAL(x) _regs.r[static_cast<word_t>(x)]
 opresult_t RobotVM::i_movrm(RegName reg, addr_t addr) {
     ASSERTREG(reg);
-    word_t* wram = reinterpret_cast<word_t*>(&_ram[addr]);
-    REGVAL(reg) = *wram;
+    REGVAL(reg) = loadRamWord(addr);
 }
 
 opresult_t RobotVM::i_movbrm(RegName reg, addr_t addr) {
     ASSERTREG(reg);
-    byte_t* wram = reinterpret_cast<byte_t*>(&_ram[addr]);
-    REGVAL(reg) = static_cast<word_t>(*wram);
+    REGVAL(reg) = static_cast<word_t>(loadRamByte(addr));
 }
 
 opresult_t RobotVM::i_movmr(addr_t addr, RegName reg) {
     ASSERTREG(reg);
-    word_t* wram = reinterpret_cast<word_t*>(&_ram[addr]);
-    *wram = REGVAL(reg);
+    storeRamWord(addr, REGVAL(reg));
 }
 
 opresult_t RobotVM::i_movrr(RegName reg1, RegName reg2) {
@@ -439,14 +730,12 @@ opresult_t RobotVM::i_movrw(RegName reg, word_t w) {
 
 opresult_t RobotVM::i_movrprr(RegName reg1ptr, RegName reg2) {
     unsigned short usaddr = (REGVAL(reg1ptr));
-    word_t* wram = reinterpret_cast<word_t*>(&_ram[usaddr]);
-    *wram = REGVAL(reg2);
+    storeRamWord(usaddr, REGVAL(reg2));
 }
 
 opresult_t RobotVM::i_movprrr(RegName reg1, RegName reg2ptr) {
     unsigned short usaddr = (REGVAL(reg2ptr));
-    word_t* wram = reinterpret_cast<word_t*>(&_ram[usaddr]);
-    REGVAL(reg1) = *wram;
+    REGVAL(reg1) = loadRamWord(usaddr);
 }
 
 opresult_t RobotVM::i_zeronil() {
@@ -496,7 +785,6 @@ opresult_t RobotVM::i_subrr(RegName reg1, RegName reg2) {
 }
 
 opresult_t RobotVM::i_jmpw(addr_t ptr) {
-	printf("JMP: %d\n", ptr);
     _regs.pc = static_cast<word_t>(ptr);
 }
 
@@ -527,35 +815,34 @@ opresult_t RobotVM::i_pushr(RegName reg) {
     if (_regs.sp >= (VM_STACK_SIZE - 2)) // 2 bc we push word not byte
         return;
 
-    word_t* wptr = reinterpret_cast<word_t*>(&(_stack[_regs.sp]));
-    *wptr = REGVAL(reg);
+    storeStackWord(_regs.sp, REGVAL(reg));
     _regs.sp += 2;
 }
 
 opresult_t RobotVM::i_pushw(word_t w) {
     if (_regs.sp >= (VM_STACK_SIZE - 2)) { // 2 bc we push word not byte
-        printf("warning: ignoring PUSH word on full stack (sp=%d)\n", _regs.sp);
+        warn("warning: ignoring PUSH word on full stack (sp=%d)", _regs.sp);
         return;
     }
 
-    word_t* wptr = reinterpret_cast<word_t*>(&(_stack[_regs.sp]));
-    *wptr = w;
+    storeStackWord(_regs.sp, w);
     _regs.sp += 2;
 }
 
 opresult_t RobotVM::i_pushb(byte_t b) {
     if (_regs.sp >= (VM_STACK_SIZE - 1)) {
-        printf("warning: ignoring PUSH byte on full stack (sp=%d)\n", _regs.sp);
+        warn("warning: ignoring PUSH byte on full stack (sp=%d)", _regs.sp);
         return;
     }
 
-    _stack[_regs.sp] = b;
+    bool never = false;
+    VMStackAccess::storeByte(_stack, _regs.sp, b, never);
     _regs.sp++;
 }
 
 opresult_t RobotVM::i_popwr(RegName reg) {
     if (_regs.sp == 0) {
-        printf("warning: POPW_R when SP==0\n");
+        warn("warning: POPW_R when SP==0");
         return;   // silent fail
     }
     if (_regs.sp == 1)
@@ -563,18 +850,76 @@ opresult_t RobotVM::i_popwr(RegName reg) {
     else
         _regs.sp -= 2;
 
-    word_t* wptr = reinterpret_cast<word_t*>(&(_stack[_regs.sp]));
-    REGVAL(reg) = *wptr;
+    REGVAL(reg) = loadStackWord(_regs.sp);
 }
 
 opresult_t RobotVM::i_popbr(RegName reg) {
     if (_regs.sp == 0) {
-        printf("warning: POPB_R when SP==0\n");
+        warn("warning: POPB_R when SP==0");
         return;   // silent fail
     }
 
-    byte_t* bptr = reinterpret_cast<byte_t*>(&(_stack[--(_regs.sp)]));
-    REGVAL(reg) = static_cast<word_t>(*bptr);
+    bool never = false;
+    REGVAL(reg) = VMStackAccess::loadByte(_stack, --(_regs.sp), never);
+}
+
+opresult_t RobotVM::i_recvrb(RegName reg, byte_t port) {
+    VMPort* const p = _ports ? _ports->at(port) : nullptr;
+    if (!p) {
+        warn("RECV from port %d, which isn't open", port);
+        _errorstate.bad_port = true;
+        halt();
+        return;
+    }
+
+    // with an outbox, which VM gets which word is up to VMWorld:  see receive()
+    word_t w;
+    if (!_outbox && p->tryRecv(w))
+        REGVAL(reg) = w;
+    else
+        waitIO(VMWaitReason::RECV, port);
+}
+
+void RobotVM::receive(word_t value) {
+    const vm_instr_t instr = instrAt(_regs.pc);
+    const word_t oldpc = _regs.pc;
+    REGVAL(static_cast<RegName>(instr.bytes[0])) = value;
+    _wait = false;
+    _halt = false;
+
+    // on past the RECV, as stepRaw() would have
+    if (oldpc == _regs.pc)
+        _regs.pc = static_cast<word_t>(_regs.pc + instrLengthOf(instr.opcode));
+    if (static_cast<addr_t>(_regs.pc) > _rwp) {
+        warn("PC exceeded ROM Write Pointer");
+        halt();
+    }
+}
+
+opresult_t RobotVM::i_sendrb(RegName reg, byte_t port) {
+    VMPort* const p = _ports ? _ports->at(port) : nullptr;
+    if (!p) {
+        warn("SEND to port %d, which isn't open", port);
+        _errorstate.bad_port = true;
+        halt();
+        return;
+    }
+
+    const word_t w = static_cast<word_t>(REGVAL(reg));
+    if (_outbox ? !_outbox->push(port, w) : !p->trySend(w))
+        waitIO(VMWaitReason::SEND, port);
+}
+
+opresult_t RobotVM::i_waitw(word_t ticks) {
+    // slept already:  this is the retry resume() let through
+    if (_woke) {
+        _woke = false;
+        return;
+    }
+    if (ticks) {
+        _sleep = ticks;
+        waitIO(VMWaitReason::SLEEP);
+    }
 }
 
 opresult_t RobotVM::i_andrr(RegName reg1, RegName reg2) {
@@ -606,19 +951,15 @@ opresult_t RobotVM::i_notr(RegName reg) {
 }
 
 opresult_t RobotVM::i_bcrrr(RegName reg1ptr, RegName reg2ptr, RegName reg3bytes) {
-    addr_t  relSrcAddr = static_cast<addr_t>(REGVAL(reg1ptr));
-    addr_t  relDstAddr = static_cast<addr_t>(REGVAL(reg2ptr));
-
-    byte_t* src = &_ram[relSrcAddr];
-    byte_t* dst = &_ram[relDstAddr];
+    addr_t  relSrcAddr = static_cast<word_t>(REGVAL(reg1ptr));
+    addr_t  relDstAddr = static_cast<word_t>(REGVAL(reg2ptr));
 
     int amt = static_cast<int>(REGVAL(reg3bytes));
     if (amt < 0) amt = 0;
-    if (relSrcAddr + amt >= (VM_RAM_SIZE -1)) {
-        throw "Not sure what to do yet.  Crash the VM for now, lol";
+    if (!VMRamAccess::copy(_ram, relDstAddr, relSrcAddr, static_cast<unsigned int>(amt))) {
+        warn("BC_RRR of %d bytes from %u to %u runs off the end of RAM", amt, relSrcAddr, relDstAddr);
+        ramFault(true);
     }
-
-    memcpy(dst, src, amt);
 }
 
 opresult_t RobotVM::i_swaprr(RegName reg1, RegName reg2) {
@@ -628,9 +969,8 @@ opresult_t RobotVM::i_swaprr(RegName reg1, RegName reg2) {
 }
 
 opresult_t RobotVM::i_swaprm(RegName reg, addr_t addr) {
-    word_t* wram = reinterpret_cast<word_t*>(&_ram[addr]);
-    word_t tmp = *wram;
-    *wram = REGVAL(reg);
+    word_t tmp = loadRamWord(addr);
+    storeRamWord(addr, REGVAL(reg));
     REGVAL(reg) = tmp;
 }
 
@@ -670,3 +1010,853 @@ opresult_t RobotVM::i_hcfnil() {
 	halt();
     _errorstate.on_fire = true;
 }
+
+// === PREDECODED EXECUTION ===
+
+/** Handlers for predecoded instructions.  Each one simply forwards the
+    operands that decodeAt() already pulled out of ROM to the matching i_*
+    member, so both execution paths share exactly the same semantics. */
+struct VMOpHandlers {
+#define DREG(x) static_cast<RegName>(op.x)
+    static void nop(RobotVM&, const vm_decoded_op_t&) { }
+    static void jmpw(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_jmpw(op.w); }
+    static void jnegrw(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_jnegrw(DREG(r1), op.w); }
+    static void jposrw(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_jposrw(DREG(r1), op.w); }
+    static void jzerorw(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_jzerorw(DREG(r1), op.w); }
+    static void jnzerorw(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_jnzerorw(DREG(r1), op.w); }
+    static void movrm(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_movrm(DREG(r1), op.w); }
+    static void movbrm(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_movbrm(DREG(r1), op.w); }
+    static void movmr(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_movmr(op.w, DREG(r2)); }
+    static void movrr(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_movrr(DREG(r1), DREG(r2)); }
+    static void movrw(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_movrw(DREG(r1), op.w); }
+    static void movrprr(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_movrprr(DREG(r1), DREG(r2)); }
+    static void movprrr(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_movprrr(DREG(r1), DREG(r2)); }
+    static void swaprr(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_swaprr(DREG(r1), DREG(r2)); }
+    static void swaprm(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_swaprm(DREG(r1), op.w); }
+    static void bcrrr(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_bcrrr(DREG(r1), DREG(r2), DREG(r3)); }
+    static void zeronil(RobotVM& vm, const vm_decoded_op_t&) { vm.i_zeronil(); }
+    static void andrr(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_andrr(DREG(r1), DREG(r2)); }
+    static void andrw(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_andrw(DREG(r1), op.w); }
+    static void orrr(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_orrr(DREG(r1), DREG(r2)); }
+    static void orrw(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_orrw(DREG(r1), op.w); }
+    static void xorrr(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_xorrr(DREG(r1), DREG(r2)); }
+    static void xorrw(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_xorrw(DREG(r1), op.w); }
+    static void notr(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_notr(DREG(r1)); }
+    static void bslr(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_bslr(DREG(r1)); }
+    static void bsrr(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_bsrr(DREG(r1)); }
+    static void rolr(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_rolr(DREG(r1)); }
+    static void rorr(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_rorr(DREG(r1)); }
+    static void haltnil(RobotVM& vm, const vm_decoded_op_t&) { vm.i_haltnil(); }
+    static void addrw(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_addrw(DREG(r1), op.w); }
+    static void addrr(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_addrr(DREG(r1), DREG(r2)); }
+    static void addrrr(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_addrrr(DREG(r1), DREG(r2), DREG(r3)); }
+    static void subrr(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_subrr(DREG(r1), DREG(r2)); }
+    static void mulrw(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_mulrw(DREG(r1), op.w); }
+    static void mulrr(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_mulrr(DREG(r1), DREG(r2)); }
+    static void negr(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_negr(DREG(r1)); }
+    static void dupr(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_dupr(DREG(r1)); }
+    static void pushr(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_pushr(DREG(r1)); }
+    static void pushw(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_pushw(op.w); }
+    static void pushb(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_pushb(op.b); }
+    static void popwr(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_popwr(DREG(r1)); }
+    static void popbr(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_popbr(DREG(r1)); }
+    static void recvrb(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_recvrb(DREG(r1), op.b); }
+    static void sendrb(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_sendrb(DREG(r1), op.b); }
+    static void waitw(RobotVM& vm, const vm_decoded_op_t& op) { vm.i_waitw(op.w); }
+    static void hcfnil(RobotVM& vm, const vm_decoded_op_t&) { vm.i_hcfnil(); }
+    static void illegal(RobotVM& vm, const vm_decoded_op_t&) {
+        vm._errorstate.illegal_instruction = true;
+        vm.halt();
+    }
+
+    // Superinstructions.  Each is handed the first op of its run and picks
+    // the rest up from the ops following it.  Unlike the handlers above, these
+    // leave PC past the end of the run (or wherever its closing jump went).
+#define FREG(o, x) static_cast<RegName>(o.x)
+    static void movrm_addrr_movmr(RobotVM& vm, const vm_decoded_op_t& op) {
+        const vm_decoded_op_t& op2 = (*vm._decoded)[op.next];
+        const vm_decoded_op_t& op3 = (*vm._decoded)[op2.next];
+        vm.i_movrm(DREG(r1), op.w);
+        vm.i_addrr(FREG(op2, r1), FREG(op2, r2));
+        vm.i_movmr(op3.w, FREG(op3, r2));
+        vm._regs.pc = op3.next;
+    }
+    static void addrw_jnzerorw(RobotVM& vm, const vm_decoded_op_t& op) {
+        const vm_decoded_op_t& op2 = (*vm._decoded)[op.next];
+        vm.i_addrw(DREG(r1), op.w);
+        vm._regs.pc = op2.next;
+        vm.i_jnzerorw(FREG(op2, r1), op2.w);
+    }
+    static void mulrw_jmpw(RobotVM& vm, const vm_decoded_op_t& op) {
+        const vm_decoded_op_t& op2 = (*vm._decoded)[op.next];
+        vm.i_mulrw(DREG(r1), op.w);
+        vm.i_jmpw(op2.w);
+    }
+    static void movrprr_addrw(RobotVM& vm, const vm_decoded_op_t& op) {
+        const vm_decoded_op_t& op2 = (*vm._decoded)[op.next];
+        vm.i_movrprr(DREG(r1), DREG(r2));
+        vm.i_addrw(FREG(op2, r1), op2.w);
+        vm._regs.pc = op2.next;
+    }
+    static void addrw_addrw(RobotVM& vm, const vm_decoded_op_t& op) {
+        const vm_decoded_op_t& op2 = (*vm._decoded)[op.next];
+        vm.i_addrw(DREG(r1), op.w);
+        vm.i_addrw(FREG(op2, r1), op2.w);
+        vm._regs.pc = op2.next;
+    }
+    static void movrm_movrm(RobotVM& vm, const vm_decoded_op_t& op) {
+        const vm_decoded_op_t& op2 = (*vm._decoded)[op.next];
+        vm.i_movrm(DREG(r1), op.w);
+        vm.i_movrm(FREG(op2, r1), op2.w);
+        vm._regs.pc = op2.next;
+    }
+    static void movmr_movmr(RobotVM& vm, const vm_decoded_op_t& op) {
+        const vm_decoded_op_t& op2 = (*vm._decoded)[op.next];
+        vm.i_movmr(op.w, DREG(r2));
+        vm.i_movmr(op2.w, FREG(op2, r2));
+        vm._regs.pc = op2.next;
+    }
+#undef FREG
+#undef DREG
+
+    // Fixed-register handlers.  There is one instantiation of fixedregs() per
+    // combination of register operands, and decodeAt() picks the one matching
+    // the op, so REGVAL() indexes with a compile-time constant instead of a
+    // register number fetched from the op every time it runs.
+    template <Opcode OPC, int A, int B, int C>
+    static void fixedregs(RobotVM& vm, const vm_decoded_op_t&) {
+        const RegName ra = static_cast<RegName>(A);
+        const RegName rb = static_cast<RegName>(B);
+        const RegName rc = static_cast<RegName>(C);
+        switch (OPC) {
+        case Opcode::MOV_RR:   vm.i_movrr(ra, rb);        break;
+        case Opcode::MOVRP_RR: vm.i_movrprr(ra, rb);      break;
+        case Opcode::MOVPR_RR: vm.i_movprrr(ra, rb);      break;
+        case Opcode::SWAP_RR:  vm.i_swaprr(ra, rb);       break;
+        case Opcode::ADD_RR:   vm.i_addrr(ra, rb);        break;
+        case Opcode::SUB_RR:   vm.i_subrr(ra, rb);        break;
+        case Opcode::MUL_RR:   vm.i_mulrr(ra, rb);        break;
+        case Opcode::AND_RR:   vm.i_andrr(ra, rb);        break;
+        case Opcode::OR_RR:    vm.i_orrr(ra, rb);         break;
+        case Opcode::XOR_RR:   vm.i_xorrr(ra, rb);        break;
+        case Opcode::ADD_RRR:  vm.i_addrrr(ra, rb, rc);   break;
+        default:               break;
+        }
+    }
+    //! fixedregs() for every R1..R4 pair, indexed by r1 * 4 + r2
+    template <Opcode OPC, std::size_t... I>
+    static const vm_op_handler_t* fixedregsRR(std::index_sequence<I...>) {
+        static const vm_op_handler_t table[] = { &fixedregs<OPC, I / 4, I % 4, 0>... };
+        return table;
+    }
+    //! fixedregs() for every R1..R4 triple, indexed by (r1 * 4 + r2) * 4 + r3
+    template <Opcode OPC, std::size_t... I>
+    static const vm_op_handler_t* fixedregsRRR(std::index_sequence<I...>) {
+        static const vm_op_handler_t table[] = { &fixedregs<OPC, I / 16, I / 4 % 4, I % 4>... };
+        return table;
+    }
+
+    /*! The fixed-register handler for \a op, or nullptr if there isn't one.
+        \a op's register operands must already be known to be valid.  BC_RRR
+        is left out, since the copy itself dwarfs any register lookups. */
+    static vm_op_handler_t fixedRegHandler(const vm_decoded_op_t& op) {
+        typedef std::make_index_sequence<4 * 4> RR;
+        typedef std::make_index_sequence<4 * 4 * 4> RRR;
+        const int rr = op.r1 * 4 + op.r2;
+        switch (op.opcode) {
+        case Opcode::MOV_RR:   return fixedregsRR<Opcode::MOV_RR>(RR())[rr];
+        case Opcode::MOVRP_RR: return fixedregsRR<Opcode::MOVRP_RR>(RR())[rr];
+        case Opcode::MOVPR_RR: return fixedregsRR<Opcode::MOVPR_RR>(RR())[rr];
+        case Opcode::SWAP_RR:  return fixedregsRR<Opcode::SWAP_RR>(RR())[rr];
+        case Opcode::ADD_RR:   return fixedregsRR<Opcode::ADD_RR>(RR())[rr];
+        case Opcode::SUB_RR:   return fixedregsRR<Opcode::SUB_RR>(RR())[rr];
+        case Opcode::MUL_RR:   return fixedregsRR<Opcode::MUL_RR>(RR())[rr];
+        case Opcode::AND_RR:   return fixedregsRR<Opcode::AND_RR>(RR())[rr];
+        case Opcode::OR_RR:    return fixedregsRR<Opcode::OR_RR>(RR())[rr];
+        case Opcode::XOR_RR:   return fixedregsRR<Opcode::XOR_RR>(RR())[rr];
+        case Opcode::ADD_RRR:  return fixedregsRRR<Opcode::ADD_RRR>(RRR())[rr * 4 + op.r3];
+        default:               return nullptr;
+        }
+    }
+};
+
+/** What each VMSuperOp fuses, indexed by VMSuperOp.  Where runs overlap, the
+    first entry that matches wins, so longer runs go ahead of shorter ones.
+    Only the last op of a run may be a jump. */
+struct vm_superop_def_t {
+    const char*     name;
+    int             len;      //!< Number of ops fused
+    Opcode          seq[3];   //!< The ops, in order
+    vm_op_handler_t handler;  //!< Runs the whole sequence
+};
+
+static const vm_superop_def_t superOpDefs[VM_SUPEROP_COUNT] = {
+    { "MOV_RM+ADD_RR+MOV_MR", 3, { Opcode::MOV_RM, Opcode::ADD_RR, Opcode::MOV_MR },
+      &VMOpHandlers::movrm_addrr_movmr },
+    { "ADD_RW+JNZERO_RW", 2, { Opcode::ADD_RW, Opcode::JNZERO_RW }, &VMOpHandlers::addrw_jnzerorw },
+    { "MUL_RW+JMP_W",     2, { Opcode::MUL_RW, Opcode::JMP_W },     &VMOpHandlers::mulrw_jmpw },
+    { "MOVRP_RR+ADD_RW",  2, { Opcode::MOVRP_RR, Opcode::ADD_RW },  &VMOpHandlers::movrprr_addrw },
+    { "ADD_RW+ADD_RW",    2, { Opcode::ADD_RW, Opcode::ADD_RW },    &VMOpHandlers::addrw_addrw },
+    { "MOV_RM+MOV_RM",    2, { Opcode::MOV_RM, Opcode::MOV_RM },    &VMOpHandlers::movrm_movrm },
+    { "MOV_MR+MOV_MR",    2, { Opcode::MOV_MR, Opcode::MOV_MR },    &VMOpHandlers::movmr_movmr },
+};
+
+const char* RobotVM::superOpName(VMSuperOp sop) {
+    return superOpDefs[static_cast<int>(sop)].name;
+}
+
+void RobotVM::resetSuperOpHits() {
+    for (unsigned long& hits : _superhits)
+        hits = 0;
+}
+
+static bool isJumpKind(byte_t kind) {
+    switch (static_cast<Opcode>(kind)) {
+    case Opcode::JMP_W:
+    case Opcode::JNEG_RW:
+    case Opcode::JPOS_RW:
+    case Opcode::JZERO_RW:
+    case Opcode::JNZERO_RW:
+        return true;
+    default:
+        return false;
+    }
+}
+
+//! True for ops that load or store RAM
+static bool touchesRam(Opcode opc) {
+    switch (opc) {
+    case Opcode::MOV_RM:
+    case Opcode::MOVB_RM:
+    case Opcode::MOV_MR:
+    case Opcode::MOVRP_RR:
+    case Opcode::MOVPR_RR:
+    case Opcode::SWAP_RM:
+    case Opcode::BC_RRR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+//! True if any op in \a def may raise a memory fault.  A fault has to stop
+//! the VM right after the op that raised it, which a fused run can't do.
+static bool mayFault(const vm_superop_def_t& def) {
+    if (!VMRamAccess::FAULTS)
+        return false;
+    for (int i = 0; i < def.len; i++)
+        if (touchesRam(def.seq[i]))
+            return true;
+    return false;
+}
+
+/*! Turn the first op of every run matching a superOpDefs[] entry into that
+    superinstruction.  Walks the code the way it was burned, starting at
+    address 0.  Any op a jump lands on may begin a run, but never continue
+    one;  the ops inside a run are left as they were, so jumping into the
+    middle of one still works. */
+static void fuseSuperOps(std::vector<vm_decoded_op_t>& ops) {
+    const std::size_t size = ops.size();
+
+    std::vector<bool> target(size, false);
+    for (std::size_t pc = 0; pc < size; pc = ops[pc].next) {
+        if (isJumpKind(ops[pc].kind) && ops[pc].w < size)
+            target[ops[pc].w] = true;
+    }
+
+    for (std::size_t pc = 0; pc < size; pc = ops[pc].next) {
+        for (int s = 0; s < VM_SUPEROP_COUNT; s++) {
+            const vm_superop_def_t& def = superOpDefs[s];
+            if (mayFault(def))
+                continue;
+            std::size_t at = pc;
+            int matched = 0;
+            while (matched < def.len && at < size
+                   && (matched == 0 || !target[at])
+                   && ops[at].kind == static_cast<byte_t>(def.seq[matched])) {
+                at = ops[at].next;
+                matched++;
+            }
+            if (matched == def.len) {
+                ops[pc].kind = static_cast<byte_t>(VM_OPKIND_SUPER + s);
+                break;
+            }
+        }
+    }
+}
+
+/*! Decode the instruction at ROM address \a pc.  Operand bytes are picked
+    apart exactly the way exec() does it, including its choice of which byte
+    holds the register of an MR instruction. */
+vm_decoded_op_t RobotVM::decodeAt(word_t pc) const {
+    byte_t raw[4] = { 0, 0, 0, 0 };
+    for (int i = 0; i < 4; i++)
+        raw[i] = _rom->at(pc + i);
+
+    const Opcode opc = static_cast<Opcode>(raw[0]);
+    const byte_t* const params = &raw[1];
+    const word_t w1 = static_cast<word_t>(params[0] | (params[1] << 8));
+    const word_t w2 = static_cast<word_t>(params[1] | (params[2] << 8));
+
+    vm_decoded_op_t op;
+    op.opcode = opc;
+    op.len    = static_cast<byte_t>(instrLengthOf(opc));
+    op.next   = static_cast<word_t>(pc + op.len);
+    op.r1     = params[0];
+    op.r2     = params[1];
+    op.r3     = params[2];
+    op.b      = params[0];
+    op.w      = w2;
+    op.handler = &VMOpHandlers::illegal;
+    op.thread = nullptr;
+    op.kind   = VM_OPKIND_ILLEGAL;
+
+    if (!registerOperandsValid(opc, params))
+        return op;
+    if (static_cast<int>(opc) < static_cast<int>(Opcode::NUM_OPCODES))
+        op.kind = static_cast<byte_t>(opc);
+
+    typedef VMOpHandlers H;
+    switch (opc) {
+    case Opcode::NOP:       op.handler = &H::nop;      break;
+    case Opcode::JMP_W:     op.handler = &H::jmpw;     op.w = w1; break;
+    case Opcode::JNEG_RW:   op.handler = &H::jnegrw;   break;
+    case Opcode::JPOS_RW:   op.handler = &H::jposrw;   break;
+    case Opcode::JZERO_RW:  op.handler = &H::jzerorw;  break;
+    case Opcode::JNZERO_RW: op.handler = &H::jnzerorw; break;
+    case Opcode::MOV_RM:    op.handler = &H::movrm;    break;
+    case Opcode::MOVB_RM:   op.handler = &H::movbrm;   break;
+    case Opcode::MOV_MR:    op.handler = &H::movmr;    op.w = w1; break;
+    case Opcode::MOV_RR:    op.handler = &H::movrr;    break;
+    case Opcode::MOV_RW:    op.handler = &H::movrw;    break;
+    case Opcode::MOVRP_RR:  op.handler = &H::movrprr;  break;
+    case Opcode::MOVPR_RR:  op.handler = &H::movprrr;  break;
+    case Opcode::SWAP_RR:   op.handler = &H::swaprr;   break;
+    case Opcode::SWAP_RM:   op.handler = &H::swaprm;   break;
+    case Opcode::BC_RRR:    op.handler = &H::bcrrr;    break;
+    case Opcode::ZERO_NIL:  op.handler = &H::zeronil;  break;
+    case Opcode::AND_RR:    op.handler = &H::andrr;    break;
+    case Opcode::AND_RW:    op.handler = &H::andrw;    break;
+    case Opcode::OR_RR:     op.handler = &H::orrr;     break;
+    case Opcode::OR_RW:     op.handler = &H::orrw;     break;
+    case Opcode::XOR_RR:    op.handler = &H::xorrr;    break;
+    case Opcode::XOR_RW:    op.handler = &H::xorrw;    break;
+    case Opcode::NOT_R:     op.handler = &H::notr;     break;
+    case Opcode::BSL_R:     op.handler = &H::bslr;     break;
+    case Opcode::BSR_R:     op.handler = &H::bsrr;     break;
+    case Opcode::ROL_R:     op.handler = &H::rolr;     break;
+    case Opcode::ROR_R:     op.handler = &H::rorr;     break;
+    case Opcode::HALT_NIL:  op.handler = &H::haltnil;  break;
+    case Opcode::ADD_RW:    op.handler = &H::addrw;    break;
+    case Opcode::ADD_RR:    op.handler = &H::addrr;    break;
+    case Opcode::ADD_RRR:   op.handler = &H::addrrr;   break;
+    case Opcode::SUB_RR:    op.handler = &H::subrr;    break;
+    case Opcode::MUL_RW:    op.handler = &H::mulrw;    break;
+    case Opcode::MUL_RR:    op.handler = &H::mulrr;    break;
+    case Opcode::NEG_R:     op.handler = &H::negr;     break;
+    case Opcode::DUP_R:     op.handler = &H::dupr;     break;
+    case Opcode::PUSH_R:    op.handler = &H::pushr;    break;
+    case Opcode::PUSH_W:    op.handler = &H::pushw;    op.w = w1; break;
+    case Opcode::PUSH_B:    op.handler = &H::pushb;    break;
+    case Opcode::POPW_R:    op.handler = &H::popwr;    break;
+    case Opcode::POPB_R:    op.handler = &H::popbr;    break;
+    case Opcode::RECV_RB:   op.handler = &H::recvrb;   op.b = params[1]; break;
+    case Opcode::SEND_RB:   op.handler = &H::sendrb;   op.b = params[1]; break;
+    case Opcode::WAIT_W:    op.handler = &H::waitw;    op.w = w1; break;
+    case Opcode::NUM_OPCODES:
+    case Opcode::INVALID:
+        op.handler = &H::hcfnil;
+        op.kind = VM_OPKIND_HCF;
+        break;
+    }
+
+    if (_fixedregs) {
+        if (vm_op_handler_t fixed = H::fixedRegHandler(op))
+            op.handler = fixed;
+    }
+
+    // A jump to itself is really a fall-through, since step() advances PC
+    // whenever an instruction leaves it unchanged.  Bake that in here so
+    // engines can always take the jump target at face value.
+    switch (opc) {
+    case Opcode::JMP_W:
+    case Opcode::JNEG_RW:
+    case Opcode::JPOS_RW:
+    case Opcode::JZERO_RW:
+    case Opcode::JNZERO_RW:
+        if (op.w == pc)
+            op.w = op.next;
+        break;
+    default:
+        break;
+    }
+
+    return op;
+}
+
+void RobotVM::predecode() {
+    assert(_rwp == _rom->size());
+    _decoded = _rom->decoded(RomImage::variant(_superops, _fixedregs), [this] {
+        std::vector<vm_decoded_op_t> ops(static_cast<std::size_t>(_rwp) + 1);
+        for (addr_t pc = 0; pc <= _rwp; pc++)
+            ops[pc] = decodeAt(static_cast<word_t>(pc));
+        if (_superops)
+            fuseSuperOps(ops);
+        return std::make_shared<VMDecodedRom>(std::move(ops));
+    });
+}
+
+/*! Calls each predecoded op's handler in turn, same as step() would, except
+    that superinstructions run as a whole whenever \a maxsteps leaves room for
+    all of their ops.  Never traces. */
+unsigned long RobotVM::runDecoded(unsigned long maxsteps) {
+    if (!_decoded)
+        predecode();
+    if (static_cast<addr_t>(_regs.pc) > _rwp)
+        return 0;
+
+    const vm_decoded_op_t* const ops = _decoded->data();
+    unsigned long done = 0;
+    while (done < maxsteps && !_halt) {
+        const vm_decoded_op_t& op = ops[_regs.pc];
+        const unsigned int sop = static_cast<unsigned int>(op.kind - VM_OPKIND_SUPER);
+
+        if (sop < VM_SUPEROP_COUNT
+                && maxsteps - done >= static_cast<unsigned long>(superOpDefs[sop].len)) {
+            superOpDefs[sop].handler(*this, op);
+            _superhits[sop]++;
+            done += superOpDefs[sop].len;
+        } else {
+            word_t oldpc = _regs.pc;
+            op.handler(*this, op);
+            if (oldpc == _regs.pc && !_wait)
+                _regs.pc = op.next;
+            done++;
+        }
+
+        if (static_cast<addr_t>(_regs.pc) > _rwp) {
+            warn("PC exceeded ROM Write Pointer");
+            halt();
+        }
+    }
+    return done;
+}
+
+// === THREADED ENGINE ===
+
+// Labels-as-values are a GCC/Clang extension.  Everything else gets a plain
+// switch inside a loop, which still benefits from the predecoded ops.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(VM_NO_COMPUTED_GOTO)
+#define VM_COMPUTED_GOTO 1
+#else
+#define VM_COMPUTED_GOTO 0
+#endif
+
+// Every kind of op the threaded engine implements, in any order
+#define VM_THREADED_OPS(X) \
+    X(NOP) X(JMP_W) X(JNEG_RW) X(JPOS_RW) X(JZERO_RW) X(JNZERO_RW) \
+    X(MOV_RM) X(MOVB_RM) X(MOV_MR) X(MOV_RR) X(MOV_RW) X(MOVRP_RR) X(MOVPR_RR) \
+    X(SWAP_RR) X(SWAP_RM) X(BC_RRR) X(ZERO_NIL) \
+    X(AND_RR) X(AND_RW) X(OR_RR) X(OR_RW) X(XOR_RR) X(XOR_RW) X(NOT_R) \
+    X(BSL_R) X(BSR_R) X(ROL_R) X(ROR_R) X(HALT_NIL) \
+    X(ADD_RW) X(ADD_RR) X(ADD_RRR) X(SUB_RR) X(MUL_RW) X(MUL_RR) X(NEG_R) X(DUP_R) \
+    X(PUSH_R) X(PUSH_W) X(PUSH_B) X(POPW_R) X(POPB_R) X(RECV_RB) X(SEND_RB) X(WAIT_W)
+
+// ...and every superinstruction
+#define VM_THREADED_SUPEROPS(X) \
+    X(MOVRM_ADDRR_MOVMR) X(ADDRW_JNZERORW) X(MULRW_JMPW) X(MOVRPRR_ADDRW) \
+    X(ADDRW_ADDRW) X(MOVRM_MOVRM) X(MOVMR_MOVMR)
+
+#define VMT_KIND_OP(name)     static_cast<byte_t>(Opcode::name)
+#define VMT_KIND_SUPER(name)  (VM_OPKIND_SUPER + static_cast<int>(VMSuperOp::name))
+#if VM_COMPUTED_GOTO
+#define VMT_OP(name, kind)  L_##name:
+#define VMT_DISPATCH()      goto *op->thread
+#else
+#define VMT_OP(name, kind)  case kind:
+#define VMT_DISPATCH()      goto dispatch
+#endif
+
+/*! Runs the predecoded ops with one dispatch site per op (so the host's
+    branch predictor gets to learn each op's likely successor), rather than
+    funnelling everything through step() and its single call site.
+
+    Behaves exactly like calling step() \a maxsteps times, stopping early
+    once halted.  Never traces. */
+unsigned long RobotVM::runThreaded(unsigned long maxsteps) {
+    if (!_decoded)
+        predecode();
+    if (maxsteps == 0 || static_cast<addr_t>(_regs.pc) > _rwp)
+        return 0;
+
+#if VM_COMPUTED_GOTO
+    if (!_decoded->threaded()) {
+        const void* labels[VM_OPKIND_COUNT];
+        for (int i = 0; i < VM_OPKIND_COUNT; i++)
+            labels[i] = &&L_ILLEGAL;
+#define VMT_BIND(name)  labels[VMT_KIND_OP(name)] = &&L_##name;
+        VM_THREADED_OPS(VMT_BIND)
+#undef VMT_BIND
+#define VMT_BIND(name)  labels[VMT_KIND_SUPER(name)] = &&L_##name;
+        VM_THREADED_SUPEROPS(VMT_BIND)
+#undef VMT_BIND
+        labels[VM_OPKIND_HCF] = &&L_HCF;
+        _decoded->bindThreaded(labels);
+    }
+#endif
+
+    const vm_decoded_op_t* const ops = _decoded->data();
+    const addr_t rwp = _rwp;
+    unsigned long remaining = maxsteps;
+    const vm_decoded_op_t* op = &ops[_regs.pc];
+
+// Every op starts by moving PC along to the next instruction; jumps then
+// overwrite it when taken.  See decodeAt() for why that's always correct.
+#define R(x)    static_cast<RegName>(op->x)
+#define NEXT()  do {                                            \
+        if (static_cast<addr_t>(_regs.pc) > rwp) goto exceeded;  \
+        if (--remaining == 0) goto out;                         \
+        op = &ops[_regs.pc];                                    \
+        VMT_DISPATCH();                                         \
+    } while (0)
+#define NEXT_MAYHALT()  do {                                    \
+        if (_halt) { --remaining; goto out; }                   \
+        NEXT();                                                 \
+    } while (0)
+// Ops touching RAM halt on a fault, but only if VM_MEM_POLICY has any
+#define NEXT_MEM()  do {                                        \
+        if (VMRamAccess::FAULTS) NEXT_MAYHALT();                \
+        else NEXT();                                            \
+    } while (0)
+// Superinstructions move straight on to their next op without dispatching,
+// unless that would go over budget, in which case they stop right there.
+#define FUSE()  do {                                            \
+        if (remaining == 1) NEXT();                             \
+        --remaining;                                            \
+        op = &ops[_regs.pc];                                    \
+    } while (0)
+#define SUPERHIT(name)  _superhits[static_cast<int>(VMSuperOp::name)]++
+
+#if VM_COMPUTED_GOTO
+    VMT_DISPATCH();
+#else
+dispatch:
+    switch (op->kind) {
+#endif
+
+    VMT_OP(NOP, VMT_KIND_OP(NOP))
+        _regs.pc = op->next;
+        NEXT();
+    VMT_OP(JMP_W, VMT_KIND_OP(JMP_W))
+        i_jmpw(op->w);
+        NEXT();
+    VMT_OP(JNEG_RW, VMT_KIND_OP(JNEG_RW))
+        _regs.pc = op->next;
+        i_jnegrw(R(r1), op->w);
+        NEXT();
+    VMT_OP(JPOS_RW, VMT_KIND_OP(JPOS_RW))
+        _regs.pc = op->next;
+        i_jposrw(R(r1), op->w);
+        NEXT();
+    VMT_OP(JZERO_RW, VMT_KIND_OP(JZERO_RW))
+        _regs.pc = op->next;
+        i_jzerorw(R(r1), op->w);
+        NEXT();
+    VMT_OP(JNZERO_RW, VMT_KIND_OP(JNZERO_RW))
+        _regs.pc = op->next;
+        i_jnzerorw(R(r1), op->w);
+        NEXT();
+    VMT_OP(MOV_RM, VMT_KIND_OP(MOV_RM))
+        _regs.pc = op->next;
+        i_movrm(R(r1), op->w);
+        NEXT_MEM();
+    VMT_OP(MOVB_RM, VMT_KIND_OP(MOVB_RM))
+        _regs.pc = op->next;
+        i_movbrm(R(r1), op->w);
+        NEXT_MEM();
+    VMT_OP(MOV_MR, VMT_KIND_OP(MOV_MR))
+        _regs.pc = op->next;
+        i_movmr(op->w, R(r2));
+        NEXT_MEM();
+    VMT_OP(MOV_RR, VMT_KIND_OP(MOV_RR))
+        _regs.pc = op->next;
+        i_movrr(R(r1), R(r2));
+        NEXT();
+    VMT_OP(MOV_RW, VMT_KIND_OP(MOV_RW))
+        _regs.pc = op->next;
+        i_movrw(R(r1), op->w);
+        NEXT();
+    VMT_OP(MOVRP_RR, VMT_KIND_OP(MOVRP_RR))
+        _regs.pc = op->next;
+        i_movrprr(R(r1), R(r2));
+        NEXT_MEM();
+    VMT_OP(MOVPR_RR, VMT_KIND_OP(MOVPR_RR))
+        _regs.pc = op->next;
+        i_movprrr(R(r1), R(r2));
+        NEXT_MEM();
+    VMT_OP(SWAP_RR, VMT_KIND_OP(SWAP_RR))
+        _regs.pc = op->next;
+        i_swaprr(R(r1), R(r2));
+        NEXT();
+    VMT_OP(SWAP_RM, VMT_KIND_OP(SWAP_RM))
+        _regs.pc = op->next;
+        i_swaprm(R(r1), op->w);
+        NEXT_MEM();
+    VMT_OP(BC_RRR, VMT_KIND_OP(BC_RRR))
+        _regs.pc = op->next;
+        i_bcrrr(R(r1), R(r2), R(r3));
+        NEXT_MAYHALT();
+    VMT_OP(ZERO_NIL, VMT_KIND_OP(ZERO_NIL))
+        _regs.pc = op->next;
+        i_zeronil();
+        NEXT();
+    VMT_OP(AND_RR, VMT_KIND_OP(AND_RR))
+        _regs.pc = op->next;
+        i_andrr(R(r1), R(r2));
+        NEXT();
+    VMT_OP(AND_RW, VMT_KIND_OP(AND_RW))
+        _regs.pc = op->next;
+        i_andrw(R(r1), op->w);
+        NEXT();
+    VMT_OP(OR_RR, VMT_KIND_OP(OR_RR))
+        _regs.pc = op->next;
+        i_orrr(R(r1), R(r2));
+        NEXT();
+    VMT_OP(OR_RW, VMT_KIND_OP(OR_RW))
+        _regs.pc = op->next;
+        i_orrw(R(r1), op->w);
+        NEXT();
+    VMT_OP(XOR_RR, VMT_KIND_OP(XOR_RR))
+        _regs.pc = op->next;
+        i_xorrr(R(r1), R(r2));
+        NEXT();
+    VMT_OP(XOR_RW, VMT_KIND_OP(XOR_RW))
+        _regs.pc = op->next;
+        i_xorrw(R(r1), op->w);
+        NEXT();
+    VMT_OP(NOT_R, VMT_KIND_OP(NOT_R))
+        _regs.pc = op->next;
+        i_notr(R(r1));
+        NEXT();
+    VMT_OP(BSL_R, VMT_KIND_OP(BSL_R))
+        _regs.pc = op->next;
+        i_bslr(R(r1));
+        NEXT();
+    VMT_OP(BSR_R, VMT_KIND_OP(BSR_R))
+        _regs.pc = op->next;
+        i_bsrr(R(r1));
+        NEXT();
+    VMT_OP(ROL_R, VMT_KIND_OP(ROL_R))
+        _regs.pc = op->next;
+        i_rolr(R(r1));
+        NEXT();
+    VMT_OP(ROR_R, VMT_KIND_OP(ROR_R))
+        _regs.pc = op->next;
+        i_rorr(R(r1));
+        NEXT();
+    VMT_OP(HALT_NIL, VMT_KIND_OP(HALT_NIL))
+        _regs.pc = op->next;
+        i_haltnil();
+        NEXT_MAYHALT();
+    VMT_OP(ADD_RW, VMT_KIND_OP(ADD_RW))
+        _regs.pc = op->next;
+        i_addrw(R(r1), op->w);
+        NEXT();
+    VMT_OP(ADD_RR, VMT_KIND_OP(ADD_RR))
+        _regs.pc = op->next;
+        i_addrr(R(r1), R(r2));
+        NEXT();
+    VMT_OP(ADD_RRR, VMT_KIND_OP(ADD_RRR))
+        _regs.pc = op->next;
+        i_addrrr(R(r1), R(r2), R(r3));
+        NEXT();
+    VMT_OP(SUB_RR, VMT_KIND_OP(SUB_RR))
+        _regs.pc = op->next;
+        i_subrr(R(r1), R(r2));
+        NEXT();
+    VMT_OP(MUL_RW, VMT_KIND_OP(MUL_RW))
+        _regs.pc = op->next;
+        i_mulrw(R(r1), op->w);
+        NEXT();
+    VMT_OP(MUL_RR, VMT_KIND_OP(MUL_RR))
+        _regs.pc = op->next;
+        i_mulrr(R(r1), R(r2));
+        NEXT();
+    VMT_OP(NEG_R, VMT_KIND_OP(NEG_R))
+        _regs.pc = op->next;
+        i_negr(R(r1));
+        NEXT();
+    VMT_OP(DUP_R, VMT_KIND_OP(DUP_R))
+        _regs.pc = op->next;
+        i_dupr(R(r1));
+        NEXT();
+    VMT_OP(PUSH_R, VMT_KIND_OP(PUSH_R))
+        _regs.pc = op->next;
+        i_pushr(R(r1));
+        NEXT();
+    VMT_OP(PUSH_W, VMT_KIND_OP(PUSH_W))
+        _regs.pc = op->next;
+        i_pushw(op->w);
+        NEXT();
+    VMT_OP(PUSH_B, VMT_KIND_OP(PUSH_B))
+        _regs.pc = op->next;
+        i_pushb(op->b);
+        NEXT();
+    VMT_OP(POPW_R, VMT_KIND_OP(POPW_R))
+        _regs.pc = op->next;
+        i_popwr(R(r1));
+        NEXT();
+    VMT_OP(POPB_R, VMT_KIND_OP(POPB_R))
+        _regs.pc = op->next;
+        i_popbr(R(r1));
+        NEXT();
+    VMT_OP(RECV_RB, VMT_KIND_OP(RECV_RB))
+        i_recvrb(R(r1), op->b);
+        if (!_wait)   // else PC stays put, to try again next time
+            _regs.pc = op->next;
+        NEXT_MAYHALT();
+    VMT_OP(SEND_RB, VMT_KIND_OP(SEND_RB))
+        i_sendrb(R(r1), op->b);
+        if (!_wait)
+            _regs.pc = op->next;
+        NEXT_MAYHALT();
+    VMT_OP(WAIT_W, VMT_KIND_OP(WAIT_W))
+        i_waitw(op->w);
+        if (!_wait)
+            _regs.pc = op->next;
+        NEXT_MAYHALT();
+
+    VMT_OP(MOVRM_ADDRR_MOVMR, VMT_KIND_SUPER(MOVRM_ADDRR_MOVMR))
+        _regs.pc = op->next;
+        i_movrm(R(r1), op->w);
+        FUSE();
+        _regs.pc = op->next;
+        i_addrr(R(r1), R(r2));
+        FUSE();
+        _regs.pc = op->next;
+        i_movmr(op->w, R(r2));
+        SUPERHIT(MOVRM_ADDRR_MOVMR);
+        NEXT();
+    VMT_OP(ADDRW_JNZERORW, VMT_KIND_SUPER(ADDRW_JNZERORW))
+        _regs.pc = op->next;
+        i_addrw(R(r1), op->w);
+        FUSE();
+        _regs.pc = op->next;
+        i_jnzerorw(R(r1), op->w);
+        SUPERHIT(ADDRW_JNZERORW);
+        NEXT();
+    VMT_OP(MULRW_JMPW, VMT_KIND_SUPER(MULRW_JMPW))
+        _regs.pc = op->next;
+        i_mulrw(R(r1), op->w);
+        FUSE();
+        i_jmpw(op->w);
+        SUPERHIT(MULRW_JMPW);
+        NEXT();
+    VMT_OP(MOVRPRR_ADDRW, VMT_KIND_SUPER(MOVRPRR_ADDRW))
+        _regs.pc = op->next;
+        i_movrprr(R(r1), R(r2));
+        FUSE();
+        _regs.pc = op->next;
+        i_addrw(R(r1), op->w);
+        SUPERHIT(MOVRPRR_ADDRW);
+        NEXT();
+    VMT_OP(ADDRW_ADDRW, VMT_KIND_SUPER(ADDRW_ADDRW))
+        _regs.pc = op->next;
+        i_addrw(R(r1), op->w);
+        FUSE();
+        _regs.pc = op->next;
+        i_addrw(R(r1), op->w);
+        SUPERHIT(ADDRW_ADDRW);
+        NEXT();
+    VMT_OP(MOVRM_MOVRM, VMT_KIND_SUPER(MOVRM_MOVRM))
+        _regs.pc = op->next;
+        i_movrm(R(r1), op->w);
+        FUSE();
+        _regs.pc = op->next;
+        i_movrm(R(r1), op->w);
+        SUPERHIT(MOVRM_MOVRM);
+        NEXT();
+    VMT_OP(MOVMR_MOVMR, VMT_KIND_SUPER(MOVMR_MOVMR))
+        _regs.pc = op->next;
+        i_movmr(op->w, R(r2));
+        FUSE();
+        _regs.pc = op->next;
+        i_movmr(op->w, R(r2));
+        SUPERHIT(MOVMR_MOVMR);
+        NEXT();
+
+    VMT_OP(HCF, VM_OPKIND_HCF)
+        _regs.pc = op->next;
+        i_hcfnil();
+        NEXT_MAYHALT();
+#if !VM_COMPUTED_GOTO
+    default:
+#endif
+    VMT_OP(ILLEGAL, VM_OPKIND_ILLEGAL)
+        _regs.pc = op->next;
+        VMOpHandlers::illegal(*this, *op);
+        NEXT_MAYHALT();
+
+#if !VM_COMPUTED_GOTO
+    }
+#endif
+
+exceeded:
+    --remaining;
+    warn("PC exceeded ROM Write Pointer");
+    halt();
+out:
+    return maxsteps - remaining;
+
+#undef SUPERHIT
+#undef FUSE
+#undef NEXT_MAYHALT
+#undef NEXT_MEM
+#undef NEXT
+#undef R
+}
+
+#undef VMT_DISPATCH
+#undef VMT_OP
+#undef VMT_KIND_SUPER
+#undef VMT_KIND_OP
+
+// === JIT ENGINE ===
+
+#if VM_HAS_JIT
+/*! Runs native code for whole blocks at a time, dropping back to the
+    interpreter for one instruction whenever a block can't be compiled, would
+    overrun \a maxsteps, or bailed out early.  Behaves exactly like calling
+    step() \a maxsteps times, stopping early once halted.  Never traces. */
+unsigned long RobotVM::runJit(unsigned long maxsteps) {
+    if (!_decoded)
+        predecode();
+    if (static_cast<addr_t>(_regs.pc) > _rwp)
+        return 0;
+    // shared with every VM running the same ROM, like _decoded itself
+    VMJit& jit = _decoded->jit();
+
+    unsigned long done = 0;
+    while (done < maxsteps && !_halt) {
+        const vm_jit_block_t& block = jit.blockAt(_regs.pc);
+        if (block.fn && block.len <= maxsteps - done) {
+            std::uint32_t result = block.fn(_regs.r, &_ram);
+            unsigned int ran = result >> 16;
+            _regs.pc = static_cast<word_t>(result & 0xFFFF);
+            done += ran;
+
+            if (static_cast<addr_t>(_regs.pc) > _rwp) {
+                warn("PC exceeded ROM Write Pointer");
+                halt();
+            }
+            if (ran == block.len)
+                continue;
+        }
+
+        // whatever the block couldn't do, the interpreter gets to
+        if (done < maxsteps && !_halt)
+            done += runDecoded(1);
+    }
+    return done;
+}
+#endif
@@ -0,0 +1,38 @@
+#include <new>
+#include "RobotVMPool.h"
+
+RobotVMPool::RobotVMPool(std::size_t blockVMs)
+    : _arena(blockVMs), _blocks(), _blockVMs(blockVMs ? blockVMs : 1), _constructed(0), _free() {
+}
+
+RobotVMPool::~RobotVMPool() {
+    for (std::size_t i = 0; i < _constructed; i++)
+        reinterpret_cast<RobotVM*>(&_blocks[i / _blockVMs][i % _blockVMs])->~RobotVM();
+}
+
+RobotVM* RobotVMPool::spawn() {
+    if (!_free.empty()) {
+        RobotVM* const vm = _free.back();
+        _free.pop_back();
+        _arena.revive(vm->slot());
+        return vm;
+    }
+
+    if (_constructed == _blocks.size() * _blockVMs)
+        _blocks.emplace_back(new vm_storage_t[_blockVMs]);
+    void* const at = &_blocks[_constructed / _blockVMs][_constructed % _blockVMs];
+    RobotVM* const vm = new (at) RobotVM(_arena);
+    _constructed++;
+    return vm;
+}
+
+RobotVM* RobotVMPool::fork(RobotVM& parent) {
+    RobotVM* const child = spawn();
+    child->inherit(parent);
+    return child;
+}
+
+void RobotVMPool::despawn(RobotVM* vm) {
+    vm->recycle();
+    _free.push_back(vm);
+}
@@ -0,0 +1,32 @@
+#include "RomImage.h"
+#include "VMStateHash.h"
+
+const std::shared_ptr<const RomImage>& RomImage::empty() {
+    static const std::shared_ptr<const RomImage> none(new RomImage());
+    return none;
+}
+
+void RomImage::write(std::size_t addr, const byte_t* bytes, std::size_t len) {
+    if (len == 0)
+        return;
+    if (_bytes.size() < addr + len)
+        _bytes.resize(addr + len, 0);
+    std::memcpy(&_bytes[addr], bytes, len);
+    _hash = 0;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (std::shared_ptr<VMDecodedRom>& d : _decoded)
+        d.reset();
+}
+
+std::uint64_t RomImage::hash() const {
+    std::uint64_t h = _hash.load(std::memory_order_relaxed);
+    if (!h) {
+        // threads racing here all work out the same answer, so any of them may store it
+        h = VMStateHash::bytes(_bytes.data(), _bytes.size());
+        if (!h)
+            h = 1;
+        _hash.store(h, std::memory_order_relaxed);
+    }
+    return h;
+}
@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <cmath>
+#include "TickBudgetController.h"
+
+TickBudgetController::TickBudgetController(double deadline, unsigned long minBudget, unsigned long maxBudget,
+                                           double percentile, std::size_t window)
+    : _deadline(deadline), _percentile(percentile), _min(0), _max(0), _budget(maxBudget), _vms(0),
+      _costs(window ? window : 1), _latency(window ? window : 1), _scratch(window ? window : 1),
+      _next(0), _stats() {
+    setLimits(minBudget, maxBudget);
+}
+
+void TickBudgetController::setLimits(unsigned long minBudget, unsigned long maxBudget) {
+    _max = maxBudget ? maxBudget : 1;
+    _min = minBudget < 1 ? 1 : minBudget > _max ? _max : minBudget;
+    _budget = std::min(std::max(_budget, _min), _max);
+    _stats.budget = _budget;
+}
+
+double TickBudgetController::quantile(const std::vector<double>& samples, std::size_t n) {
+    // the sample that a fraction _percentile of them are no bigger than
+    std::size_t rank = static_cast<std::size_t>(std::ceil(_percentile * n));
+    rank = rank ? rank - 1 : 0;
+    if (rank >= n)
+        rank = n - 1;
+    std::copy(samples.begin(), samples.begin() + n, _scratch.begin());
+    std::nth_element(_scratch.begin(), _scratch.begin() + rank, _scratch.begin() + n);
+    return _scratch[rank];
+}
+
+unsigned long TickBudgetController::budgetFor(std::size_t vms) {
+    _vms = vms;
+    _stats.vms = vms;
+    const std::size_t n = _next < _costs.size() ? _next : _costs.size();
+    // nothing to go on yet, or nothing to run
+    if (n == 0 || vms == 0)
+        return _budget;
+
+    const double cost = quantile(_costs, n) * vms;
+    // the budget the deadline has room for, if cost is right
+    const double fits = cost > 0.0 ? _deadline / cost : static_cast<double>(_max);
+    unsigned long next;
+    if (fits < _budget) {
+        next = fits < _min ? _min : static_cast<unsigned long>(fits);
+    } else {
+        const unsigned long step = _budget / 8 ? _budget / 8 : 1;
+        next = fits < static_cast<double>(_budget + step) ? static_cast<unsigned long>(fits) : _budget + step;
+        if (next > _max)
+            next = _max;
+    }
+
+    if (next < _budget)
+        _stats.cuts++;
+    else if (next > _budget)
+        _stats.raises++;
+    _budget = next;
+    _stats.budget = next;
+    _stats.predicted = cost * next;
+    if (next == _min && _stats.predicted > _deadline)
+        _stats.floored++;
+    return next;
+}
+
+void TickBudgetController::record(double seconds) {
+    _stats.ticks++;
+    if (seconds > _deadline)
+        _stats.late++;
+    // a tick that ran nothing says nothing about what running costs
+    if (_vms == 0)
+        return;
+
+    const std::size_t window = _costs.size();
+    _costs[_next % window] = seconds / (static_cast<double>(_budget) * _vms);
+    _latency[_next % window] = seconds;
+    _next++;
+    _stats.latency = quantile(_latency, _next < window ? _next : window);
+}
@@ -0,0 +1,201 @@
+#include <chrono>
+#include "TickScheduler.h"
+
+typedef std::chrono::steady_clock tick_clock;
+
+TickScheduler::TickScheduler(unsigned int threads, bool pinned)
+    : _threads(), _mutex(), _wake(), _finished(), _generation(0), _pending(0), _quit(false),
+      _error(), _job(nullptr), _bounds(), _pinned(pinned), _workers() {
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+
+    const HostTopology& topology = HostTopology::host();
+    for (unsigned int w = 0; w < threads; w++) {
+        _workers.emplace_back(new Worker());
+        topology.place(w, threads, _workers[w]->node, _workers[w]->cpu);
+    }
+    // Steal round the ring of workers starting with the next one, as ever,
+    // but from workers on the same node before any on another
+    for (unsigned int w = 0; w < threads; w++) {
+        Worker& self = *_workers[w];
+        for (int local = 1; local >= 0; local--) {
+            for (unsigned int k = 1; k < threads; k++) {
+                const unsigned int victim = (w + k) % threads;
+                if ((_workers[victim]->node == self.node) == (local == 1))
+                    self.victims.push_back(victim);
+            }
+        }
+    }
+    for (unsigned int w = 1; w < threads; w++)
+        _threads.emplace_back(&TickScheduler::workerLoop, this, w);
+}
+
+TickScheduler::~TickScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+    _wake.notify_all();
+    for (std::thread& t : _threads)
+        t.join();
+}
+
+void TickScheduler::runBatch(Worker& self, unsigned int worker, std::size_t batch) {
+    const auto start = tick_clock::now();
+    self.done += (*_job)(_bounds[batch], _bounds[batch + 1], worker);
+    self.busy += std::chrono::duration<double>(tick_clock::now() - start).count();
+    self.stats.batches++;
+}
+
+void TickScheduler::runShare(unsigned int worker) {
+    Worker& self = *_workers[worker];
+    const std::size_t n = self.victims.size();
+    try {
+        std::size_t batch;
+        while (self.batches.pop(batch))
+            runBatch(self, worker, batch);
+
+        // Out of our own work:  go round everyone else stealing until a whole
+        // lap turns up nothing.  Nobody adds batches mid-tick, so once every
+        // deque has been seen empty there's nothing left to do.
+        std::size_t from = 0;
+        bool more = n > 0;
+        while (more) {
+            more = false;
+            for (std::size_t k = 0; k < n; k++) {
+                const std::size_t at = (from + k) % n;
+                Worker& victim = *_workers[self.victims[at]];
+                const StealResult got = victim.batches.steal(batch);
+                if (got == StealResult::STOLEN) {
+                    self.stats.steals++;
+                    if (victim.node != self.node)
+                        self.stats.remoteSteals++;
+                    runBatch(self, worker, batch);
+                    // whoever we robbed probably has more where that came from
+                    from = at;
+                    more = true;
+                    break;
+                }
+                self.stats.failedSteals++;
+                if (got == StealResult::LOST)
+                    more = true;
+            }
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_error)
+            _error = std::current_exception();
+    }
+}
+
+void TickScheduler::workerLoop(unsigned int worker) {
+    if (_pinned)
+        HostTopology::pinThread(_workers[worker]->cpu);
+
+    unsigned long seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [&] { return _quit || _generation != seen; });
+            if (_quit)
+                return;
+            seen = _generation;
+        }
+
+        runShare(worker);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (--_pending == 0)
+            _finished.notify_one();
+    }
+}
+
+unsigned long TickScheduler::run(std::size_t count, std::size_t batchSize, const job_t& job) {
+    if (batchSize == 0)
+        batchSize = 1;
+
+    // an even share of the batches each
+    const unsigned int n = threads();
+    const std::size_t batches = (count + batchSize - 1) / batchSize;
+    std::vector<std::size_t> shares(n);
+    for (unsigned int w = 0; w < n; w++) {
+        const std::size_t first = batches * w / n * batchSize;
+        const std::size_t last = batches * (w + 1) / n * batchSize;
+        shares[w] = (last < count ? last : count) - (first < count ? first : count);
+    }
+    return run(shares, batchSize, job);
+}
+
+unsigned long TickScheduler::run(const std::vector<std::size_t>& shards, std::size_t batchSize, const job_t& job) {
+    if (batchSize == 0)
+        batchSize = 1;
+
+    const auto start = tick_clock::now();
+    const unsigned int n = threads();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _job = &job;
+        _error = nullptr;
+
+        // Cut each worker's shard into batches, pushed last-first so that the
+        // owner pops its batches in order and thieves take from the far end.
+        // The workers are all idle, and the mutex publishes this to them.
+        _bounds.clear();
+        std::size_t item = 0;
+        for (unsigned int w = 0; w < n; w++) {
+            Worker& worker = *_workers[w];
+            const std::size_t first = _bounds.size();
+            const std::size_t end = item + shards[w];
+            for (; item < end; item += batchSize)
+                _bounds.push_back(item);
+            item = end;
+            const std::size_t last = _bounds.size();
+            worker.batches.reset(last - first);
+            for (std::size_t b = last; b > first; b--)
+                worker.batches.push(b - 1);
+            worker.done = 0;
+            worker.busy = 0.0;
+        }
+        _bounds.push_back(item);
+
+        _pending = static_cast<unsigned int>(_threads.size());
+        _generation++;
+    }
+    _wake.notify_all();
+
+    {
+        // worker 0 is whoever called us, so only pinned while it works for us
+        std::unique_ptr<ScopedThreadPin> pin;
+        if (_pinned)
+            pin.reset(new ScopedThreadPin(_workers[0]->cpu));
+        runShare(0);
+    }
+
+    // the tick barrier
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _finished.wait(lock, [&] { return _pending == 0; });
+        _job = nullptr;
+        error = _error;
+    }
+
+    const double seconds = std::chrono::duration<double>(tick_clock::now() - start).count();
+    unsigned long total = 0;
+    for (const std::unique_ptr<Worker>& w : _workers) {
+        total += w->done;
+        w->stats.busySeconds += w->busy;
+        w->stats.idleSeconds += seconds > w->busy ? seconds - w->busy : 0.0;
+    }
+
+    if (error)
+        std::rethrow_exception(error);
+    return total;
+}
+
+void TickScheduler::resetWorkerStats() {
+    for (const std::unique_ptr<Worker>& w : _workers)
+        w->stats = tick_worker_stats_t();
+}
@@ -0,0 +1,415 @@
+#include <algorithm>
+#include <cstring>
+#include "VMBatch.h"
+#include "RobotVM.h"
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define VM_BATCH_SIMD 1
+#else
+#define VM_BATCH_SIMD 0
+#endif
+
+namespace {
+
+/** One sword_t per lane.  Comparisons give all-ones lanes for true and zero
+    lanes for false, which is what select() takes as its mask. */
+#if VM_BATCH_SIMD
+
+// SSE2 and AVX2 only differ in the width of the vector and the names of the
+// intrinsics, so both versions come out of the one macro.
+#define VM_LANES_SIMD(VEC, PFX, SI)                                                    \
+struct Lanes {                                                                         \
+    VEC v;                                                                             \
+                                                                                       \
+    static Lanes load(const sword_t* p) {                                              \
+        return { PFX##load_##SI(reinterpret_cast<const VEC*>(p)) };                    \
+    }                                                                                  \
+    void store(sword_t* p) const {                                                     \
+        PFX##store_##SI(reinterpret_cast<VEC*>(p), v);                                 \
+    }                                                                                  \
+    static Lanes all(int x) { return { PFX##set1_epi16(static_cast<short>(x)) }; }     \
+    static Lanes add(Lanes a, Lanes b) { return { PFX##add_epi16(a.v, b.v) }; }        \
+    static Lanes sub(Lanes a, Lanes b) { return { PFX##sub_epi16(a.v, b.v) }; }        \
+    static Lanes mul(Lanes a, Lanes b) { return { PFX##mullo_epi16(a.v, b.v) }; }      \
+    static Lanes band(Lanes a, Lanes b) { return { PFX##and_##SI(a.v, b.v) }; }        \
+    static Lanes bor(Lanes a, Lanes b) { return { PFX##or_##SI(a.v, b.v) }; }          \
+    static Lanes bxor(Lanes a, Lanes b) { return { PFX##xor_##SI(a.v, b.v) }; }        \
+    static Lanes shl(Lanes a, int n) { return { PFX##slli_epi16(a.v, n) }; }           \
+    static Lanes shr(Lanes a, int n) { return { PFX##srli_epi16(a.v, n) }; }           \
+    static Lanes eq(Lanes a, Lanes b) { return { PFX##cmpeq_epi16(a.v, b.v) }; }       \
+    static Lanes gt(Lanes a, Lanes b) { return { PFX##cmpgt_epi16(a.v, b.v) }; }       \
+    /*! \a a where \a mask is set, else \a b */                                        \
+    static Lanes select(Lanes mask, Lanes a, Lanes b) {                                \
+        return { PFX##or_##SI(PFX##and_##SI(mask.v, a.v), PFX##andnot_##SI(mask.v, b.v)) }; \
+    }                                                                                  \
+};
+
+#if defined(__AVX2__)
+VM_LANES_SIMD(__m256i, _mm256_, si256)
+#else
+VM_LANES_SIMD(__m128i, _mm_, si128)
+#endif
+#undef VM_LANES_SIMD
+
+#else // !VM_BATCH_SIMD
+
+struct Lanes {
+    sword_t v[VM_BATCH_LANES];
+
+    template <class F>
+    static Lanes each(F f) {
+        Lanes r;
+        for (int i = 0; i < VM_BATCH_LANES; i++)
+            r.v[i] = static_cast<sword_t>(f(i));
+        return r;
+    }
+
+    static Lanes load(const sword_t* p) { return each([&](int i) { return p[i]; }); }
+    void store(sword_t* p) const { std::memcpy(p, v, sizeof(v)); }
+    static Lanes all(int x) { return each([&](int) { return x; }); }
+    static Lanes add(Lanes a, Lanes b) { return each([&](int i) { return a.v[i] + b.v[i]; }); }
+    static Lanes sub(Lanes a, Lanes b) { return each([&](int i) { return a.v[i] - b.v[i]; }); }
+    static Lanes mul(Lanes a, Lanes b) { return each([&](int i) { return a.v[i] * b.v[i]; }); }
+    static Lanes band(Lanes a, Lanes b) { return each([&](int i) { return a.v[i] & b.v[i]; }); }
+    static Lanes bor(Lanes a, Lanes b) { return each([&](int i) { return a.v[i] | b.v[i]; }); }
+    static Lanes bxor(Lanes a, Lanes b) { return each([&](int i) { return a.v[i] ^ b.v[i]; }); }
+    static Lanes shl(Lanes a, int n) { return each([&](int i) { return static_cast<word_t>(a.v[i]) << n; }); }
+    static Lanes shr(Lanes a, int n) { return each([&](int i) { return static_cast<word_t>(a.v[i]) >> n; }); }
+    static Lanes eq(Lanes a, Lanes b) { return each([&](int i) { return a.v[i] == b.v[i] ? -1 : 0; }); }
+    static Lanes gt(Lanes a, Lanes b) { return each([&](int i) { return a.v[i] > b.v[i] ? -1 : 0; }); }
+    static Lanes select(Lanes mask, Lanes a, Lanes b) {
+        return each([&](int i) { return mask.v[i] ? a.v[i] : b.v[i]; });
+    }
+};
+
+#endif // VM_BATCH_SIMD
+
+//! How a VMBatch runs an op
+enum class LaneStep {
+    SIMD,      //!< All lanes at once, in SIMD registers
+    RAM,       //!< Lane by lane, each on its own VM's RAM, but still in lockstep
+    ALONE      //!< Each lane's own VM runs the op
+};
+
+/*! How \a op gets run.  SIMD and RAM ops touch nothing but the general
+    registers, PC and RAM, and never leave PC past the end of ROM (\a rwp). */
+LaneStep howToRun(const vm_decoded_op_t& op, addr_t rwp) {
+    if (op.kind == VM_OPKIND_ILLEGAL || op.kind == VM_OPKIND_HCF)
+        return LaneStep::ALONE;
+
+    switch (op.opcode) {
+    case Opcode::JMP_W:
+        return op.w <= rwp ? LaneStep::SIMD : LaneStep::ALONE;
+    case Opcode::JNEG_RW:
+    case Opcode::JPOS_RW:
+    case Opcode::JZERO_RW:
+    case Opcode::JNZERO_RW:
+        return op.w <= rwp && op.next <= rwp ? LaneStep::SIMD : LaneStep::ALONE;
+
+    case Opcode::NOP:
+    case Opcode::MOV_RR:
+    case Opcode::MOV_RW:
+    case Opcode::SWAP_RR:
+    case Opcode::ZERO_NIL:
+    case Opcode::DUP_R:
+    case Opcode::ADD_RW:
+    case Opcode::ADD_RR:
+    case Opcode::ADD_RRR:
+    case Opcode::SUB_RR:
+    case Opcode::MUL_RW:
+    case Opcode::MUL_RR:
+    case Opcode::NEG_R:
+    case Opcode::AND_RR:
+    case Opcode::AND_RW:
+    case Opcode::OR_RR:
+    case Opcode::OR_RW:
+    case Opcode::XOR_RR:
+    case Opcode::XOR_RW:
+    case Opcode::NOT_R:
+    case Opcode::BSL_R:
+    case Opcode::BSR_R:
+    case Opcode::ROL_R:
+    case Opcode::ROR_R:
+        return op.next <= rwp ? LaneStep::SIMD : LaneStep::ALONE;
+
+    case Opcode::MOV_RM:
+    case Opcode::MOVB_RM:
+    case Opcode::MOV_MR:
+    case Opcode::SWAP_RM:
+    case Opcode::MOVRP_RR:
+    case Opcode::MOVPR_RR:
+        return op.next <= rwp ? LaneStep::RAM : LaneStep::ALONE;
+
+    default:   // BC_RRR, stack, HALT_NIL, ports
+        return LaneStep::ALONE;
+    }
+}
+
+bool isJump(Opcode opc) {
+    return opc == Opcode::JMP_W || opc == Opcode::JNEG_RW || opc == Opcode::JPOS_RW
+           || opc == Opcode::JZERO_RW || opc == Opcode::JNZERO_RW;
+}
+
+/*! Run \a op on every lane set in \a mask, exactly the way the matching i_*
+    member would.  \a op must be a LaneStep::SIMD op. */
+void execLanes(const vm_decoded_op_t& op, sword_t (*reg)[VM_BATCH_LANES], sword_t* pc,
+               const sword_t* mask) {
+    typedef Lanes L;
+    const L m = L::load(mask);
+    const L w = L::all(op.w);
+    const L zero = L::all(0);
+    auto get = [&](byte_t r) { return L::load(reg[r]); };
+    auto set = [&](byte_t r, L v) { L::select(m, v, get(r)).store(reg[r]); };
+    L next = L::all(op.next);
+
+    switch (op.opcode) {
+    case Opcode::NOP:
+        break;
+    case Opcode::MOV_RR:  set(op.r1, get(op.r2));  break;
+    case Opcode::MOV_RW:  set(op.r1, w);  break;
+    case Opcode::SWAP_RR: {
+        const L a = get(op.r1), b = get(op.r2);
+        set(op.r2, a);
+        set(op.r1, b);
+        break;
+    }
+    case Opcode::ZERO_NIL:
+        for (byte_t r = 0; r < 4; r++)
+            set(r, zero);
+        break;
+    case Opcode::DUP_R: {
+        const L v = get(op.r1);
+        for (byte_t r = op.r1; r < 4; r++)
+            set(r, v);
+        break;
+    }
+    case Opcode::ADD_RW:  set(op.r1, L::add(get(op.r1), w));  break;
+    case Opcode::ADD_RR:  set(op.r1, L::add(get(op.r1), get(op.r2)));  break;
+    case Opcode::ADD_RRR: set(op.r1, L::add(get(op.r1), L::add(get(op.r2), get(op.r3))));  break;
+    case Opcode::SUB_RR:  set(op.r1, L::sub(get(op.r1), get(op.r2)));  break;
+    case Opcode::MUL_RW:  set(op.r1, L::mul(get(op.r1), w));  break;
+    case Opcode::MUL_RR:  set(op.r1, L::mul(get(op.r1), get(op.r2)));  break;
+    case Opcode::NEG_R:   set(op.r1, L::sub(zero, get(op.r1)));  break;
+    case Opcode::AND_RR:  set(op.r1, L::band(get(op.r1), get(op.r2)));  break;
+    case Opcode::AND_RW:  set(op.r1, L::band(get(op.r1), w));  break;
+    case Opcode::OR_RR:   set(op.r1, L::bor(get(op.r1), get(op.r2)));  break;
+    case Opcode::OR_RW:   set(op.r1, L::bor(get(op.r1), w));  break;
+    case Opcode::XOR_RR:  set(op.r1, L::bxor(get(op.r1), get(op.r2)));  break;
+    case Opcode::XOR_RW:  set(op.r1, L::bxor(get(op.r1), w));  break;
+    case Opcode::NOT_R:   set(op.r1, L::bxor(get(op.r1), L::all(-1)));  break;
+    case Opcode::BSL_R:   set(op.r1, L::shl(get(op.r1), 1));  break;
+    case Opcode::BSR_R:   set(op.r1, L::shr(get(op.r1), 1));  break;
+    case Opcode::ROL_R:   set(op.r1, L::bor(L::shl(get(op.r1), 1), L::shr(get(op.r1), 15)));  break;
+    case Opcode::ROR_R:   set(op.r1, L::bor(L::shr(get(op.r1), 1), L::shl(get(op.r1), 15)));  break;
+
+    case Opcode::JMP_W:
+        next = w;
+        break;
+    case Opcode::JNEG_RW:
+        next = L::select(L::gt(zero, get(op.r1)), w, next);
+        break;
+    case Opcode::JPOS_RW:   // sic, see i_jposrw()
+        next = L::select(L::gt(get(op.r1), L::all(1)), w, next);
+        break;
+    case Opcode::JZERO_RW:
+        next = L::select(L::eq(get(op.r1), zero), w, next);
+        break;
+    case Opcode::JNZERO_RW:
+        next = L::select(L::eq(get(op.r1), zero), next, w);
+        break;
+
+    default:
+        break;
+    }
+
+    L::select(m, next, L::load(pc)).store(pc);
+}
+
+} // namespace
+
+/*! Run RAM op \a op on every lane set in \a mask, one lane at a time, the
+    way the matching i_* member would.
+    \return true if a lane halted on a memory fault */
+bool VMBatch::execRam(const vm_decoded_op_t& op, RobotVM* const* vms,
+                      sword_t (*reg)[VM_BATCH_LANES], sword_t* pc, const sword_t* mask) {
+    bool halted = false;
+    for (unsigned int i = 0; i < VM_BATCH_LANES; i++) {
+        if (!mask[i])
+            continue;
+        RobotVM& vm = *vms[i];
+        switch (op.opcode) {
+        case Opcode::MOV_RM:
+            reg[op.r1][i] = static_cast<sword_t>(vm.loadRamWord(op.w));
+            break;
+        case Opcode::MOVB_RM:
+            reg[op.r1][i] = static_cast<sword_t>(vm.loadRamByte(op.w));
+            break;
+        case Opcode::MOV_MR:
+            vm.storeRamWord(op.w, static_cast<word_t>(reg[op.r2][i]));
+            break;
+        case Opcode::SWAP_RM: {
+            const word_t tmp = vm.loadRamWord(op.w);
+            vm.storeRamWord(op.w, static_cast<word_t>(reg[op.r1][i]));
+            reg[op.r1][i] = static_cast<sword_t>(tmp);
+            break;
+        }
+        case Opcode::MOVRP_RR:
+            vm.storeRamWord(static_cast<word_t>(reg[op.r1][i]), static_cast<word_t>(reg[op.r2][i]));
+            break;
+        case Opcode::MOVPR_RR:
+            reg[op.r1][i] = static_cast<sword_t>(vm.loadRamWord(static_cast<word_t>(reg[op.r2][i])));
+            break;
+        default:
+            break;
+        }
+        pc[i] = static_cast<sword_t>(op.next);
+        if (VMRamAccess::FAULTS)
+            halted |= vm._halt;
+    }
+    return halted;
+}
+
+unsigned long VMBatch::runLanes(RobotVM* const* vms, unsigned int count, unsigned long budget) {
+    alignas(32) sword_t reg[4][VM_BATCH_LANES];
+    alignas(32) sword_t pc[VM_BATCH_LANES];
+    alignas(32) sword_t mask[VM_BATCH_LANES];   //!< Lanes in the group being run
+    unsigned long left[VM_BATCH_LANES];         //!< Budget each lane has left;  0 once halted
+
+    for (unsigned int i = 0; i < VM_BATCH_LANES; i++) {
+        const bool used = i < count;
+        for (int r = 0; r < 4; r++)
+            reg[r][i] = used ? vms[i]->_regs.r[r] : 0;
+        pc[i] = used ? static_cast<sword_t>(vms[i]->_regs.pc) : 0;
+        left[i] = used ? budget : 0;
+    }
+
+    const VMDecodedRom& rom = vms[0]->decodedROM();
+    const addr_t rwp = vms[0]->_rwp;
+    unsigned long total = 0;
+
+    // A group of lanes sharing a PC keeps running together until it reaches
+    // a jump, at which point the lanes get sorted into groups all over again.
+    word_t at = 0;               // PC of the group
+    unsigned int lanes = 0;      // Lanes in the group
+    unsigned long burst = 0;     // Instructions every lane of the group has budget for
+    unsigned long ran = 0;       // Instructions the group ran, not yet taken off left[]
+    bool regroup = true;
+
+    for (;;) {
+        if (regroup) {
+            // The lanes at the lowest PC go next, so stragglers catch up
+            unsigned int lowest = 0x10000;
+            for (unsigned int i = 0; i < VM_BATCH_LANES; i++) {
+                if (left[i] && static_cast<word_t>(pc[i]) < lowest)
+                    lowest = static_cast<word_t>(pc[i]);
+            }
+            if (lowest > 0xFFFF)
+                break;
+
+            at = static_cast<word_t>(lowest);
+            lanes = 0;
+            burst = budget;
+            for (unsigned int i = 0; i < VM_BATCH_LANES; i++) {
+                const bool in = left[i] && static_cast<word_t>(pc[i]) == at;
+                mask[i] = in ? -1 : 0;
+                if (in) {
+                    lanes++;
+                    burst = std::min(burst, left[i]);
+                }
+            }
+            ran = 0;
+            regroup = false;
+        }
+
+        const vm_decoded_op_t& op = rom[at];
+        const LaneStep how = howToRun(op, rwp);
+
+        if (how == LaneStep::ALONE) {
+            // Let each VM run this one itself
+            for (unsigned int i = 0; i < VM_BATCH_LANES; i++) {
+                if (!mask[i])
+                    continue;
+                RobotVM& vm = *vms[i];
+                for (int r = 0; r < 4; r++)
+                    vm._regs.r[r] = reg[r][i];
+                vm._regs.pc = static_cast<word_t>(pc[i]);
+
+                unsigned long one = 0;
+                vm.runFor(1, &one);
+
+                for (int r = 0; r < 4; r++)
+                    reg[r][i] = vm._regs.r[r];
+                pc[i] = static_cast<sword_t>(vm._regs.pc);
+                left[i] = vm._halt ? 0 : left[i] - ran - one;   // halted, or waiting on a port
+                _stats.scalarInstr += one;
+                total += one;
+            }
+            regroup = true;
+            continue;
+        }
+
+        bool halted = false;
+        if (how == LaneStep::SIMD)
+            execLanes(op, reg, pc, mask);
+        else
+            halted = execRam(op, vms, reg, pc, mask);
+        ran++;
+        total += lanes;
+        _stats.lockstepOps++;
+        _stats.lockstepInstr += lanes;
+
+        if (halted || ran == burst || isJump(op.opcode)) {
+            for (unsigned int i = 0; i < VM_BATCH_LANES; i++) {
+                if (mask[i])
+                    left[i] = vms[i]->_halt ? 0 : left[i] - ran;
+            }
+            regroup = true;
+        } else {
+            at = op.next;
+        }
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        for (int r = 0; r < 4; r++)
+            vms[i]->_regs.r[r] = reg[r][i];
+        vms[i]->_regs.pc = static_cast<word_t>(pc[i]);
+    }
+    return total;
+}
+
+unsigned long VMBatch::runFor(unsigned long budget) {
+    unsigned long total = 0;
+    std::vector<RobotVM*>& lanes = _lanes;
+    lanes.clear();
+
+    // Pick out the VMs that can run in lockstep with the first one that can
+    const RobotVM* model = nullptr;
+    for (RobotVM* vm : _vms) {
+        if (vm->isHalted() || budget == 0)
+            continue;
+
+        bool lockstep = !vm->_trace && static_cast<addr_t>(vm->_regs.pc) <= vm->_rwp;
+        if (lockstep && model) {
+            lockstep = vm->_rwp == model->_rwp
+                       && (vm->_rom == model->_rom || vm->_rom->sameBytes(*model->_rom));
+        }
+        if (lockstep) {
+            if (!model)
+                model = vm;
+            lanes.push_back(vm);
+        } else {
+            unsigned long ran = 0;
+            vm->runFor(budget, &ran);
+            _stats.scalarInstr += ran;
+            total += ran;
+        }
+    }
+
+    for (std::size_t at = 0; at < lanes.size(); at += VM_BATCH_LANES) {
+        const unsigned int count = static_cast<unsigned int>(
+                                       std::min<std::size_t>(VM_BATCH_LANES, lanes.size() - at));
+        total += runLanes(&lanes[at], count, budget);
+    }
+    return total;
+}
@@ -0,0 +1,586 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include "VMBenchmark.h"
+#include "HostTopology.h"
+#include "RobotVM.h"
+#include "RobotVMPool.h"
+#include "VMBatch.h"
+#include "VMWorld.h"
+#include "VMOpcodeTypes.h"
+#include "VMSnapshot.h"
+
+namespace {
+
+typedef std::chrono::steady_clock bench_clock;
+
+//! Burns a program straight into a VM with no assembler in between (which
+//! would print plenty about what it's doing and skew nothing but the logs)
+class BenchProgram {
+private:
+    std::vector<vm_instr_t> _instrs;
+    word_t _here = 0;
+
+public:
+    BenchProgram() : _instrs() {}
+
+    //! Append an instruction, returning the address it will be burned at
+    word_t add(const vm_instr_t& instr) {
+        word_t at = _here;
+        _instrs.push_back(instr);
+        _here += VMOpcodeInfo::length(instr.opcode);
+        return at;
+    }
+    //! Address the next add()ed instruction will get
+    word_t here() const {
+        return _here;
+    }
+
+    void burnInto(RobotVM& vm) const {
+        for (const vm_instr_t& instr : _instrs)
+            vm.burn(instr);
+    }
+    //! The program as a RomImage, for any number of VMs to share
+    std::shared_ptr<const RomImage> image() const {
+        RobotVM vm;
+        burnInto(vm);
+        return vm.rom();
+    }
+};
+
+byte_t reg(RegName r) {
+    return static_cast<byte_t>(r);
+}
+
+//! Nested countdown loops doing register-only ALU work
+BenchProgram aluLoop() {
+    BenchProgram p;
+    p.add(vm_instr_t(Opcode::MOV_RW, reg(RegName::R2), static_cast<word_t>(200)));
+    word_t outer = p.add(vm_instr_t(Opcode::MOV_RW, reg(RegName::R1), static_cast<word_t>(2500)));
+    word_t inner = p.add(vm_instr_t(Opcode::ADD_RR, reg(RegName::R3), reg(RegName::R1)));
+    p.add(vm_instr_t(Opcode::XOR_RR,    reg(RegName::R4), reg(RegName::R3)));
+    p.add(vm_instr_t(Opcode::ADD_RW,    reg(RegName::R1), static_cast<word_t>(-1)));
+    p.add(vm_instr_t(Opcode::JNZERO_RW, reg(RegName::R1), inner));
+    p.add(vm_instr_t(Opcode::ADD_RW,    reg(RegName::R2), static_cast<word_t>(-1)));
+    p.add(vm_instr_t(Opcode::JNZERO_RW, reg(RegName::R2), outer));
+    p.add(vm_instr_t(Opcode::HALT_NIL));
+    return p;
+}
+
+//! Read-modify-write of a RAM variable in a loop
+BenchProgram memLoop() {
+    BenchProgram p;
+    p.add(vm_instr_t(Opcode::MOV_RW, reg(RegName::R3), static_cast<word_t>(100)));
+    word_t outer = p.add(vm_instr_t(Opcode::MOV_RW, reg(RegName::R2), static_cast<word_t>(2000)));
+    word_t inner = p.add(vm_instr_t(Opcode::MOV_RM, reg(RegName::R1), static_cast<word_t>(100)));
+    p.add(vm_instr_t(Opcode::ADD_RR,    reg(RegName::R1), reg(RegName::R2)));
+    p.add(vm_instr_t(Opcode::MOV_MR,    static_cast<word_t>(100), reg(RegName::R1)));
+    p.add(vm_instr_t(Opcode::ADD_RW,    reg(RegName::R2), static_cast<word_t>(-1)));
+    p.add(vm_instr_t(Opcode::JNZERO_RW, reg(RegName::R2), inner));
+    p.add(vm_instr_t(Opcode::ADD_RW,    reg(RegName::R3), static_cast<word_t>(-1)));
+    p.add(vm_instr_t(Opcode::JNZERO_RW, reg(RegName::R3), outer));
+    p.add(vm_instr_t(Opcode::HALT_NIL));
+    return p;
+}
+
+//! Countdown loop made of nothing but register-to-register ops
+BenchProgram regLoop() {
+    BenchProgram p;
+    p.add(vm_instr_t(Opcode::MOV_RW, reg(RegName::R4), static_cast<word_t>(200)));
+    word_t outer = p.add(vm_instr_t(Opcode::MOV_RW, reg(RegName::R1), static_cast<word_t>(2500)));
+    word_t inner = p.add(vm_instr_t(Opcode::ADD_RRR, reg(RegName::R2), reg(RegName::R1), reg(RegName::R3)));
+    p.add(vm_instr_t(Opcode::MOV_RR,    reg(RegName::R3), reg(RegName::R2)));
+    p.add(vm_instr_t(Opcode::XOR_RR,    reg(RegName::R3), reg(RegName::R1)));
+    p.add(vm_instr_t(Opcode::SUB_RR,    reg(RegName::R2), reg(RegName::R3)));
+    p.add(vm_instr_t(Opcode::ADD_RW,    reg(RegName::R1), static_cast<word_t>(-1)));
+    p.add(vm_instr_t(Opcode::JNZERO_RW, reg(RegName::R1), inner));
+    p.add(vm_instr_t(Opcode::ADD_RW,    reg(RegName::R4), static_cast<word_t>(-1)));
+    p.add(vm_instr_t(Opcode::JNZERO_RW, reg(RegName::R4), outer));
+    p.add(vm_instr_t(Opcode::HALT_NIL));
+    return p;
+}
+
+//! Waits on a word that never comes, by polling RAM for it
+BenchProgram pollLoop() {
+    BenchProgram p;
+    word_t loop = p.add(vm_instr_t(Opcode::MOV_RM, reg(RegName::R1), static_cast<word_t>(100)));
+    p.add(vm_instr_t(Opcode::JZERO_RW, reg(RegName::R1), loop));
+    p.add(vm_instr_t(Opcode::HALT_NIL));
+    return p;
+}
+
+//! Waits on a word that never comes, by receiving it from port 0
+BenchProgram recvWait() {
+    BenchProgram p;
+    p.add(vm_instr_t(Opcode::RECV_RB, reg(RegName::R1), static_cast<byte_t>(0)));
+    p.add(vm_instr_t(Opcode::HALT_NIL));
+    return p;
+}
+
+//! Number of instructions \a prog executes before halting
+unsigned long countInstructions(const BenchProgram& prog) {
+    std::unique_ptr<RobotVM> vm(new RobotVM());
+    prog.burnInto(*vm);
+    unsigned long count = 0;
+    while (!vm->isHalted()) {
+        vm->step();
+        count++;
+    }
+    return count;
+}
+
+//! One way of configuring a VM to run the benchmark programs
+struct BenchConfig {
+    const char* name;
+    VMEngine    engine;
+    bool        superops;
+    bool        fixedregs;  //!< Fixed-register handlers;  only the decoded engine calls handlers
+};
+
+const BenchConfig configs[] = {
+    { "switch",          VMEngine::SWITCH,   false, false },
+    { "decoded-generic", VMEngine::DECODED,  false, false },
+    { "decoded",         VMEngine::DECODED,  false, true  },
+    { "decoded+super",   VMEngine::DECODED,  true,  true  },
+    { "threaded",        VMEngine::THREADED, false, true  },
+    { "threaded+super",  VMEngine::THREADED, true,  true  },
+#if VM_HAS_JIT
+    { "jit",             VMEngine::JIT,      true,  true  },
+#endif
+};
+
+//! Seconds taken for \a reps fresh VMs to run \a prog to completion.  \a last
+//! is left holding the final VM, for its superinstruction hit counts.
+double timeConfig(const BenchProgram& prog, const BenchConfig& config, int reps,
+                  std::unique_ptr<RobotVM>& last) {
+    double total = 0.0;
+    for (int i = 0; i < reps; i++) {
+        last.reset(new RobotVM());
+        prog.burnInto(*last);
+        last->setEngine(config.engine);
+        last->setSuperOps(config.superops);
+        last->setFixedRegHandlers(config.fixedregs);
+
+        auto start = bench_clock::now();
+        last->run();
+        total += std::chrono::duration<double>(bench_clock::now() - start).count();
+    }
+    return total;
+}
+
+void benchProgram(std::FILE* out, const char* name, const BenchProgram& prog) {
+    const int reps = 5;
+    const unsigned long instrs = countInstructions(prog) * reps;
+
+    double baseline = 0.0;
+    std::unique_ptr<RobotVM> vm, fused;
+    for (const BenchConfig& config : configs) {
+        double secs = timeConfig(prog, config, reps, vm);
+        if (config.engine == VMEngine::SWITCH)
+            baseline = secs;
+        if (config.engine == VMEngine::THREADED && config.superops)
+            fused = std::move(vm);
+        fprintf(out, "  %-10s %-15s %8.2f Minstr/s  (%.2fx switch)\n", name, config.name,
+                instrs / secs / 1e6, baseline / secs);
+    }
+
+    // show which superinstructions fired, and how often
+    for (int i = 0; i < VM_SUPEROP_COUNT; i++) {
+        VMSuperOp sop = static_cast<VMSuperOp>(i);
+        if (fused->superOpHits(sop) > 0)
+            fprintf(out, "  %-10s   %-24s %10lu hits\n", "", RobotVM::superOpName(sop), fused->superOpHits(sop));
+    }
+}
+
+//! Run \a prog on \a count VMs, once one VM after another and once as a VMBatch
+void benchBatchProgram(std::FILE* out, const char* name, const BenchProgram& prog, int count) {
+    const unsigned long instrs = countInstructions(prog) * count;
+
+    std::vector<std::unique_ptr<RobotVM>> vms;
+    auto fresh = [&]() {
+        vms.clear();
+        for (int i = 0; i < count; i++) {
+            vms.emplace_back(new RobotVM());
+            prog.burnInto(*vms.back());
+        }
+    };
+
+    fresh();
+    auto start = bench_clock::now();
+    for (auto& vm : vms)
+        vm->run();
+    const double alone = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+    fresh();
+    VMBatch batch;
+    for (auto& vm : vms)
+        batch.add(*vm);
+    start = bench_clock::now();
+    while (batch.runFor(~0UL) > 0)
+        ;
+    const double batched = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+    const vm_batch_stats_t& stats = batch.stats();
+    fprintf(out, "  %-10s %3d VMs  alone %8.2f Minstr/s   batch %8.2f Minstr/s  (%.2fx)  %5.1f%% lockstep, %.1f lanes/op\n",
+            name, count, instrs / alone / 1e6, instrs / batched / 1e6, alone / batched,
+            100.0 * stats.lockstepInstr / (stats.lockstepInstr + stats.scalarInstr),
+            stats.lockstepOps ? static_cast<double>(stats.lockstepInstr) / stats.lockstepOps : 0.0);
+}
+
+//! Tick \a count VMs in a VMWorld with \a threads workers.  Up to \a heavy of them
+//! run \a prog, all in the first worker's shard;  the rest halt straight away, to
+//! load workers unevenly.
+void benchWorldThreads(std::FILE* out, const BenchProgram& prog, int count, int heavy,
+                       unsigned int threads) {
+    const int ticks = 50;
+    VMWorld world(threads);
+    world.setBudget(2000);
+    BenchProgram idle;
+    idle.add(vm_instr_t(Opcode::HALT_NIL));
+    const std::shared_ptr<const RomImage> busyRom = prog.image(), idleRom = idle.image();
+    // spawned VMs are dealt out to shards in turn
+    const int shards = static_cast<int>(world.shards());
+    if (heavy > count / shards)
+        heavy = count / shards;
+    for (int i = 0; i < count; i++)
+        world.spawn(i % shards == 0 && i / shards < heavy ? busyRom : idleRom);
+
+    unsigned long instrs = 0;
+    double secs = 0.0;
+    for (int t = 0; t < ticks; t++) {
+        vm_tick_stats_t stats = world.tick();
+        instrs += stats.instructions;
+        secs += stats.seconds;
+    }
+    fprintf(out, "  %5d VMs (%5d busy)  %2u threads  %8.2f Minstr/s  %7.3f ms/tick  %6zu KB resident RAM\n",
+            count, heavy, world.threads(), instrs / secs / 1e6, secs / ticks * 1e3, world.residentRam() / 1024);
+    if (world.threads() == 1)
+        return;
+    for (unsigned int w = 0; w < world.threads(); w++) {
+        const tick_worker_stats_t& ws = world.workerStats(w);
+        const double total = ws.busySeconds + ws.idleSeconds;
+        fprintf(out, "    worker %2u  %6lu batches  %6lu stolen  %7lu failed steals  %5.1f%% busy\n",
+                w, ws.batches, ws.steals, ws.failedSteals, total > 0.0 ? 100.0 * ws.busySeconds / total : 0.0);
+    }
+}
+
+//! Tick \a count VMs running \a prog in a world with one worker per hardware
+//! thread, \a pinned or not.  Returns Minstr/s, adding up steals off other nodes.
+double timeWorldPinning(const BenchProgram& prog, int count, bool pinned, unsigned long& remote) {
+    const int ticks = 50;
+    VMWorld world(0, pinned);
+    world.setBudget(2000);
+    const std::shared_ptr<const RomImage> rom = prog.image();
+    for (int i = 0; i < count; i++)
+        world.spawn(rom);
+
+    unsigned long instrs = 0;
+    double secs = 0.0;
+    for (int t = 0; t < ticks; t++) {
+        vm_tick_stats_t stats = world.tick();
+        instrs += stats.instructions;
+        secs += stats.seconds;
+    }
+    for (unsigned int w = 0; w < world.threads(); w++)
+        remote += world.workerStats(w).remoteSteals;
+    return instrs / secs / 1e6;
+}
+
+//! The same RAM-heavy world, with workers left wherever the OS puts them and pinned node by node
+void benchWorldPinning(std::FILE* out, int count) {
+    const HostTopology& host = HostTopology::host();
+    unsigned long remoteUnpinned = 0, remotePinned = 0;
+    const double unpinned = timeWorldPinning(memLoop(), count, false, remoteUnpinned);
+    const double pinned = timeWorldPinning(memLoop(), count, true, remotePinned);
+    fprintf(out, "  %5d VMs  %u nodes, %2u cpus  unpinned %8.2f Minstr/s   pinned %8.2f Minstr/s  (%.2fx)  %lu/%lu remote steals\n",
+            count, host.nodes(), host.cpuCount(), unpinned, pinned, pinned / unpinned, remoteUnpinned, remotePinned);
+}
+
+//! Tick a world that grows from \a from to \a to VMs running \a prog, on a fixed budget or
+//! \a adaptive to \a deadline seconds per tick.  Prints how long ticks took, 99% of the time
+//! and at worst, and how many took longer than \a deadline.
+void timeWorldDeadline(std::FILE* out, const BenchProgram& prog, int from, int to, double deadline, bool adaptive) {
+    const int ticks = 100;
+    VMWorld world(1);
+    world.setBudget(2000);
+    if (adaptive)
+        world.setTickDeadline(deadline);
+    const std::shared_ptr<const RomImage> rom = prog.image();
+
+    std::vector<double> secs;
+    unsigned long instrs = 0;
+    int late = 0;
+    for (int t = 0; t < ticks; t++) {
+        while (static_cast<int>(world.size()) < from + (to - from) * t / (ticks - 1))
+            world.spawn(rom);
+        const vm_tick_stats_t stats = world.tick();
+        secs.push_back(stats.seconds);
+        instrs += stats.instructions;
+        late += stats.seconds > deadline;
+    }
+    std::sort(secs.begin(), secs.end());
+    const tick_budget_stats_t decided = world.budgetStats();
+    fprintf(out, "    %-8s  p99 %7.3f ms  worst %7.3f ms  %3d late  %8.2f Minstr/tick", adaptive ? "adaptive" : "fixed",
+            secs[(ticks * 99 + 99) / 100 - 1] * 1e3, secs.back() * 1e3, late, instrs / 1e6 / ticks);
+    if (adaptive)
+        fprintf(out, "  budget now %lu (%lu cuts, %lu raises)", decided.budget, decided.cuts, decided.raises);
+    fprintf(out, "\n");
+}
+
+//! A world growing from \a from to \a to VMs, with a fixed budget and ticking to a deadline of \a ms
+void benchWorldDeadline(std::FILE* out, int from, int to, double ms) {
+    fprintf(out, "  %5d -> %5d VMs, %.1f ms deadline:\n", from, to, ms);
+    timeWorldDeadline(out, aluLoop(), from, to, ms / 1e3, false);
+    timeWorldDeadline(out, aluLoop(), from, to, ms / 1e3, true);
+}
+
+//! Hash a world of \a count VMs running mem-loop, every page and then with none changed since,
+//! and tick it with and without hashing at the end of each tick
+void benchWorldHash(std::FILE* out, int count) {
+    const int ticks = 50;
+    VMWorld world(1);
+    world.setBudget(200);
+    const std::shared_ptr<const RomImage> rom = memLoop().image();
+    for (int i = 0; i < count; i++)
+        world.spawn(rom);
+    world.tick();
+
+    auto start = bench_clock::now();
+    std::uint64_t hash = world.stateHash();
+    const double cold = std::chrono::duration<double>(bench_clock::now() - start).count();
+    start = bench_clock::now();
+    if (world.stateHash() != hash)
+        fprintf(out, "  hash changed with nothing run!\n");
+    const double warm = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+    double plain = 0.0, hashed = 0.0;
+    for (int t = 0; t < ticks; t++) {
+        world.setTickHashing(t % 2 != 0);
+        const vm_tick_stats_t stats = world.tick();
+        (world.tickHashing() ? hashed : plain) += stats.seconds;
+    }
+    fprintf(out, "  %5d VMs  hash all %7.3f ms  unchanged %7.3f ms   tick %7.3f ms, hashing %7.3f ms  (%016llx)\n",
+            count, cold * 1e3, warm * 1e3, plain / (ticks / 2) * 1e3, hashed / (ticks / 2) * 1e3,
+            static_cast<unsigned long long>(hash));
+}
+
+//! Count the halted VMs in a world of \a count, once through the arena and once VM by VM
+void benchWorldScan(std::FILE* out, int count) {
+    const int scans = 200;
+    VMWorld world(1);
+    BenchProgram idle;
+    idle.add(vm_instr_t(Opcode::HALT_NIL));
+    const std::shared_ptr<const RomImage> busyRom = aluLoop().image(), idleRom = idle.image();
+    for (int i = 0; i < count; i++)
+        world.spawn(i % 3 == 0 ? idleRom : busyRom);
+    world.setBudget(1);
+    world.tick();
+
+    std::size_t viaArena = 0, viaVMs = 0;
+    auto start = bench_clock::now();
+    for (int s = 0; s < scans; s++)
+        viaArena += world.halted();
+    const double arena = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+    start = bench_clock::now();
+    for (int s = 0; s < scans; s++)
+        for (std::size_t i = 0; i < world.size(); i++)
+            viaVMs += world[i].isHalted();
+    const double each = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+    fprintf(out, "  %5d VMs  halted scan:  arena %8.2f us   VM by VM %8.2f us  (%zu halted)\n", count,
+            arena / scans * 1e6, each / scans * 1e6, viaArena == viaVMs ? viaArena / scans : 0);
+    fprintf(out, "  %zu bytes per RobotVM, besides its RAM and stack in the arena and its shared ROM\n",
+            sizeof(RobotVM));
+}
+
+//! Tick a world of \a count VMs, of which \a busy run \a prog and the rest wait
+//! on \a idle.  Returns milliseconds per tick.
+double timeWorldIdle(const BenchProgram& prog, const BenchProgram& idle, int count, int busy) {
+    const int ticks = 20;
+    VMWorld world(1);
+    world.setBudget(2000);
+    world.ports().open(0);
+    const std::shared_ptr<const RomImage> busyRom = prog.image(), idleRom = idle.image();
+    for (int i = 0; i < count; i++)
+        world.spawn(i < busy ? busyRom : idleRom);
+    world.tick();   // idle VMs get parked, if they can be
+
+    double secs = 0.0;
+    for (int t = 0; t < ticks; t++)
+        secs += world.tick().seconds;
+    return secs / ticks * 1e3;
+}
+
+//! The same mostly-idle world, with idle VMs polling RAM and with them parked on a port
+void benchWorldIdle(std::FILE* out, int count, int busy) {
+    const double polling = timeWorldIdle(aluLoop(), pollLoop(), count, busy);
+    const double parked = timeWorldIdle(aluLoop(), recvWait(), count, busy);
+    fprintf(out, "  %5d VMs (%5d busy)  idle ones polling %7.3f ms/tick   parked %7.3f ms/tick  (%.2fx)\n",
+            count, busy, polling, parked, polling / parked);
+}
+
+//! Spawn \a live VMs running \a rom and run each for a few instructions, dirtying its
+//! registers and RAM, then despawn the lot;  \a rounds times over.  Returns seconds taken.
+template<class SpawnT, class DespawnT>
+double timeChurn(const std::shared_ptr<const RomImage>& rom, int live, int rounds,
+                 SpawnT spawn, DespawnT despawn) {
+    std::vector<RobotVM*> vms(live);
+    const auto start = bench_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        for (RobotVM*& vm : vms) {
+            vm = spawn();
+            vm->setRom(rom);
+            vm->setEngine(VMEngine::DECODED);  // no JIT compile, which would swamp the rest
+            vm->runFor(16);
+        }
+        for (RobotVM* vm : vms)
+            despawn(vm);
+    }
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+//! Churn \a live VMs at a time through new/delete, new/delete in a shared arena, and a
+//! RobotVMPool, and fork them off a parent
+void benchSpawnChurn(std::FILE* out, int live) {
+    const int rounds = 200;
+    const std::shared_ptr<const RomImage> rom = memLoop().image();
+    VMStateArena arena;
+    RobotVMPool pool;
+
+    const double alone = timeChurn(rom, live, rounds,
+        []() { return new RobotVM(); }, [](RobotVM* vm) { delete vm; });
+    const double shared = timeChurn(rom, live, rounds,
+        [&]() { return new RobotVM(arena); }, [](RobotVM* vm) { delete vm; });
+    const double pooled = timeChurn(rom, live, rounds,
+        [&]() { return pool.spawn(); }, [&](RobotVM* vm) { pool.despawn(vm); });
+
+    // a parent that's been at work a while, its RAM and stack in use
+    RobotVM* parent = pool.spawn();
+    parent->setRom(rom);
+    parent->runFor(100000);
+    parent->putstr(VM_RAM_SIZE - 64, "offspring");
+    const double forked = timeChurn(rom, live, rounds,
+        [&]() { return pool.fork(*parent); }, [&](RobotVM* vm) { pool.despawn(vm); });
+    pool.despawn(parent);
+
+    const double vms = static_cast<double>(live) * rounds;
+    fprintf(out, "  %5d live  new RobotVM() %7.2f M/s   in an arena %7.2f M/s   pooled %7.2f M/s  (%.2fx)"
+            "   pooled fork %7.2f M/s\n",
+            live, vms / alone / 1e6, vms / shared / 1e6, vms / pooled / 1e6, alone / pooled, vms / forked / 1e6);
+}
+
+//! Size of the file at \a path, or 0 if it can't be opened
+long fileBytes(const char* path) {
+    std::FILE* const f = std::fopen(path, "rb");
+    long bytes = 0;
+    if (f) {
+        std::fseek(f, 0, SEEK_END);
+        bytes = std::ftell(f);
+        std::fclose(f);
+    }
+    return bytes;
+}
+
+//! Save a world of \a count VMs that have each written a little RAM, a quarter of them
+//! forks sharing it, then restore it into a new world, and again over the top of that
+//! too.  Then checkpoint the changes after a sixteenth of them run on, and restore both.
+void benchSnapshotWorld(std::FILE* out, int count) {
+    const char* const path = "rbh-bench.snapshot";
+    VMWorld world(1);
+    world.setBudget(40);
+    const std::shared_ptr<const RomImage> rom = memLoop().image();
+    for (int i = 0; i < count - count / 4; i++)
+        world.spawn(rom);
+    world.tick();
+    for (int i = 0; i < count / 4; i++)
+        world.fork(static_cast<std::size_t>(i));
+
+    try {
+        auto start = bench_clock::now();
+        VMSnapshot::save(world, path);
+        const double save = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+        VMWorld restored(1);
+        start = bench_clock::now();
+        VMSnapshot::restore(restored, path);
+        const double restore = std::chrono::duration<double>(bench_clock::now() - start).count();
+        start = bench_clock::now();
+        VMSnapshot::restore(restored, path);
+        const double again = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+        const long bytes = fileBytes(path);
+        fprintf(out, "  %7d VMs  %8.2f MB  save %8.2f ms   restore %8.2f ms, again %8.2f ms  (%zu VMs back, %zu KB resident RAM)\n",
+                count, bytes / 1048576.0, save * 1e3, restore * 1e3, again * 1e3, restored.size(), restored.residentRam() / 1024);
+
+        // a checkpoint of the changes after a tick in which only every 16th robot ran
+        const char* const deltaPath = "rbh-bench.delta";
+        VMSnapshot::checkpoint(restored, path);
+        for (std::size_t i = 0; i < restored.size(); i += 16)
+            restored[i].runFor(40);
+        start = bench_clock::now();
+        VMSnapshot::checkpointChanges(restored, deltaPath);
+        const double changes = std::chrono::duration<double>(bench_clock::now() - start).count();
+        start = bench_clock::now();
+        VMSnapshot::restore(restored, std::vector<std::string>{ path, deltaPath });
+        const double chain = std::chrono::duration<double>(bench_clock::now() - start).count();
+        const long deltaBytes = fileBytes(deltaPath);
+        fprintf(out, "  %7d VMs  %8.2f MB  changes %5.2f ms   restore both %8.2f ms\n",
+                count, deltaBytes / 1048576.0, changes * 1e3, chain * 1e3);
+        std::remove(deltaPath);
+    } catch (const VMSnapshotException& e) {
+        fprintf(out, "  %7d VMs  %s\n", count, e.what());
+    }
+    std::remove(path);
+}
+
+} // namespace
+
+void benchSnapshot(std::FILE* out) {
+    fprintf(out, "snapshot:\n");
+    benchSnapshotWorld(out, 65536);
+    benchSnapshotWorld(out, 1 << 20);
+}
+
+void benchWorld(std::FILE* out) {
+    fprintf(out, "world:\n");
+    benchWorldThreads(out, aluLoop(), 1024, 1024, 1);
+    benchWorldThreads(out, aluLoop(), 1024, 1024, 0);
+    benchWorldThreads(out, aluLoop(), 1024, 256, 0);
+    benchWorldScan(out, 16384);
+    benchWorldIdle(out, 16384, 256);
+    benchWorldPinning(out, 4096);
+    benchWorldDeadline(out, 256, 4096, 8.0);
+    benchWorldHash(out, 16384);
+}
+
+void benchSpawn(std::FILE* out) {
+    fprintf(out, "spawn + despawn (VMs/sec):\n");
+    benchSpawnChurn(out, 64);
+    benchSpawnChurn(out, 4096);
+}
+
+void benchBatch(std::FILE* out) {
+    fprintf(out, "batch (%d lanes):\n", VM_BATCH_LANES);
+    benchBatchProgram(out, "alu-loop", aluLoop(), 64);
+    benchBatchProgram(out, "reg-loop", regLoop(), 64);
+    benchBatchProgram(out, "mem-loop", memLoop(), 64);
+}
+
+void benchEngines(std::FILE* out) {
+    fprintf(out, "engines:\n");
+    benchProgram(out, "alu-loop", aluLoop());
+    benchProgram(out, "mem-loop", memLoop());
+    benchProgram(out, "reg-loop", regLoop());
+}
+
+void runBenchmarks(std::FILE* out) {
+    benchEngines(out);
+    benchBatch(out);
+    benchWorld(out);
+    benchSpawn(out);
+    benchSnapshot(out);
+}
@@ -9,6 +9,8 @@
 #include "VMXCoderException.h"
 #include "TextBuffer.h"
 
+constexpr vm_opcode_tables_t VMOpcodeInfo::tables;
+
 //! String representations of the HumanOpcodes
 std::vector<std::string> humanopcodestrings = {
     "NOP",
@@ -42,7 +44,8 @@ std::vector<std::string> humanopcodestrings = {
     "POPW",
     "BC",
     "RECV",
-    "SEND"
+    "SEND",
+    "WAIT"
 };
 
 std::string printHumanOpcodeStrings()
@@ -90,18 +93,8 @@ HumanOpcode VMInstrTranscoder::stringToHumanOpcode(std::string str) const {
 }
 
 Opcode VMInstrTranscoder::getVMOpcodeFromHumanOpcode(HumanOpcode opc, OperandType ot) const {
-    // auto& pairlist = (_operandValidityTable[opc]);
-
-    for (auto pair : (_operandValidityTable[opc]))
-        //for (auto pair = pairlist.begin(); pair != pairlist.end(); ++pair)
-    {
-        if ((pair).first == ot) {
-            return (pair).second;
-        }
-    }
-
     //  throw VMXCoderException("There is no combination of VM opcode with the given HumanOpcode+OperandType combination");
-    return Opcode::INVALID;
+    return VMOpcodeInfo::fromHuman(opc, ot);
 }
 
 Opcode VMInstrTranscoder::byteToOpcode(byte_t byte) const {
@@ -119,209 +112,20 @@ byte_t VMInstrTranscoder::opcodeToByte(Opcode opc) const {
     return static_cast<byte_t>(opc);
 }
 
-void VMInstrTranscoder::initOpcodeByteToOperandTypeTable() {
-    for (int i=0; i<static_cast<int>(Opcode::NUM_OPCODES); i++) {
-        printf("i = %d\n", i);
-        this->_opcodeByteToOperandTypeTable[i] = OperandType::INVALID;
-    }
-
-    byte_t* opair = &vmsetup_opc_instr_types[0][0];
-    do {
-        Opcode opc = static_cast<Opcode>(opair[0]);
-        OperandType opt = static_cast<OperandType>(opair[1]);
-        printf("opcode(%d) is type %d\n", static_cast<int>(opc),
-               static_cast<int>(opt));
-
-        this->_opcodeByteToOperandTypeTable[opair[0]] = opt;
-
-        opair += 2;
-        if (opc == Opcode::NOP)
-            break;
-    } while (true);
-
-
-    // check if any opcodes were forgotten
-    for (int i=0; i<static_cast<int>(Opcode::NUM_OPCODES); i++) {
-        OperandType type = this->_opcodeByteToOperandTypeTable[i];
-        if (OperandType::INVALID == type) {
-            // Please check VMOpcodeTypes.h if this is thrown.
-            throw VMXCoderException("An opcode was overlooked during initOpcodeByteToOperandTypeTable()");
-        }
+HumanOpcode VMInstrTranscoder::opcodeToHumanOpcode(Opcode opc) const {
+    for (const vm_opc_setup_t& row : vmsetup_opc_instr_types) {
+        if (row.opcode == opc)
+            return row.human;
     }
+    return HumanOpcode::INVALID;
 }
 
-OperandType VMInstrTranscoder::getOperandTypeOfOpcode(Opcode opc) {
-    return _opcodeByteToOperandTypeTable[static_cast<int>(opc)];
-}
-
-void VMInstrTranscoder::initOperandTypeLengthTable() {
-    typedef OperandType OT;
-
-    // ugly fucking stupid monkey language, lol
-    // let's use C++'s not-really-a-macro system
-    // to make this less of an eyesore.
-#define OTLEN(x, y)   _operandTypeLengthTable[static_cast<unsigned char>(x)] = y
-
-    for (int i=0; i<static_cast<int>(OT::NUM_OPERAND_TYPES); i++) {
-        OTLEN(i, -1);  // any that get missed will be easily noticable in debugger later on
-    }
-
-    OTLEN(OT::NIL,1);
-    OTLEN(OT::RM, 4);
-    OTLEN(OT::MR, 4);
-    OTLEN(OT::RR, 3);
-    OTLEN(OT::RRR,4);
-    OTLEN(OT::RW, 4);
-    OTLEN(OT::RB, 3);
-    OTLEN(OT::P,  3);
-    OTLEN(OT::R,  2);
-    // OTLEN(OT::RP, 4);
-    OTLEN(OT::BBB,4);
-    OTLEN(OT::BB, 3);
-    OTLEN(OT::B,  2);
-    OTLEN(OT::BW, 4);
-    OTLEN(OT::WB, 4);
-    OTLEN(OT::W,  3);
-#undef OTLEN
+OperandType VMInstrTranscoder::getOperandTypeOfOpcode(Opcode opc) const {
+    return VMOpcodeInfo::operandType(opc);
 }
 
 int VMInstrTranscoder::instructionLengthOfOperandType(OperandType opt) const {
-    int opt_cast = static_cast<int>(opt);
-    int len = _operandTypeLengthTable[opt_cast];
-
-    return len;
-}
-
-// this would be so much prettier in Lisp
-void VMInstrTranscoder::initOperandValidityTable() {
-    auto& ovt = _operandValidityTable;
-    typedef OperandType OT;
-    typedef Opcode OP;
-
-    // translate HumanOpcode + mode to VM Opcode
-    ovt[HumanOpcode::MOV] = {
-        {OT::RM, OP::MOV_RM},
-        {OT::MR, OP::MOV_MR},
-        {OT::RR, OP::MOV_RR},
-        {OT::RW, OP::MOV_RW}
-    };
-
-    ovt[HumanOpcode::MOVRP] = {
-        {OT::RR, OP::MOVRP_RR}
-    };
-
-    ovt[HumanOpcode::MOVPR] = {
-        {OT::RR, OP::MOVPR_RR}
-    };
-
-    ovt[HumanOpcode::SWAP] = {
-        {OT::RR, OP::SWAP_RR},
-        {OT::RM, OP::SWAP_RM}
-    };
-
-    ovt[HumanOpcode::ZERO] = {
-        {OT::NIL, OP::ZERO_NIL}
-    };
-
-    ovt[HumanOpcode::DUP] = {
-        {OT::R, OP::DUP_R}
-    };
-
-    ovt[HumanOpcode::ADD] = {
-        {OT::RW, OP::ADD_RW},
-        {OT::RR, OP::ADD_RR},
-        {OT::RRR, OP::ADD_RRR}
-    };
-
-    ovt[HumanOpcode::SUB] = {
-        {OT::RR, OP::SUB_RR}
-    };
-
-    ovt[HumanOpcode::MUL] = {
-        {OT::RW, OP::MUL_RW},
-        {OT::RR, OP::MUL_RR}
-    };
-
-    ovt[HumanOpcode::NEG] = {
-        {OT::R, OP::NEG_R}
-    };
-
-    ovt[HumanOpcode::JMP] = {
-        {OT::W, OP::JMP_W}
-    };
-
-    ovt[HumanOpcode::JNEG] = {
-        {OT::RW, OP::JNEG_RW}
-    };
-
-    ovt[HumanOpcode::JPOS] = {
-        {OT::RW, OP::JPOS_RW}
-    };
-
-    ovt[HumanOpcode::JZERO] = {
-        {OT::RW, OP::JZERO_RW}
-    };
-
-    ovt[HumanOpcode::JNZERO] = {
-        {OT::RW, OP::JNZERO_RW}
-    };
-
-    ovt[HumanOpcode::HALT] = {
-        {OT::NIL, OP::HALT_NIL}
-    };
-
-    ovt[HumanOpcode::AND] = {
-        {OT::RR, OP::AND_RR},
-        {OT::RW, OP::AND_RW}
-    };
-
-    ovt[HumanOpcode::OR] = {
-        {OT::RR, OP::OR_RR},
-        {OT::RW, OP::OR_RW}
-    };
-
-    ovt[HumanOpcode::XOR] = {
-        {OT::RR, OP::XOR_RR},
-        {OT::RW, OP::XOR_RW}
-    };
-
-    ovt[HumanOpcode::NOT] = {
-        {OT::R, OP::NOT_R}
-    };
-
-    ovt[HumanOpcode::BSL] = {
-        {OT::R, OP::BSL_R}
-    };
-
-    ovt[HumanOpcode::BSR] = {
-        {OT::R, OP::BSR_R}
-    };
-
-    ovt[HumanOpcode::ROL] = {
-        {OT::R, OP::ROL_R}
-    };
-
-    ovt[HumanOpcode::ROR] = {
-        {OT::R, OP::ROR_R}
-    };
-
-
-    ovt[HumanOpcode::BC] = {
-        {OT::RRR, OP::BC_RRR}
-    };
-
-    ovt[HumanOpcode::PUSH] = {
-        {OT::R, OP::PUSH_R},
-        {OT::W, OP::PUSH_W},
-        {OT::B, OP::PUSH_B}
-    };
-
-    ovt[HumanOpcode::POPB] = {
-        {OT::R, OP::POPB_R},
-    };
-    ovt[HumanOpcode::POPW] = {
-        {OT::R, OP::POPW_R},
-    };
+    return VMOpcodeInfo::operandTypeLength(opt);
 }
 
 vm_instr_emit_info_t VMInstrEmitter::emit(HumanOpcode opc, RegName reg1, addr_t addr2) const {
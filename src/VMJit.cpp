@@ -0,0 +1,616 @@
+#include "VMJit.h"
+
+#if VM_HAS_JIT
+
+#include <cstddef>
+#include <cstring>
+#include "RobotVM.h"
+#include "VMDecodedRom.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+const unsigned int MAX_BLOCK_LEN   = 64;          //!< Instructions per block, at most
+const std::size_t  CODE_CHUNK_SIZE = 64 * 1024;   //!< Bytes of executable memory grabbed at a time
+
+// x86-64 register numbers
+enum HostReg {
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+    R8 = 8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// Where R1..R4 live while a block runs.  All callee-saved, and all picked so
+// no instruction needs a SIB byte or special-cased encoding.
+const HostReg vmreg[4] = { RBX, R12, R13, R14 };
+const HostReg REGS_PTR = RBP;  //!< &vm_regs_t::r[0]
+const HostReg RAM_PTR  = R15;  //!< &RobotVM::_ram, the VM's vm_ram_t page table
+const HostReg PAGE_PTR = RDX;  //!< Whichever RAM page the current op needs
+
+const unsigned int PAGE = VMRamAccess::PAGE;
+//! Where vm_ram_t's read and write views start, relative to RAM_PTR
+const std::uint32_t READ_VIEW  = offsetof(vm_ram_t, read);
+const std::uint32_t WRITE_VIEW = offsetof(vm_ram_t, write);
+
+#ifdef _WIN64
+const HostReg ARG0 = RCX, ARG1 = RDX;
+#else
+const HostReg ARG0 = RDI, ARG1 = RSI;
+#endif
+
+// condition codes for Jcc
+enum Cond { CC_A = 0x7, CC_BE = 0x6, CC_E = 0x4, CC_NE = 0x5, CC_S = 0x8, CC_G = 0xF };
+
+/** Just enough of an x86-64 assembler for the JIT.  VM registers are 16-bit,
+    but are kept in 32-bit host registers:  whatever ends up in the upper
+    half is junk, so anything that looks at the upper half (compares, right
+    shifts and rotates) is done with 16-bit operand size instead. */
+class X64Asm {
+private:
+    std::vector<byte_t>& _c;
+
+    void rex(bool w, int reg, int rm) {
+        byte_t b = static_cast<byte_t>(0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3));
+        if (b != 0x40)
+            emit8(b);
+    }
+    void modrmReg(int reg, int rm) {
+        emit8(static_cast<byte_t>(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+    }
+
+public:
+    explicit X64Asm(std::vector<byte_t>& code) : _c(code) {}
+
+    std::size_t here() const {
+        return _c.size();
+    }
+    void emit8(unsigned int b) {
+        _c.push_back(static_cast<byte_t>(b));
+    }
+    void emit32(std::uint32_t v) {
+        for (int i = 0; i < 4; i++)
+            emit8((v >> (i * 8)) & 0xFF);
+    }
+    void patch32(std::size_t at, std::uint32_t v) {
+        for (int i = 0; i < 4; i++)
+            _c[at + i] = static_cast<byte_t>((v >> (i * 8)) & 0xFF);
+    }
+
+    //! <op> rm, reg  for any single-byte opcode with a /r ModRM
+    void rr(byte_t opcode, int rm, int reg, bool op16 = false) {
+        if (op16)
+            emit8(0x66);
+        rex(false, reg, rm);
+        emit8(opcode);
+        modrmReg(reg, rm);
+    }
+    void mov(int dst, int src)   { rr(0x89, dst, src); }
+    void add(int dst, int src)   { rr(0x01, dst, src); }
+    void sub(int dst, int src)   { rr(0x29, dst, src); }
+    void and_(int dst, int src)  { rr(0x21, dst, src); }
+    void or_(int dst, int src)   { rr(0x09, dst, src); }
+    void xor_(int dst, int src)  { rr(0x31, dst, src); }
+    void test16(int r)           { rr(0x85, r, r, true); }
+
+    void imul(int dst, int src) {
+        rex(false, dst, src);
+        emit8(0x0F);
+        emit8(0xAF);
+        modrmReg(dst, src);
+    }
+    void imulImm(int dst, int src, std::uint32_t imm) {
+        rex(false, dst, src);
+        emit8(0x69);
+        modrmReg(dst, src);
+        emit32(imm);
+    }
+    //! 81 /ext id:  add=0, or=1, and=4, sub=5, xor=6, cmp=7
+    void aluImm(int ext, int dst, std::uint32_t imm) {
+        rex(false, 0, dst);
+        emit8(0x81);
+        modrmReg(ext, dst);
+        emit32(imm);
+    }
+    void cmp16Imm8(int r, byte_t imm) {
+        emit8(0x66);
+        rex(false, 0, r);
+        emit8(0x83);
+        modrmReg(7, r);
+        emit8(imm);
+    }
+    void movImm(int dst, std::uint32_t imm) {
+        rex(false, 0, dst);
+        emit8(0xB8 + (dst & 7));
+        emit32(imm);
+    }
+    //! F7 /ext:  not=2, neg=3
+    void unary(int ext, int r) {
+        rex(false, 0, r);
+        emit8(0xF7);
+        modrmReg(ext, r);
+    }
+    //! D1 /ext, a shift or rotate by 1:  rol=0, ror=1, shl=4, shr=5
+    void shift1(int ext, int r, bool op16) {
+        if (op16)
+            emit8(0x66);
+        rex(false, 0, r);
+        emit8(0xD1);
+        modrmReg(ext, r);
+    }
+    void mov64(int dst, int src) {
+        rex(true, src, dst);
+        emit8(0x89);
+        modrmReg(src, dst);
+    }
+    void push(int r) {
+        rex(false, 0, r);
+        emit8(0x50 + (r & 7));
+    }
+    void pop(int r) {
+        rex(false, 0, r);
+        emit8(0x58 + (r & 7));
+    }
+    void ret() {
+        emit8(0xC3);
+    }
+
+    //! reg <- zero-extended word at [REGS_PTR + disp]
+    void loadRegsWord(int reg, byte_t disp) {
+        rex(false, reg, REGS_PTR);
+        emit8(0x0F);
+        emit8(0xB7);
+        emit8(static_cast<byte_t>(0x40 | ((reg & 7) << 3) | (REGS_PTR & 7)));
+        emit8(disp);
+    }
+    //! word at [REGS_PTR + disp] <- reg
+    void storeRegsWord(byte_t disp, int reg) {
+        emit8(0x66);
+        rex(false, reg, REGS_PTR);
+        emit8(0x89);
+        emit8(static_cast<byte_t>(0x40 | ((reg & 7) << 3) | (REGS_PTR & 7)));
+        emit8(disp);
+    }
+
+    //! C1 /ext ib, a shift or rotate by \a imm:  rol=0, ror=1, shl=4, shr=5
+    void shiftImm(int ext, int r, byte_t imm) {
+        rex(false, 0, r);
+        emit8(0xC1);
+        modrmReg(ext, r);
+        emit8(imm);
+    }
+    void test64(int r) {
+        rex(true, r, r);
+        emit8(0x85);
+        modrmReg(r, r);
+    }
+
+    //! dst <- the pointer at [RAM_PTR + disp32], or at [RAM_PTR + RAX*8 + disp32] if \a indexed
+    void loadRamPointer(int dst, bool indexed, std::uint32_t disp) {
+        rex(true, dst, RAM_PTR);
+        emit8(0x8B);
+        if (indexed) {
+            emit8(static_cast<byte_t>(0x84 | ((dst & 7) << 3)));        // mod=10, rm=SIB
+            emit8(static_cast<byte_t>(0xC0 | (RAX << 3) | (RAM_PTR & 7))); // scale=8, index=rax
+        } else {
+            emit8(static_cast<byte_t>(0x80 | ((dst & 7) << 3) | (RAM_PTR & 7)));
+        }
+        emit32(disp);
+    }
+
+    // RAM accesses within a page, either at [PAGE_PTR + disp32] or at [PAGE_PTR + RCX]
+    void ramOperand(int reg, bool indexed, std::uint32_t disp) {
+        if (indexed) {
+            emit8(static_cast<byte_t>(0x04 | ((reg & 7) << 3)));    // mod=00, rm=SIB
+            emit8(static_cast<byte_t>((RCX << 3) | (PAGE_PTR & 7)));  // scale=1, index=rcx
+        } else {
+            emit8(static_cast<byte_t>(0x80 | ((reg & 7) << 3) | (PAGE_PTR & 7)));
+            emit32(disp);
+        }
+    }
+    //! reg <- zero-extended word (or byte) of RAM
+    void loadRam(int reg, bool indexed, std::uint32_t disp, bool byte) {
+        rex(false, reg, PAGE_PTR);
+        emit8(0x0F);
+        emit8(byte ? 0xB6 : 0xB7);
+        ramOperand(reg, indexed, disp);
+    }
+    //! word of RAM <- reg
+    void storeRam(bool indexed, std::uint32_t disp, int reg) {
+        emit8(0x66);
+        rex(false, reg, PAGE_PTR);
+        emit8(0x89);
+        ramOperand(reg, indexed, disp);
+    }
+
+    //! Jcc rel32 to be patched later;  returns where its rel32 lives
+    std::size_t jccForward(Cond cc) {
+        emit8(0x0F);
+        emit8(0x80 + cc);
+        emit32(0);
+        return here() - 4;
+    }
+    //! Point a jccForward() at the current position
+    void land(std::size_t rel32at) {
+        patch32(rel32at, static_cast<std::uint32_t>(here() - (rel32at + 4)));
+    }
+};
+
+bool jitCanRun(const vm_decoded_op_t& op) {
+    if (op.kind == VM_OPKIND_ILLEGAL || op.kind == VM_OPKIND_HCF)
+        return false;
+
+    switch (op.opcode) {
+    case Opcode::MOV_RM:
+    case Opcode::MOV_MR:
+    case Opcode::SWAP_RM:
+        // whole word must fit in RAM, and in a single page
+        return op.w <= VM_RAM_SIZE - 2 && op.w % PAGE != PAGE - 1;
+    case Opcode::MOVB_RM:
+        return op.w <= VM_RAM_SIZE - 1;
+
+    case Opcode::NOP:
+    case Opcode::MOV_RR:
+    case Opcode::MOV_RW:
+    case Opcode::MOVRP_RR:
+    case Opcode::MOVPR_RR:
+    case Opcode::SWAP_RR:
+    case Opcode::ZERO_NIL:
+    case Opcode::DUP_R:
+    case Opcode::ADD_RW:
+    case Opcode::ADD_RR:
+    case Opcode::ADD_RRR:
+    case Opcode::SUB_RR:
+    case Opcode::MUL_RW:
+    case Opcode::MUL_RR:
+    case Opcode::NEG_R:
+    case Opcode::AND_RR:
+    case Opcode::AND_RW:
+    case Opcode::OR_RR:
+    case Opcode::OR_RW:
+    case Opcode::XOR_RR:
+    case Opcode::XOR_RW:
+    case Opcode::NOT_R:
+    case Opcode::BSL_R:
+    case Opcode::BSR_R:
+    case Opcode::ROL_R:
+    case Opcode::ROR_R:
+    case Opcode::JMP_W:
+    case Opcode::JNEG_RW:
+    case Opcode::JPOS_RW:
+    case Opcode::JZERO_RW:
+    case Opcode::JNZERO_RW:
+        return true;
+
+    default:   // HALT_NIL, stack ops, BC_RRR, ports:  the interpreter's problem
+        return false;
+    }
+}
+
+bool isJump(Opcode opc) {
+    return opc == Opcode::JMP_W || opc == Opcode::JNEG_RW || opc == Opcode::JPOS_RW
+           || opc == Opcode::JZERO_RW || opc == Opcode::JNZERO_RW;
+}
+
+void emitPrologue(X64Asm& a) {
+    a.push(RBX);
+    a.push(RBP);
+    a.push(R12);
+    a.push(R13);
+    a.push(R14);
+    a.push(R15);
+    a.mov64(REGS_PTR, ARG0);
+    a.mov64(RAM_PTR, ARG1);
+    for (int i = 0; i < 4; i++)
+        a.loadRegsWord(vmreg[i], static_cast<byte_t>(i * sizeof(sword_t)));
+}
+
+//! Leave the block, continuing at \a pc with \a count instructions executed
+void emitExit(X64Asm& a, word_t pc, unsigned int count) {
+    for (int i = 0; i < 4; i++)
+        a.storeRegsWord(static_cast<byte_t>(i * sizeof(sword_t)), vmreg[i]);
+    a.movImm(RAX, pc | (count << 16));
+    a.pop(R15);
+    a.pop(R14);
+    a.pop(R13);
+    a.pop(R12);
+    a.pop(RBP);
+    a.pop(RBX);
+    a.ret();
+}
+
+//! Leave the block for the interpreter (at \a pc, \a count instructions in) if PAGE_PTR is nullptr
+void emitExitIfNoPage(X64Asm& a, word_t pc, unsigned int count) {
+    a.test64(PAGE_PTR);
+    std::size_t gotPage = a.jccForward(CC_NE);
+    emitExit(a, pc, count);
+    a.land(gotPage);
+}
+
+/*! PAGE_PTR <- the page holding the word at fixed address \a addr, as read,
+    or as written if \a store.  A store into a page that hasn't got one of its
+    own yet leaves the block for the interpreter (at \a pc, \a count
+    instructions in), which allocates it;  next time round it'll be there. */
+void emitPage(X64Asm& a, word_t addr, bool store, word_t pc, unsigned int count) {
+    const std::uint32_t slot = (addr / PAGE) * sizeof(void*);
+    a.loadRamPointer(PAGE_PTR, false, (store ? WRITE_VIEW : READ_VIEW) + slot);
+    if (store)
+        emitExitIfNoPage(a, pc, count);
+}
+
+/*! PAGE_PTR and RCX <- the page and offset within it of the word at the RAM
+    address in \a ptrreg, as emitPage() would have it.  Also leaves the block
+    if a word there would run past the end of RAM, or straddle two pages. */
+void emitRamPointer(X64Asm& a, int ptrreg, bool store, word_t pc, unsigned int count) {
+    a.mov(RCX, ptrreg);
+    a.aluImm(4, RCX, 0xFFFF);
+    a.aluImm(7, RCX, VM_RAM_SIZE - 2);
+    std::size_t inRange = a.jccForward(CC_BE);
+    emitExit(a, pc, count);
+    a.land(inRange);
+
+    a.mov(RAX, RCX);
+    a.shiftImm(5, RAX, 8);
+    a.loadRamPointer(PAGE_PTR, true, store ? WRITE_VIEW : READ_VIEW);
+    if (store)
+        emitExitIfNoPage(a, pc, count);
+
+    a.aluImm(4, RCX, PAGE - 1);
+    a.aluImm(7, RCX, PAGE - 2);
+    std::size_t inPage = a.jccForward(CC_BE);
+    emitExit(a, pc, count);
+    a.land(inPage);
+}
+
+/*! Emit \a op, found at \a pc after \a count other ops of the block.  Jumps
+    emit their own exits;  everything else falls through to the next op. */
+void emitOp(X64Asm& a, const vm_decoded_op_t& op, word_t pc, unsigned int count) {
+    const int r1 = vmreg[op.r1 & 3], r2 = vmreg[op.r2 & 3], r3 = vmreg[op.r3 & 3];
+
+    switch (op.opcode) {
+    case Opcode::NOP:
+        break;
+    case Opcode::MOV_RM:
+        emitPage(a, op.w, false, pc, count);
+        a.loadRam(r1, false, op.w % PAGE, false);
+        break;
+    case Opcode::MOVB_RM:
+        emitPage(a, op.w, false, pc, count);
+        a.loadRam(r1, false, op.w % PAGE, true);
+        break;
+    case Opcode::MOV_MR:
+        emitPage(a, op.w, true, pc, count);
+        a.storeRam(false, op.w % PAGE, r2);
+        break;
+    case Opcode::SWAP_RM:
+        emitPage(a, op.w, true, pc, count);
+        a.loadRam(RAX, false, op.w % PAGE, false);
+        a.storeRam(false, op.w % PAGE, r1);
+        a.mov(r1, RAX);
+        break;
+    case Opcode::MOVRP_RR:
+        emitRamPointer(a, r1, true, pc, count);
+        a.storeRam(true, 0, r2);
+        break;
+    case Opcode::MOVPR_RR:
+        emitRamPointer(a, r2, false, pc, count);
+        a.loadRam(r1, true, 0, false);
+        break;
+    case Opcode::MOV_RR:
+        a.mov(r1, r2);
+        break;
+    case Opcode::MOV_RW:
+        a.movImm(r1, op.w);
+        break;
+    case Opcode::SWAP_RR:
+        a.mov(RAX, r2);
+        a.mov(r2, r1);
+        a.mov(r1, RAX);
+        break;
+    case Opcode::ZERO_NIL:
+        for (int i = 0; i < 4; i++)
+            a.xor_(vmreg[i], vmreg[i]);
+        break;
+    case Opcode::DUP_R:
+        for (int i = op.r1 + 1; i < 4; i++)
+            a.mov(vmreg[i], r1);
+        break;
+    case Opcode::ADD_RW:
+        a.aluImm(0, r1, op.w);
+        break;
+    case Opcode::ADD_RR:
+        a.add(r1, r2);
+        break;
+    case Opcode::ADD_RRR:
+        a.mov(RAX, r2);
+        a.add(RAX, r3);
+        a.add(r1, RAX);
+        break;
+    case Opcode::SUB_RR:
+        a.sub(r1, r2);
+        break;
+    case Opcode::MUL_RW:
+        a.imulImm(r1, r1, op.w);
+        break;
+    case Opcode::MUL_RR:
+        a.imul(r1, r2);
+        break;
+    case Opcode::NEG_R:
+        a.unary(3, r1);
+        break;
+    case Opcode::AND_RR:
+        a.and_(r1, r2);
+        break;
+    case Opcode::AND_RW:
+        a.aluImm(4, r1, op.w);
+        break;
+    case Opcode::OR_RR:
+        a.or_(r1, r2);
+        break;
+    case Opcode::OR_RW:
+        a.aluImm(1, r1, op.w);
+        break;
+    case Opcode::XOR_RR:
+        a.xor_(r1, r2);
+        break;
+    case Opcode::XOR_RW:
+        a.aluImm(6, r1, op.w);
+        break;
+    case Opcode::NOT_R:
+        a.unary(2, r1);
+        break;
+    case Opcode::BSL_R:
+        a.shift1(4, r1, false);
+        break;
+    case Opcode::BSR_R:
+        a.shift1(5, r1, true);
+        break;
+    case Opcode::ROL_R:
+        a.shift1(0, r1, true);
+        break;
+    case Opcode::ROR_R:
+        a.shift1(1, r1, true);
+        break;
+
+    case Opcode::JMP_W:
+        emitExit(a, op.w, count + 1);
+        break;
+    case Opcode::JNEG_RW:
+    case Opcode::JPOS_RW:
+    case Opcode::JZERO_RW:
+    case Opcode::JNZERO_RW: {
+        Cond taken;
+        if (op.opcode == Opcode::JPOS_RW) {
+            a.cmp16Imm8(r1, 1);   // JPOS means > 1;  see i_jposrw()
+            taken = CC_G;
+        } else {
+            a.test16(r1);
+            taken = op.opcode == Opcode::JNEG_RW ? CC_S
+                    : op.opcode == Opcode::JZERO_RW ? CC_E : CC_NE;
+        }
+        std::size_t jump = a.jccForward(taken);
+        emitExit(a, op.next, count + 1);
+        a.land(jump);
+        emitExit(a, op.w, count + 1);
+        break;
+    }
+
+    default:
+        break;   // jitCanRun() keeps everything else out
+    }
+}
+
+} // namespace
+
+VMJit::VMJit(const VMDecodedRom& rom)
+    : _rom(rom), _blocks(rom.size(), vm_jit_block_t{ nullptr, 0 }), _compiled(rom.size()),
+      _chunks(), _failed(false), _mutex() {
+}
+
+VMJit::~VMJit() {
+    for (CodeChunk& chunk : _chunks) {
+#ifdef _WIN32
+        VirtualFree(chunk.mem, 0, MEM_RELEASE);
+#else
+        munmap(chunk.mem, chunk.size);
+#endif
+    }
+}
+
+/*! Memory is only ever writable or executable, never both at once, so every
+    install flips the chunk's protection there and back again.  Blocks get
+    compiled rarely enough for that not to matter. */
+const byte_t* VMJit::install(const std::vector<byte_t>& code) {
+    const std::size_t size = (code.size() + 15) & ~static_cast<std::size_t>(15);
+    if (_failed || size > CODE_CHUNK_SIZE)
+        return nullptr;
+
+    if (_chunks.empty() || _chunks.back().used + size > _chunks.back().size) {
+#ifdef _WIN32
+        void* mem = VirtualAlloc(nullptr, CODE_CHUNK_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READONLY);
+        if (!mem) {
+#else
+        void* mem = mmap(nullptr, CODE_CHUNK_SIZE, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+#endif
+            _failed = true;
+            return nullptr;
+        }
+        _chunks.push_back(CodeChunk{ static_cast<byte_t*>(mem), CODE_CHUNK_SIZE, 0 });
+    }
+
+    CodeChunk& chunk = _chunks.back();
+    byte_t* dst = chunk.mem + chunk.used;
+#ifdef _WIN32
+    DWORD old;
+    bool ok = VirtualProtect(chunk.mem, chunk.size, PAGE_READWRITE, &old);
+    if (ok) {
+        memcpy(dst, code.data(), code.size());
+        ok = VirtualProtect(chunk.mem, chunk.size, PAGE_EXECUTE_READ, &old)
+             && FlushInstructionCache(GetCurrentProcess(), dst, code.size());
+    }
+#else
+    bool ok = mprotect(chunk.mem, chunk.size, PROT_READ | PROT_WRITE) == 0;
+    if (ok) {
+        memcpy(dst, code.data(), code.size());
+        ok = mprotect(chunk.mem, chunk.size, PROT_READ | PROT_EXEC) == 0;
+    }
+#endif
+    if (!ok) {
+        _failed = true;
+        return nullptr;
+    }
+
+    chunk.used += size;
+    return dst;
+}
+
+vm_jit_block_t VMJit::compile(word_t startpc) {
+    const VMDecodedRom& rom = _rom;
+    vm_jit_block_t block = { nullptr, 0 };
+    std::vector<byte_t> code;
+    X64Asm a(code);
+
+    emitPrologue(a);
+    word_t pc = startpc;
+    bool ended = false;
+    while (block.len < MAX_BLOCK_LEN && pc < rom.size()) {
+        const vm_decoded_op_t& op = rom[pc];
+        if (!jitCanRun(op))
+            break;
+
+        emitOp(a, op, pc, block.len);
+        block.len++;
+        pc = op.next;
+        if (isJump(op.opcode)) {
+            ended = true;
+            break;
+        }
+    }
+
+    if (block.len == 0)
+        return block;
+    if (!ended)
+        emitExit(a, pc, block.len);
+
+    const byte_t* fn = install(code);
+    if (fn)
+        block.fn = reinterpret_cast<vm_jit_fn_t>(const_cast<byte_t*>(fn));
+    else
+        block.len = 0;
+    return block;
+}
+
+const vm_jit_block_t& VMJit::compileAt(word_t pc) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_compiled[pc].load(std::memory_order_relaxed)) {
+        _blocks[pc] = compile(pc);
+        _compiled[pc].store(true, std::memory_order_release);
+    }
+    return _blocks[pc];
+}
+
+#endif // VM_HAS_JIT
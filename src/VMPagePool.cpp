@@ -0,0 +1,72 @@
+#include <cstring>
+#include "VMPagePool.h"
+
+VMPagePool::VMPagePool()
+    : _mutex(), _slabs(), _free(), _sharers(), _inUse(0) {
+}
+
+const byte_t* VMPagePool::zeroPage() {
+    alignas(64) static const byte_t zeros[VM_RAM_PAGE_SIZE] = { 0 };
+    return zeros;
+}
+
+std::uint64_t VMPagePool::zeroPageHash() {
+    static const std::uint64_t hash = VMStateHash::bytes(zeroPage(), VM_RAM_PAGE_SIZE);
+    return hash;
+}
+
+byte_t* VMPagePool::take() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_free.empty()) {
+        _slabs.emplace_back(new byte_t[SLAB_PAGES * VM_RAM_PAGE_SIZE]);
+        byte_t* const slab = _slabs.back().get();
+        for (std::size_t i = SLAB_PAGES; i > 0; i--)
+            _free.push_back(slab + (i - 1) * VM_RAM_PAGE_SIZE);
+    }
+    byte_t* const page = _free.back();
+    _free.pop_back();
+    _inUse++;
+    return page;
+}
+
+byte_t* VMPagePool::allocate() {
+    byte_t* const page = take();
+    std::memset(page, 0, VM_RAM_PAGE_SIZE);
+    return page;
+}
+
+byte_t* VMPagePool::allocate(const byte_t* from) {
+    byte_t* const page = take();
+    std::memcpy(page, from, VM_RAM_PAGE_SIZE);
+    return page;
+}
+
+void VMPagePool::share(const byte_t* page) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _sharers[page]++;
+}
+
+void VMPagePool::release(const byte_t* page) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_sharers.empty()) {
+        auto it = _sharers.find(page);
+        if (it != _sharers.end()) {
+            if (--it->second == 0)
+                _sharers.erase(it);
+            return;
+        }
+    }
+    // only ever const to the owners;  nobody else has it now
+    _free.push_back(const_cast<byte_t*>(page));
+    _inUse--;
+}
+
+std::size_t VMPagePool::pagesInUse() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _inUse;
+}
+
+std::size_t VMPagePool::pagesAllocated() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _slabs.size() * SLAB_PAGES;
+}
@@ -0,0 +1,55 @@
+#include "VMPort.h"
+
+namespace {
+
+//! Slots for a port of \a capacity:  a power of two, and at least 2, or a
+//! full slot's sequence number would look just like the next free one's
+std::size_t slotsFor(std::size_t capacity) {
+    std::size_t n = 2;
+    while (n < capacity)
+        n <<= 1;
+    return n;
+}
+
+} // namespace
+
+VMPort::VMPort(std::size_t capacity)
+    : _slots(new Slot[slotsFor(capacity)]), _mask(slotsFor(capacity) - 1),
+      _pad0(), _tail(0), _pad1(), _head(0) {
+    for (std::size_t i = 0; i <= _mask; i++) {
+        _slots[i].seq.store(i, std::memory_order_relaxed);
+        _slots[i].value = 0;
+    }
+}
+
+VMPortMap::VMPortMap()
+    : _ports() {
+}
+
+VMPort& VMPortMap::open(byte_t id, std::size_t capacity) {
+    _ports[id].reset(new VMPort(capacity));
+    return *_ports[id];
+}
+
+void VMPortMap::close(byte_t id) {
+    _ports[id].reset();
+}
+
+VMOutbox::VMOutbox(std::size_t capacity)
+    : _msgs(), _capacity(capacity ? capacity : 1) {
+    _msgs.reserve(_capacity);
+}
+
+std::size_t VMOutbox::deliver(const VMPortMap& ports) {
+    std::size_t done = 0, sent = 0;
+    for (; done < _msgs.size(); done++) {
+        VMPort* const port = ports.at(_msgs[done].port);
+        if (!port)
+            continue;
+        if (!port->trySend(_msgs[done].value))
+            break;
+        sent++;
+    }
+    _msgs.erase(_msgs.begin(), _msgs.begin() + done);
+    return sent;
+}
@@ -0,0 +1,238 @@
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+#include "VMSelfCheck.h"
+#include "RobotVM.h"
+#include "VMOpcodeTypes.h"
+#include "VMWorld.h"
+
+namespace {
+
+//! Most instructions a check program runs
+const unsigned long CHECK_STEPS = 2000;
+
+//! What check programs are made of:  every opcode but the port and WAIT_W ones, whose
+//! retries runFor() and stepRaw() count differently, with the usual loop makings again
+const Opcode checkOpcodes[] = {
+    Opcode::NOP, Opcode::MOV_RM, Opcode::MOV_MR, Opcode::MOV_RR, Opcode::MOV_RW, Opcode::MOVRP_RR,
+    Opcode::MOVPR_RR, Opcode::MOVB_RM, Opcode::SWAP_RR, Opcode::SWAP_RM, Opcode::ZERO_NIL, Opcode::DUP_R,
+    Opcode::ADD_RW, Opcode::ADD_RR, Opcode::ADD_RRR, Opcode::SUB_RR,
+    Opcode::MUL_RW, Opcode::MUL_RR, Opcode::NEG_R, Opcode::JMP_W, Opcode::JNEG_RW, Opcode::JPOS_RW,
+    Opcode::JZERO_RW, Opcode::JNZERO_RW, Opcode::HALT_NIL, Opcode::AND_RR, Opcode::AND_RW, Opcode::OR_RR,
+    Opcode::OR_RW, Opcode::XOR_RR, Opcode::XOR_RW, Opcode::NOT_R, Opcode::BSL_R, Opcode::BSR_R,
+    Opcode::ROL_R, Opcode::ROR_R, Opcode::PUSH_R, Opcode::PUSH_W, Opcode::PUSH_B, Opcode::POPB_R,
+    Opcode::POPW_R, Opcode::BC_RRR,
+    Opcode::ADD_RW, Opcode::ADD_RW, Opcode::JNZERO_RW, Opcode::MOV_RM, Opcode::MOV_MR, Opcode::MOV_MR,
+};
+
+//! One way of configuring a VM to run the check programs
+struct CheckConfig {
+    const char* name;
+    VMEngine    engine;
+    bool        superops;
+    bool        fixedregs;
+};
+
+const CheckConfig configs[] = {
+    { "switch",          VMEngine::SWITCH,   false, false },
+    { "decoded-generic", VMEngine::DECODED,  false, false },
+    { "decoded",         VMEngine::DECODED,  false, true  },
+    { "decoded+super",   VMEngine::DECODED,  true,  true  },
+    { "threaded",        VMEngine::THREADED, false, true  },
+    { "threaded+super",  VMEngine::THREADED, true,  true  },
+    { "jit",             VMEngine::JIT,      true,  true  },
+};
+
+bool isJump(Opcode op) {
+    return op == Opcode::JMP_W || op == Opcode::JNEG_RW || op == Opcode::JPOS_RW
+           || op == Opcode::JZERO_RW || op == Opcode::JNZERO_RW;
+}
+
+//! A program of \a count random instructions, whose jumps all land on one of them
+std::shared_ptr<const RomImage> randomProgram(std::mt19937& rng, int count) {
+    std::vector<Opcode> ops;
+    std::vector<word_t> starts;
+    word_t here = 0;
+    for (int i = 0; i < count; i++) {
+        ops.push_back(checkOpcodes[rng() % (sizeof(checkOpcodes) / sizeof(checkOpcodes[0]))]);
+        starts.push_back(here);
+        here = static_cast<word_t>(here + VMOpcodeInfo::length(ops.back()));
+    }
+
+    RobotVM vm;
+    for (Opcode op : ops) {
+        const byte_t r1 = static_cast<byte_t>(rng() % 4);
+        const byte_t r2 = static_cast<byte_t>(rng() % 4);
+        const byte_t r3 = static_cast<byte_t>(rng() % 4);
+        // now and then a big number, or an address outside RAM
+        word_t w = static_cast<word_t>(rng() % 3 == 0 ? rng() : rng() % 20);
+        const word_t addr = static_cast<word_t>(rng() % 8 == 0 ? rng() : rng() % 1000);
+        if (isJump(op))
+            w = starts[rng() % starts.size()];
+
+        switch (VMOpcodeInfo::operandType(op)) {
+        case OperandType::RM:
+            vm.burn(vm_instr_t(op, r1, addr));
+            break;
+        case OperandType::MR:
+            vm.burn(vm_instr_t(op, addr, r1));
+            break;
+        case OperandType::RR:
+            vm.burn(vm_instr_t(op, r1, r2));
+            break;
+        case OperandType::RRR:
+            vm.burn(vm_instr_t(op, r1, r2, r3));
+            break;
+        case OperandType::RW:
+            vm.burn(vm_instr_t(op, r1, w));
+            break;
+        case OperandType::W:
+            vm.burn(vm_instr_t(op, w));
+            break;
+        case OperandType::R:
+        case OperandType::B:
+            vm.burn(vm_instr_t(op, static_cast<byte_t>(op == Opcode::PUSH_B ? w : r1)));
+            break;
+        default:
+            vm.burn(vm_instr_t(op));
+            break;
+        }
+    }
+    return vm.rom();
+}
+
+//! Receives on port \a in, adds what it got to a running total in R2 and RAM, and sends that on to port \a out
+std::shared_ptr<const RomImage> relay(byte_t in, byte_t out) {
+    const byte_t r1 = static_cast<byte_t>(RegName::R1);
+    const byte_t r2 = static_cast<byte_t>(RegName::R2);
+    RobotVM vm;
+    vm.burn(vm_instr_t(Opcode::RECV_RB, r1, in));
+    vm.burn(vm_instr_t(Opcode::ADD_RR, r2, r1));
+    vm.burn(vm_instr_t(Opcode::MOV_MR, static_cast<word_t>(64 * in), r2));
+    vm.burn(vm_instr_t(Opcode::SEND_RB, r2, out));
+    vm.burn(vm_instr_t(Opcode::JMP_W, static_cast<word_t>(0)));
+    return vm.rom();
+}
+
+//! Each tick's VMWorld::stateHash() for a world of relays ticked \a ticks times on \a threads threads
+std::vector<std::uint64_t> relayHashes(unsigned int threads, int ticks) {
+    VMWorld world(threads);
+    world.setDeterministicMessaging(true);
+    world.setTickHashing(true);
+    world.setBatchSize(4);
+    world.ports().open(0);
+    world.ports().open(1);
+    // many receivers on each port, so who gets which word is up to the world
+    const std::shared_ptr<const RomImage> there = relay(0, 1), back = relay(1, 0);
+    for (int i = 0; i < 16; i++)
+        world.spawn(i % 4 ? there : back);
+    for (word_t w = 1; w <= 40; w++)
+        world.ports().at(0)->trySend(w);
+
+    std::vector<std::uint64_t> hashes;
+    for (int t = 0; t < ticks; t++) {
+        if (t == ticks / 2)
+            world.fork(3);
+        hashes.push_back(world.tick().hash);
+    }
+    return hashes;
+}
+
+bool faulted(const vm_errorstate_t& e) {
+    return e.illegal_instruction || e.on_fire || e.memory_fault || e.bad_port;
+}
+
+//! Whether \a vm ended up just like \a ref, printing how it didn't to \a out
+bool sameAs(std::FILE* out, int program, const char* config, const RobotVM& vm, const RobotVM& ref) {
+    const vm_regs_t& a = vm.getRegs();
+    const vm_regs_t& b = ref.getRegs();
+    bool same = a.pc == b.pc && a.sp == b.sp && a.ix == b.ix;
+    for (int r = 0; r < 4; r++)
+        same = same && a.r[r] == b.r[r];
+    if (!same) {
+        fprintf(out, "  program %d, %s:  registers differ (PC %u, not %u)\n", program, config, a.pc, b.pc);
+        return false;
+    }
+    if (vm.isHalted() != ref.isHalted() || faulted(vm.errorState()) != faulted(ref.errorState())) {
+        fprintf(out, "  program %d, %s:  halted %d, faulted %d, not %d, %d\n", program, config,
+                vm.isHalted(), faulted(vm.errorState()), ref.isHalted(), faulted(ref.errorState()));
+        return false;
+    }
+    if (vm.stateHash() != ref.stateHash()) {
+        fprintf(out, "  program %d, %s:  RAM or stack differ\n", program, config);
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int checkEngines(std::FILE* out, int programs) {
+    std::mt19937 rng(1);
+    int failures = 0;
+    for (int p = 0; p < programs; p++) {
+        const std::shared_ptr<const RomImage> rom = randomProgram(rng, 1 + static_cast<int>(rng() % 40));
+
+        std::unique_ptr<RobotVM> ref(new RobotVM());
+        ref->setRom(rom);
+        unsigned long steps = 0;
+        while (steps < CHECK_STEPS && !ref->isHalted()) {
+            ref->stepRaw();
+            steps++;
+        }
+        const VMStopReason expect = faulted(ref->errorState()) ? VMStopReason::FAULT
+                                    : ref->isHalted() ? VMStopReason::HALT : VMStopReason::BUDGET;
+
+        for (const CheckConfig& config : configs) {
+            std::unique_ptr<RobotVM> vm(new RobotVM());
+            vm->setRom(rom);
+            vm->setEngine(config.engine);
+            vm->setSuperOps(config.superops);
+            vm->setFixedRegHandlers(config.fixedregs);
+            // in uneven slices, so that budgets run out partway through blocks and superinstructions
+            const unsigned long slice = 1 + rng() % 17;
+            unsigned long total = 0;
+            VMStopReason why;
+            do {
+                unsigned long ran = 0;
+                why = vm->runFor(std::min(slice, CHECK_STEPS - total), &ran);
+                total += ran;
+            } while (why == VMStopReason::BUDGET && total < CHECK_STEPS);
+
+            if (total != steps || why != expect) {
+                fprintf(out, "  program %d, %s:  ran %lu instructions, not %lu, and stopped with %d, not %d\n",
+                        p, config.name, total, steps, static_cast<int>(why), static_cast<int>(expect));
+                failures++;
+            } else if (!sameAs(out, p, config.name, *vm, *ref)) {
+                failures++;
+            }
+        }
+    }
+    fprintf(out, "engines:  %d programs on %u configurations, %d mismatches\n", programs,
+            static_cast<unsigned>(sizeof(configs) / sizeof(configs[0])), failures);
+    return failures;
+}
+
+int checkWorldThreads(std::FILE* out) {
+    const int ticks = 40;
+    const std::vector<std::uint64_t> one = relayHashes(1, ticks);
+    int failures = 0;
+    for (unsigned int threads : { 2u, 4u, 8u }) {
+        const std::vector<std::uint64_t> many = relayHashes(threads, ticks);
+        for (int t = 0; t < ticks; t++) {
+            if (many[t] != one[t]) {
+                fprintf(out, "  %u threads:  tick %d hashes differently from one thread's\n", threads, t + 1);
+                failures++;
+                break;
+            }
+        }
+    }
+    fprintf(out, "world:  %d ticks on 1, 2, 4 and 8 threads, %d mismatches\n", ticks, failures);
+    return failures;
+}
+
+int runSelfChecks(std::FILE* out) {
+    return checkEngines(out, 2000) + checkWorldThreads(out);
+}
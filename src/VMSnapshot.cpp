@@ -0,0 +1,696 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "VMSnapshot.h"
+#include "VMWorld.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char SNAPSHOT_MAGIC[8] = { 'R', 'B', 'H', 'S', 'N', 'A', 'P', 0 };
+const std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+//! Every section starts on a multiple of this
+const std::uint64_t SECTION_ALIGN = 64;
+//! Pages gathered up per write
+const std::size_t PAGES_PER_WRITE = 4096;
+//! RAM pages per VM, then one more for the stack
+const unsigned int RAM_PAGES = VM_RAM_SIZE / VM_RAM_PAGE_SIZE;
+//! Bits of vm_snapshot_vm_t::pages that mean anything
+const std::uint32_t PAGE_BITS = (1u << (RAM_PAGES + 1)) - 1;
+
+static_assert(VM_STACK_SIZE == VM_RAM_PAGE_SIZE, "the stack is saved as one page");
+static_assert(RAM_PAGES + 1 <= 32, "a VM's pages in use are saved as a 32-bit mask");
+
+std::uint64_t align(std::uint64_t at) {
+    return (at + SECTION_ALIGN - 1) & ~(SECTION_ALIGN - 1);
+}
+
+std::uint8_t packErrors(const vm_errorstate_t& e) {
+    return static_cast<std::uint8_t>(e.illegal_instruction | e.on_fire << 1 | e.memory_fault << 2 | e.bad_port << 3);
+}
+
+void unpackErrors(std::uint8_t bits, vm_errorstate_t& e) {
+    e.illegal_instruction = (bits & 1) != 0;
+    e.on_fire = (bits & 2) != 0;
+    e.memory_fault = (bits & 4) != 0;
+    e.bad_port = (bits & 8) != 0;
+}
+
+unsigned int popCount(std::uint32_t bits) {
+    unsigned int n = 0;
+    for (; bits; bits &= bits - 1)
+        n++;
+    return n;
+}
+
+//! An id for a new checkpoint:  the time, and how many this process has made, well mixed
+std::uint64_t newId() {
+    static std::atomic<std::uint64_t> made(0);
+    std::uint64_t x = static_cast<std::uint64_t>(std::chrono::system_clock::now().time_since_epoch().count())
+                      + ++made * 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x ? x : 1;
+}
+
+//! Numbers every page in use as VMs are saved, each shared page just once
+class PageNumbering {
+private:
+    std::unordered_map<const byte_t*, std::uint32_t> _shared;  //!< Shared pages numbered so far
+
+public:
+    std::vector<std::uint32_t> refs;   //!< Each VM's pages, by number
+    std::vector<const byte_t*> pages;  //!< Each page, by number
+
+    PageNumbering()
+        : _shared(), refs(), pages() {
+    }
+
+    //! Number the pages of \a table in \a mask, bit n for page n, which must be in use
+    template <unsigned int PAGES>
+    void add(const VMPageTable<PAGES>& table, std::uint32_t mask) {
+        for (unsigned int i = 0; i < PAGES; i++) {
+            if (!(mask >> i & 1))
+                continue;
+            const byte_t* const page = table.read[i];
+            // only a page that's not our own might be somebody else's too
+            if (table.owns(i)) {
+                refs.push_back(number(page));
+            } else {
+                auto it = _shared.find(page);
+                if (it == _shared.end())
+                    it = _shared.emplace(page, number(page)).first;
+                refs.push_back(it->second);
+            }
+        }
+    }
+    std::uint32_t number(const byte_t* page) {
+        if (pages.size() >= 0xffffffffu)
+            throw VMSnapshotException("too many pages for a snapshot");
+        pages.push_back(page);
+        return static_cast<std::uint32_t>(pages.size() - 1);
+    }
+};
+
+//! Writes sections one after the other, each on a SECTION_ALIGN boundary
+class SectionWriter {
+private:
+    std::FILE*    _file;
+    std::string   _path;
+    std::uint64_t _at;   //!< Bytes written so far
+
+    void fail() {
+        throw VMSnapshotException("can't write snapshot " + _path);
+    }
+
+public:
+    explicit SectionWriter(const char* path)
+        : _file(std::fopen(path, "wb")), _path(path), _at(0) {
+        if (!_file)
+            fail();
+    }
+    ~SectionWriter() {
+        if (_file)
+            std::fclose(_file);
+    }
+    SectionWriter(const SectionWriter&) = delete;
+    SectionWriter& operator=(const SectionWriter&) = delete;
+
+    void write(const void* bytes, std::size_t size) {
+        if (size && std::fwrite(bytes, 1, size, _file) != size)
+            fail();
+        _at += size;
+    }
+    //! Pad with zeros up to where the next section goes
+    void pad() {
+        static const byte_t zeros[SECTION_ALIGN] = { 0 };
+        write(zeros, static_cast<std::size_t>(align(_at) - _at));
+    }
+    template <class RecordT>
+    void section(const std::vector<RecordT>& records) {
+        pad();
+        write(records.data(), records.size() * sizeof(RecordT));
+    }
+    void close() {
+        std::FILE* const file = _file;
+        _file = nullptr;
+        if (std::fclose(file) != 0)
+            fail();
+    }
+};
+
+//! A whole file, mapped into memory read-only
+class MappedFile {
+private:
+    const byte_t* _data;
+    std::size_t   _size;
+#if defined(_WIN32)
+    HANDLE _file, _mapping;
+#elif !defined(__unix__) && !defined(__APPLE__)
+    std::vector<byte_t> _copy;   //!< No mmap:  the file read into memory instead
+#endif
+
+    //! Unmap and close whatever got mapped and opened
+    void release() {
+#if defined(_WIN32)
+        if (_data)
+            UnmapViewOfFile(_data);
+        if (_mapping)
+            CloseHandle(_mapping);
+        if (_file != INVALID_HANDLE_VALUE)
+            CloseHandle(_file);
+#elif defined(__unix__) || defined(__APPLE__)
+        if (_data)
+            munmap(const_cast<byte_t*>(_data), _size);
+#endif
+        _data = nullptr;
+    }
+    void fail(const char* path, const char* why) {
+        release();
+        throw VMSnapshotException(std::string(why) + " snapshot " + path);
+    }
+
+public:
+    explicit MappedFile(const char* path)
+        : _data(nullptr), _size(0)
+#if defined(_WIN32)
+        , _file(INVALID_HANDLE_VALUE), _mapping(nullptr)
+#elif !defined(__unix__) && !defined(__APPLE__)
+        , _copy()
+#endif
+    {
+#if defined(_WIN32)
+        _file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (_file == INVALID_HANDLE_VALUE)
+            fail(path, "can't open");
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(_file, &size))
+            fail(path, "can't read");
+        _size = static_cast<std::size_t>(size.QuadPart);
+        if (_size < sizeof(vm_snapshot_header_t))
+            fail(path, "truncated");
+        _mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!_mapping)
+            fail(path, "can't map");
+        _data = static_cast<const byte_t*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+        if (!_data)
+            fail(path, "can't map");
+#elif defined(__unix__) || defined(__APPLE__)
+        const int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            fail(path, "can't open");
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<std::uint64_t>(st.st_size) < sizeof(vm_snapshot_header_t)) {
+            ::close(fd);
+            fail(path, "truncated");
+        }
+        _size = static_cast<std::size_t>(st.st_size);
+        void* const at = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);   // the mapping keeps the file open
+        if (at == MAP_FAILED)
+            fail(path, "can't map");
+        madvise(at, _size, MADV_SEQUENTIAL);
+        _data = static_cast<const byte_t*>(at);
+#else
+        std::FILE* const f = std::fopen(path, "rb");
+        if (!f)
+            fail(path, "can't open");
+        byte_t buf[65536];
+        for (std::size_t got; (got = std::fread(buf, 1, sizeof(buf), f)) > 0; )
+            _copy.insert(_copy.end(), buf, buf + got);
+        std::fclose(f);
+        if (_copy.size() < sizeof(vm_snapshot_header_t))
+            fail(path, "truncated");
+        _data = _copy.data();
+        _size = _copy.size();
+#endif
+    }
+    ~MappedFile() {
+        release();
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const byte_t* data() const {
+        return _data;
+    }
+    std::size_t size() const {
+        return _size;
+    }
+};
+
+//! The records of one section of a snapshot, checked to be in the file
+template <class RecordT>
+struct Section {
+    const RecordT* at;
+    std::uint64_t  count;
+
+    Section(const MappedFile& file, const vm_snapshot_section_t& where, const char* path)
+        : at(reinterpret_cast<const RecordT*>(file.data() + where.offset)), count(where.count) {
+        if (where.offset % SECTION_ALIGN != 0 || where.offset > file.size()
+            || where.count > (file.size() - where.offset) / sizeof(RecordT))
+            throw VMSnapshotException(std::string("corrupt snapshot ") + path);
+    }
+    const RecordT& operator[](std::uint64_t i) const {
+        return at[i];
+    }
+};
+
+//! One file of a chain of snapshots, mapped and checked
+class SnapshotFile {
+private:
+    static vm_snapshot_header_t readHeader(const MappedFile& file, const char* path) {
+        vm_snapshot_header_t header;
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0)
+            throw VMSnapshotException(std::string("not a snapshot:  ") + path);
+        if (header.version != VM_SNAPSHOT_VERSION || header.byteOrder != BYTE_ORDER_MARK
+            || header.pageSize != VM_RAM_PAGE_SIZE || header.ramPages != RAM_PAGES)
+            throw VMSnapshotException(std::string("snapshot from another version or host:  ") + path);
+        if (header.fileSize != file.size() || header.id == 0)
+            throw VMSnapshotException(std::string("corrupt snapshot ") + path);
+        return header;
+    }
+
+public:
+    const MappedFile file;
+    const std::string path;
+    const vm_snapshot_header_t header;
+    const Section<vm_snapshot_rom_t> roms;
+    const Section<byte_t> romBytes;
+    const Section<vm_snapshot_vm_t> vms;
+    const Section<std::uint32_t> refs;
+    const Section<byte_t> pages;
+    const Section<vm_snapshot_port_t> ports;
+    const Section<word_t> portWords;
+    const Section<vm_snapshot_outbox_t> outboxes;
+    const Section<vm_snapshot_message_t> messages;
+
+    explicit SnapshotFile(const char* path)
+        : file(path), path(path), header(readHeader(file, path)),
+          roms(file, header.roms, path), romBytes(file, header.romBytes, path),
+          vms(file, header.vms, path), refs(file, header.pageRefs, path), pages(file, header.pages, path),
+          ports(file, header.ports, path), portWords(file, header.portWords, path),
+          outboxes(file, header.outboxes, path), messages(file, header.messages, path) {
+        bool ok = pages.count % VM_RAM_PAGE_SIZE == 0 && header.batchSize > 0;
+        for (std::uint64_t i = 0; ok && i < roms.count; i++)
+            ok = roms[i].size <= VM_ROM_SIZE && roms[i].offset <= romBytes.count
+                 && roms[i].size <= romBytes.count - roms[i].offset;
+        for (std::uint64_t i = 0; ok && i < vms.count; i++) {
+            const vm_snapshot_vm_t& rec = vms[i];
+            ok = rec.rom < roms.count && (rec.pages & ~PAGE_BITS) == 0 && (rec.changed & ~rec.pages) == 0
+                 && (rec.previous == VM_SNAPSHOT_NEW ? rec.changed == rec.pages : header.base != 0)
+                 && rec.firstPage <= refs.count && popCount(rec.changed) <= refs.count - rec.firstPage
+                 && rec.engine <= static_cast<std::uint8_t>(VMEngine::JIT)
+                 && rec.waitFor <= static_cast<std::uint8_t>(VMWaitReason::SLEEP);
+        }
+        for (std::uint64_t i = 0; ok && i < refs.count; i++)
+            ok = refs[i] < pages.count / VM_RAM_PAGE_SIZE;
+        for (std::uint64_t i = 0; ok && i < ports.count; i++)
+            ok = ports[i].id < VM_PORT_COUNT && ports[i].words <= ports[i].capacity
+                 && ports[i].firstWord <= portWords.count && ports[i].words <= portWords.count - ports[i].firstWord;
+        for (std::uint64_t i = 0; ok && i < outboxes.count; i++)
+            ok = outboxes[i].vm < vms.count && outboxes[i].firstMessage <= messages.count
+                 && outboxes[i].messages <= messages.count - outboxes[i].firstMessage;
+        if (!ok)
+            throw VMSnapshotException("corrupt snapshot " + this->path);
+    }
+    SnapshotFile(const SnapshotFile&) = delete;
+    SnapshotFile& operator=(const SnapshotFile&) = delete;
+
+    //! Page \a n of this file
+    const byte_t* page(std::uint32_t n) const {
+        return pages.at + static_cast<std::size_t>(n) * VM_RAM_PAGE_SIZE;
+    }
+};
+
+/** Finds where, in a chain of snapshots, each page of the last one's VMs is,
+    following each VM back through the files before it for those it didn't
+    change, and checking as it goes that they're there */
+class PageFinder {
+private:
+    const std::vector<std::unique_ptr<SnapshotFile>>& _chain;
+    std::vector<std::uint64_t> _first;   //!< Where each file's pages start, numbering the chain's pages all together
+
+public:
+    std::vector<std::uint64_t> refs;     //!< Each VM's pages, by number over the whole chain
+    std::vector<const byte_t*> pages;    //!< Each page of the chain, by number
+
+    explicit PageFinder(const std::vector<std::unique_ptr<SnapshotFile>>& chain)
+        : _chain(chain), _first(), refs(), pages() {
+        for (const std::unique_ptr<SnapshotFile>& file : chain) {
+            _first.push_back(pages.size());
+            for (std::uint64_t n = 0; n < file->pages.count / VM_RAM_PAGE_SIZE; n++)
+                pages.push_back(file->page(static_cast<std::uint32_t>(n)));
+        }
+        const SnapshotFile& last = *chain.back();
+        for (std::uint64_t i = 0; i < last.vms.count; i++)
+            for (unsigned int bit = 0; bit <= RAM_PAGES; bit++)
+                if (last.vms[i].pages >> bit & 1)
+                    refs.push_back(find(chain.size() - 1, i, 1u << bit));
+    }
+    PageFinder(const PageFinder&) = delete;
+    PageFinder& operator=(const PageFinder&) = delete;
+
+    //! The number of the page \a bit of VM \a vm in file \a file of the chain
+    std::uint64_t find(std::size_t file, std::uint64_t vm, std::uint32_t bit) const {
+        for (;;) {
+            const SnapshotFile& in = *_chain[file];
+            const vm_snapshot_vm_t& rec = in.vms[vm];
+            if (!(rec.pages & bit))
+                break;
+            if (rec.changed & bit)
+                return _first[file] + in.refs[rec.firstPage + popCount(rec.changed & (bit - 1))];
+            if (file == 0 || rec.previous >= _chain[file - 1]->vms.count)
+                break;
+            vm = rec.previous;
+            file--;
+        }
+        throw VMSnapshotException("corrupt snapshot " + _chain[file]->path);
+    }
+};
+
+//! Gives the VMs being restored their pages, sharing them as the saved ones did
+class PageRestorer {
+private:
+    const std::vector<const byte_t*>& _pages;  //!< Each page's bytes
+    std::vector<std::uint32_t> _owners;   //!< How many VMs have each page
+    std::vector<byte_t*> _made;           //!< Each shared page once it's been made, from...
+    std::vector<VMPagePool*> _pools;      //!< ...this pool
+
+public:
+    explicit PageRestorer(const PageFinder& found)
+        : _pages(found.pages), _owners(found.pages.size()), _made(_owners.size()), _pools(_owners.size()) {
+        for (std::uint64_t n : found.refs)
+            _owners[n]++;
+    }
+    PageRestorer(const PageRestorer&) = delete;
+    PageRestorer& operator=(const PageRestorer&) = delete;
+
+    /** Fill in the pages of \a table in use, going by \a mask from bit \a bit,
+        from the page numbers at \a ref, moving it past them */
+    template <unsigned int PAGES>
+    void restore(VMPageTable<PAGES>& table, std::uint32_t mask, unsigned int bit, const std::uint64_t*& ref) {
+        for (unsigned int i = 0; i < PAGES; i++) {
+            if (!(mask & 1u << (bit + i)))
+                continue;
+            const std::uint64_t n = *ref++;
+            byte_t* page = _made[n];
+            if (page && _pools[n] == table.pool) {
+                table.pool->share(page);
+                table.read[i] = page;
+                table.write[i] = nullptr;
+                continue;
+            }
+            // ours alone, the first share of it, or a share from another node's pool, which we copy
+            page = table.pool->allocate(_pages[n]);
+            table.read[i] = page;
+            table.write[i] = page;
+            if (_owners[n] > 1 && !_made[n]) {
+                _made[n] = page;
+                _pools[n] = table.pool;
+                table.write[i] = nullptr;
+            }
+        }
+    }
+};
+
+} // namespace
+
+void VMSnapshot::write(const VMWorld& world, const char* path, std::uint64_t id, std::uint64_t base) {
+    if (world._vms.size() >= VM_SNAPSHOT_NEW)
+        throw VMSnapshotException("too many VMs for a snapshot");
+    std::vector<vm_snapshot_rom_t> roms;
+    std::vector<byte_t> romBytes;
+    std::unordered_map<const RomImage*, std::uint32_t> romNumbers;
+    const RomImage* lastRom = nullptr;
+    std::uint32_t lastRomNumber = 0;
+    std::vector<vm_snapshot_vm_t> vms(world._vms.size());
+    PageNumbering pages;
+    pages.refs.reserve(world._vms.size());
+    pages.pages.reserve(world._vms.size());
+    const std::vector<word_t> sleeps = world.sleepsLeft();
+
+    for (std::size_t i = 0; i < world._vms.size(); i++) {
+        const RobotVM& vm = *world._vms[i];
+        vm_snapshot_vm_t& rec = vms[i];
+        std::memset(&rec, 0, sizeof(rec));
+        for (int r = 0; r < 4; r++)
+            rec.r[r] = vm._regs.r[r];
+        rec.pc = vm._regs.pc;
+        rec.sp = vm._regs.sp;
+        rec.ix = vm._regs.ix;
+        rec.halted = vm._halt;
+        rec.waiting = vm._wait;
+        rec.errors = packErrors(vm._errorstate);
+        rec.waitFor = static_cast<std::uint8_t>(vm._waitFor);
+        rec.waitPort = vm._waitPort;
+        rec.woke = vm._woke;
+        rec.engine = static_cast<std::uint8_t>(vm._engine);
+        rec.options = static_cast<std::uint8_t>((vm._superops ? VM_SNAPSHOT_SUPEROPS : 0)
+                                                | (vm._fixedregs ? VM_SNAPSHOT_FIXEDREGS : 0)
+                                                | (vm._hexregs ? VM_SNAPSHOT_HEXREGS : 0));
+        rec.sleep = sleeps[i];
+
+        // neighbours mostly run the same program, so try the last one before looking it up
+        const RomImage* const rom = vm._rom.get();
+        if (rom != lastRom) {
+            auto it = romNumbers.find(rom);
+            if (it == romNumbers.end()) {
+                vm_snapshot_rom_t image = { romBytes.size(), static_cast<std::uint32_t>(rom->size()), 0 };
+                romBytes.insert(romBytes.end(), rom->data(), rom->data() + rom->size());
+                roms.push_back(image);
+                it = romNumbers.emplace(rom, static_cast<std::uint32_t>(roms.size() - 1)).first;
+            }
+            lastRom = rom;
+            lastRomNumber = it->second;
+        }
+        rec.rom = lastRomNumber;
+
+        // a VM that was in the base needs only the pages written since;  any other, all of them
+        rec.pages = vm._ram.residentMask() | vm._stack.residentMask() << RAM_PAGES;
+        rec.changed = rec.pages;
+        rec.previous = VM_SNAPSHOT_NEW;
+        if (base && vm._saved) {
+            rec.changed &= vm._ram.dirty | vm._stack.dirty << RAM_PAGES;
+            rec.previous = static_cast<std::uint32_t>(vm._saved - 1);
+        }
+        rec.firstPage = pages.refs.size();
+        pages.add(vm._ram, rec.changed);
+        pages.add(vm._stack, rec.changed >> RAM_PAGES);
+    }
+
+    std::vector<vm_snapshot_port_t> ports;
+    std::vector<word_t> portWords;
+    for (unsigned int portId = 0; portId < VM_PORT_COUNT; portId++) {
+        const VMPort* const port = world._ports.at(static_cast<byte_t>(portId));
+        if (!port)
+            continue;
+        const std::size_t first = portWords.size();
+        port->peek(portWords);
+        vm_snapshot_port_t rec = { portId, static_cast<std::uint32_t>(port->capacity()), first, portWords.size() - first };
+        ports.push_back(rec);
+    }
+
+    std::vector<vm_snapshot_outbox_t> outboxes;
+    std::vector<vm_snapshot_message_t> messages;
+    for (std::size_t i = 0; i < world._outboxes.size(); i++) {
+        const std::vector<vm_message_t>& held = world._outboxes[i]->messages();
+        if (held.empty())
+            continue;
+        vm_snapshot_outbox_t rec = { i, messages.size(), held.size() };
+        outboxes.push_back(rec);
+        for (const vm_message_t& msg : held) {
+            vm_snapshot_message_t m = { msg.value, msg.port, 0 };
+            messages.push_back(m);
+        }
+    }
+
+    // lay the sections out, so the header can go first
+    vm_snapshot_header_t header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = VM_SNAPSHOT_VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.pageSize = VM_RAM_PAGE_SIZE;
+    header.ramPages = RAM_PAGES;
+    header.ticks = world._ticks;
+    header.budget = world._budget;
+    header.batchSize = world._batchSize;
+    header.deterministic = world._deterministic;
+    header.id = id;
+    header.base = base;
+    std::uint64_t at = sizeof(header);
+    auto place = [&at](vm_snapshot_section_t& section, std::uint64_t count, std::size_t size) {
+        at = align(at);
+        section.offset = at;
+        section.count = count;
+        at += count * size;
+    };
+    place(header.roms, roms.size(), sizeof(vm_snapshot_rom_t));
+    place(header.romBytes, romBytes.size(), 1);
+    place(header.vms, vms.size(), sizeof(vm_snapshot_vm_t));
+    place(header.pageRefs, pages.refs.size(), sizeof(std::uint32_t));
+    place(header.pages, pages.pages.size() * VM_RAM_PAGE_SIZE, 1);
+    place(header.ports, ports.size(), sizeof(vm_snapshot_port_t));
+    place(header.portWords, portWords.size(), sizeof(word_t));
+    place(header.outboxes, outboxes.size(), sizeof(vm_snapshot_outbox_t));
+    place(header.messages, messages.size(), sizeof(vm_snapshot_message_t));
+    header.fileSize = at;
+
+    SectionWriter out(path);
+    out.write(&header, sizeof(header));
+    out.section(roms);
+    out.section(romBytes);
+    out.section(vms);
+    out.section(pages.refs);
+    out.pad();
+    std::vector<byte_t> gathered;
+    gathered.reserve(PAGES_PER_WRITE * VM_RAM_PAGE_SIZE);
+    for (std::size_t i = 0; i < pages.pages.size(); i++) {
+        gathered.insert(gathered.end(), pages.pages[i], pages.pages[i] + VM_RAM_PAGE_SIZE);
+        if (gathered.size() == gathered.capacity() || i + 1 == pages.pages.size()) {
+            out.write(gathered.data(), gathered.size());
+            gathered.clear();
+        }
+    }
+    out.section(ports);
+    out.section(portWords);
+    out.section(outboxes);
+    out.section(messages);
+    out.close();
+}
+
+void VMSnapshot::markSaved(VMWorld& world, std::uint64_t id) {
+    for (std::size_t i = 0; i < world._vms.size(); i++) {
+        RobotVM& vm = *world._vms[i];
+        vm._ram.markClean();
+        vm._stack.markClean();
+        vm._saved = i + 1;
+    }
+    world._checkpoint = id;
+}
+
+void VMSnapshot::save(const VMWorld& world, const char* path) {
+    write(world, path, newId(), 0);
+}
+
+void VMSnapshot::checkpoint(VMWorld& world, const char* path) {
+    const std::uint64_t id = newId();
+    write(world, path, id, 0);
+    markSaved(world, id);
+}
+
+void VMSnapshot::checkpointChanges(VMWorld& world, const char* path) {
+    if (!world._checkpoint)
+        throw VMSnapshotException("no checkpoint to save the changes since");
+    const std::uint64_t id = newId();
+    write(world, path, id, world._checkpoint);
+    markSaved(world, id);
+}
+
+void VMSnapshot::restore(VMWorld& world, const char* path) {
+    restore(world, std::vector<std::string>(1, path));
+}
+
+void VMSnapshot::restore(VMWorld& world, const std::vector<std::string>& chain) {
+    if (chain.empty())
+        throw VMSnapshotException("no snapshot to restore");
+    // check everything before touching the world, so a bad chain leaves it be
+    std::vector<std::unique_ptr<SnapshotFile>> files;
+    for (const std::string& path : chain) {
+        files.emplace_back(new SnapshotFile(path.c_str()));
+        const vm_snapshot_header_t& header = files.back()->header;
+        if (files.size() == 1 && header.base != 0)
+            throw VMSnapshotException("snapshot " + path + " needs the checkpoints before it");
+        if (files.size() > 1 && header.base != files[files.size() - 2]->header.id)
+            throw VMSnapshotException("snapshot " + path + " doesn't follow on from " + files[files.size() - 2]->path);
+    }
+    const PageFinder found(files);
+    const SnapshotFile& last = *files.back();
+    const vm_snapshot_header_t& header = last.header;
+    const Section<vm_snapshot_rom_t>& roms = last.roms;
+    const Section<vm_snapshot_vm_t>& vms = last.vms;
+    const Section<vm_snapshot_port_t>& ports = last.ports;
+    const Section<vm_snapshot_outbox_t>& outboxes = last.outboxes;
+    const Section<vm_snapshot_message_t>& messages = last.messages;
+
+    while (world.size())
+        world.despawn(world.size() - 1);
+    for (unsigned int id = 0; id < VM_PORT_COUNT; id++)
+        world._ports.close(static_cast<byte_t>(id));
+    world.setDeterministicMessaging(header.deterministic != 0);
+    world.setBudget(static_cast<unsigned long>(header.budget));
+    world.setBatchSize(static_cast<std::size_t>(header.batchSize));
+    world._ticks = static_cast<unsigned long>(header.ticks);
+
+    std::vector<std::shared_ptr<const RomImage>> images(static_cast<std::size_t>(roms.count));
+    for (std::size_t i = 0; i < images.size(); i++) {
+        if (roms[i].size == 0) {
+            images[i] = RomImage::empty();
+        } else {
+            std::shared_ptr<RomImage> image = std::make_shared<RomImage>();
+            image->write(0, last.romBytes.at + roms[i].offset, roms[i].size);
+            images[i] = image;
+        }
+    }
+
+    PageRestorer restorer(found);
+    const std::uint64_t* ref = found.refs.data();
+    world._vms.reserve(static_cast<std::size_t>(vms.count));
+    for (std::uint64_t i = 0; i < vms.count; i++) {
+        const vm_snapshot_vm_t& rec = vms[i];
+        unsigned int shard;
+        RobotVM* const vm = world.create(shard);
+        for (int r = 0; r < 4; r++)
+            vm->_regs.r[r] = rec.r[r];
+        vm->_regs.pc = rec.pc;
+        vm->_regs.sp = rec.sp;
+        vm->_regs.ix = rec.ix;
+        vm->_halt = rec.halted != 0;
+        vm->_wait = rec.waiting != 0;
+        unpackErrors(rec.errors, vm->_errorstate);
+        vm->_waitFor = static_cast<VMWaitReason>(rec.waitFor);
+        vm->_waitPort = rec.waitPort;
+        vm->_woke = rec.woke != 0;
+        vm->_sleep = rec.sleep;
+        vm->_engine = static_cast<VMEngine>(rec.engine);
+        vm->_superops = (rec.options & VM_SNAPSHOT_SUPEROPS) != 0;
+        vm->_fixedregs = (rec.options & VM_SNAPSHOT_FIXEDREGS) != 0;
+        vm->_hexregs = (rec.options & VM_SNAPSHOT_HEXREGS) != 0;
+        vm->setRom(images[rec.rom]);
+
+        restorer.restore(vm->_ram, rec.pages, 0, ref);
+        restorer.restore(vm->_stack, rec.pages, RAM_PAGES, ref);
+        world.adopt(vm, shard);
+    }
+
+    for (std::uint64_t i = 0; i < ports.count; i++) {
+        VMPort& port = world._ports.open(static_cast<byte_t>(ports[i].id), ports[i].capacity);
+        for (std::uint64_t w = 0; w < ports[i].words; w++)
+            port.trySend(last.portWords[ports[i].firstWord + w]);
+    }
+    for (std::uint64_t i = 0; i < outboxes.count; i++) {
+        VMOutbox* const outbox = world._outboxes.empty() ? nullptr : world._outboxes[outboxes[i].vm].get();
+        for (std::uint64_t m = 0; outbox && m < outboxes[i].messages; m++) {
+            const vm_snapshot_message_t& msg = messages[outboxes[i].firstMessage + m];
+            outbox->push(msg.port, msg.value);
+        }
+    }
+    markSaved(world, header.id);
+}
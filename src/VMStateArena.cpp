@@ -0,0 +1,142 @@
+#include <cassert>
+#include "VMStateArena.h"
+#include "RobotVM.h"
+
+struct VMStateArena::Chunk {
+    std::unique_ptr<vm_regs_t[]>       regs;
+    std::unique_ptr<bool[]>            halted;
+    std::unique_ptr<bool[]>            waiting;
+    std::unique_ptr<vm_errorstate_t[]> errors;
+    std::unique_ptr<bool[]>            used;
+    std::unique_ptr<vm_ram_t[]>        ram;
+    std::unique_ptr<vm_stack_t[]>      stack;
+
+    explicit Chunk(std::size_t slots)
+        : regs(new vm_regs_t[slots]()), halted(new bool[slots]()), waiting(new bool[slots]()),
+          errors(new vm_errorstate_t[slots]), used(new bool[slots]()), ram(new vm_ram_t[slots]()),
+          stack(new vm_stack_t[slots]()) {
+    }
+};
+
+VMStateArena::VMStateArena(std::size_t chunkSlots)
+    : _chunks(), _free(), _chunkSlots(chunkSlots ? chunkSlots : 1), _live(0), _pools() {
+    _pools.emplace_back(new VMPagePool());
+}
+
+VMStateArena::~VMStateArena() {
+}
+
+VMStateArena::slot_t VMStateArena::acquire() {
+    if (_free.empty()) {
+        const slot_t first = capacity();
+        _chunks.emplace_back(new Chunk(_chunkSlots));
+        // hand out the new chunk's slots lowest first
+        for (slot_t s = first + _chunkSlots; s > first; s--)
+            _free.push_back(s - 1);
+    }
+
+    const slot_t slot = _free.back();
+    _free.pop_back();
+    _live++;
+
+    Chunk& c = chunkOf(slot);
+    const std::size_t i = slot % _chunkSlots;
+    c.used[i] = true;
+    clearState(slot);
+    c.ram[i].init(*_pools[0]);
+    c.stack[i].init(*_pools[0]);
+    return slot;
+}
+
+void VMStateArena::release(slot_t slot) {
+    if (inUse(slot))
+        retire(slot);
+    _free.push_back(slot);
+}
+
+void VMStateArena::retire(slot_t slot) {
+    Chunk& c = chunkOf(slot);
+    c.used[slot % _chunkSlots] = false;
+    c.ram[slot % _chunkSlots].clear();
+    c.stack[slot % _chunkSlots].clear();
+    clearState(slot);
+    _live--;
+}
+
+void VMStateArena::revive(slot_t slot) {
+    chunkOf(slot).used[slot % _chunkSlots] = true;
+    _live++;
+}
+
+void VMStateArena::clearState(slot_t slot) {
+    Chunk& c = chunkOf(slot);
+    const std::size_t i = slot % _chunkSlots;
+    c.regs[i] = vm_regs_t();
+    c.halted[i] = false;
+    c.waiting[i] = false;
+    c.errors[i] = vm_errorstate_t();
+}
+
+void VMStateArena::setNodes(unsigned int nodes) {
+    while (_pools.size() < nodes)
+        _pools.emplace_back(new VMPagePool());
+}
+
+void VMStateArena::place(slot_t slot, unsigned int node) {
+    Chunk& c = chunkOf(slot);
+    const std::size_t i = slot % _chunkSlots;
+    assert(c.ram[i].resident() == 0 && c.stack[i].resident() == 0);
+    c.ram[i].pool = _pools[node].get();
+    c.stack[i].pool = _pools[node].get();
+}
+
+std::size_t VMStateArena::pagesInUse() const {
+    std::size_t n = 0;
+    for (const std::unique_ptr<VMPagePool>& pool : _pools)
+        n += pool->pagesInUse();
+    return n;
+}
+
+bool VMStateArena::inUse(slot_t slot) const {
+    return chunkOf(slot).used[slot % _chunkSlots];
+}
+
+vm_regs_t& VMStateArena::regs(slot_t slot) {
+    return chunkOf(slot).regs[slot % _chunkSlots];
+}
+
+bool& VMStateArena::halted(slot_t slot) {
+    return chunkOf(slot).halted[slot % _chunkSlots];
+}
+
+bool& VMStateArena::waiting(slot_t slot) {
+    return chunkOf(slot).waiting[slot % _chunkSlots];
+}
+
+vm_errorstate_t& VMStateArena::errors(slot_t slot) {
+    return chunkOf(slot).errors[slot % _chunkSlots];
+}
+
+vm_ram_t& VMStateArena::ram(slot_t slot) {
+    return chunkOf(slot).ram[slot % _chunkSlots];
+}
+
+vm_stack_t& VMStateArena::stack(slot_t slot) {
+    return chunkOf(slot).stack[slot % _chunkSlots];
+}
+
+std::size_t VMStateArena::countHalted() const {
+    std::size_t n = 0;
+    for (const std::unique_ptr<Chunk>& c : _chunks)
+        for (std::size_t i = 0; i < _chunkSlots; i++)
+            n += c->used[i] & c->halted[i] & !c->waiting[i];
+    return n;
+}
+
+std::size_t VMStateArena::countWaiting() const {
+    std::size_t n = 0;
+    for (const std::unique_ptr<Chunk>& c : _chunks)
+        for (std::size_t i = 0; i < _chunkSlots; i++)
+            n += c->used[i] & c->waiting[i];
+    return n;
+}
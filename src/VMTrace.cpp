@@ -0,0 +1,57 @@
+#include <cstdio>
+#include <cstring>
+#include "VMTrace.h"
+#include "RobotVM.h"
+
+void VMTextTraceSink::traceExec(const RobotVM& vm, const vm_instr_t& instr, word_t pcbefore) {
+    if (instr.opcode == Opcode::JMP_W)
+        printf("JMP: %d\n", instr.bytes[0] | (instr.bytes[1] << 8));
+
+    vm_regs_t printregs = vm.getRegs();
+    printregs.pc = pcbefore;
+    vm.printRegs(printregs);
+    vm.printStack();
+}
+
+void VMTextTraceSink::traceBurn(const RobotVM&, addr_t, unsigned int len) {
+    printf("burn(): burned %d bytes...\n", len);
+}
+
+void VMTextTraceSink::traceWarning(const RobotVM&, const char* msg) {
+    printf("%s\n", msg);
+}
+
+VMBinaryTraceSink::VMBinaryTraceSink(std::FILE* out, std::size_t bufferedRecords)
+    : _out(out), _buffer(), _written(0) {
+    _buffer.reserve(bufferedRecords);
+}
+
+VMBinaryTraceSink::~VMBinaryTraceSink() {
+    flush();
+}
+
+void VMBinaryTraceSink::traceExec(const RobotVM& vm, const vm_instr_t& instr, word_t pcbefore) {
+    const vm_regs_t& regs = vm.getRegs();
+    vm_trace_record_t rec;
+
+    rec.pc = pcbefore;
+    rec.instr[0] = static_cast<byte_t>(instr.opcode);
+    rec.instr[1] = instr.bytes[0];
+    rec.instr[2] = instr.bytes[1];
+    rec.instr[3] = instr.bytes[2];
+    memcpy(&rec.r[0], &regs.r[0], sizeof(rec.r));
+    rec.sp = regs.sp;
+    rec.nextpc = regs.pc;
+
+    _buffer.push_back(rec);
+    if (_buffer.size() == _buffer.capacity())
+        flush();
+}
+
+void VMBinaryTraceSink::flush() {
+    if (_buffer.empty())
+        return;
+
+    _written += fwrite(_buffer.data(), sizeof(vm_trace_record_t), _buffer.size(), _out);
+    _buffer.clear();
+}
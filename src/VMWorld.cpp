@@ -0,0 +1,361 @@
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+#include "VMWorld.h"
+#include "VMStateHash.h"
+
+VMWorld::VMWorld(unsigned int threads, bool pinned)
+    : _pool(), _vms(), _ports(), _deterministic(false), _outboxes(),
+      _runnable(), _reschedule(false), _population(), _ticking(), _tickShards(),
+      _parkedOn(), _sleepers(), _parked(0), _scheduler(threads, pinned), _budget(VM_WORLD_DEFAULT_BUDGET),
+      _deadline(), _batchSize(VM_WORLD_DEFAULT_BATCH), _ticks(0), _checkpoint(0),
+      _tickHashing(false), _hashes() {
+    _runnable.resize(_scheduler.threads());
+    _population.resize(_scheduler.threads());
+    _tickShards.resize(_scheduler.threads());
+    if (pinned)
+        _pool.arena().setNodes(HostTopology::host().nodes());
+}
+
+RobotVM& VMWorld::adopt(RobotVM* vm, unsigned int shard) {
+    vm->_shard = shard;
+    _population[shard]++;
+    _vms.push_back(vm);
+    vm->setPorts(&_ports);
+    if (_deterministic) {
+        _outboxes.emplace_back(new VMOutbox());
+        vm->setOutbox(_outboxes.back().get());
+    }
+    // a fork of a parked VM is waiting just the same
+    if (vm->isWaiting())
+        park(vm);
+    else
+        _runnable[shard].push_back(vm);
+    return *vm;
+}
+
+RobotVM* VMWorld::create(unsigned int& shard) {
+    shard = static_cast<unsigned int>(
+        std::min_element(_population.begin(), _population.end()) - _population.begin());
+    RobotVM* const vm = _pool.spawn();
+    if (pinned())
+        _pool.arena().place(vm->_slot, shardNode(shard));
+    return vm;
+}
+
+RobotVM& VMWorld::spawn() {
+    unsigned int shard;
+    RobotVM* const vm = create(shard);
+    return adopt(vm, shard);
+}
+
+RobotVM& VMWorld::spawn(const std::shared_ptr<const RomImage>& rom) {
+    RobotVM& vm = spawn();
+    vm.setRom(rom);
+    return vm;
+}
+
+RobotVM& VMWorld::fork(std::size_t index) {
+    // shares its parent's pages, so takes new ones from the same node too
+    RobotVM& parent = *_vms[index];
+    RobotVM* const child = _pool.fork(parent);
+    // and wakes when its parent does
+    child->_sleep = sleepLeft(parent);
+    return adopt(child, parent._shard);
+}
+
+void VMWorld::despawn(std::size_t index) {
+    if (_vms[index]->_parked)
+        unpark(_vms[index]);
+    else
+        _reschedule = true;
+    _population[_vms[index]->_shard]--;
+    _pool.despawn(_vms[index]);
+    _vms[index] = _vms.back();
+    _vms.pop_back();
+    if (_deterministic) {
+        // whatever the VM had yet to deliver goes with it
+        _outboxes[index] = std::move(_outboxes.back());
+        _outboxes.pop_back();
+    }
+}
+
+void VMWorld::setDeterministicMessaging(bool enable) {
+    if (enable == _deterministic)
+        return;
+    if (enable) {
+        for (RobotVM* vm : _vms) {
+            _outboxes.emplace_back(new VMOutbox());
+            vm->setOutbox(_outboxes.back().get());
+        }
+    } else {
+        deliver();
+        for (RobotVM* vm : _vms)
+            vm->setOutbox(nullptr);
+        _outboxes.clear();
+    }
+    _deterministic = enable;
+}
+
+namespace {
+
+//! Orders VMWorld::_sleepers with the earliest wake-up on top
+struct WakesLater {
+    bool operator()(const std::pair<unsigned long, RobotVM*>& a,
+                    const std::pair<unsigned long, RobotVM*>& b) const {
+        return a.first > b.first;
+    }
+};
+
+} // namespace
+
+void VMWorld::park(RobotVM* vm) {
+    if (vm->waitReason() == VMWaitReason::SLEEP) {
+        // it carries on in the tick that makes sleepTicks() calls of runFor() from now
+        _sleepers.emplace_back(_ticks + vm->sleepTicks(), vm);
+        std::push_heap(_sleepers.begin(), _sleepers.end(), WakesLater());
+    } else {
+        _parkedOn[vm->waitPort()].push_back(vm);
+    }
+    vm->_parked = true;
+    _parked++;
+}
+
+void VMWorld::unpark(RobotVM* vm) {
+    // _waitFor rather than waitReason():  the host may have reset the VM since
+    if (vm->_waitFor == VMWaitReason::SLEEP) {
+        for (auto it = _sleepers.begin(); it != _sleepers.end(); ++it) {
+            if (it->second == vm) {
+                _sleepers.erase(it);
+                std::make_heap(_sleepers.begin(), _sleepers.end(), WakesLater());
+                break;
+            }
+        }
+    } else {
+        std::vector<RobotVM*>& on = _parkedOn[vm->_waitPort];
+        on.erase(std::find(on.begin(), on.end(), vm));
+    }
+    vm->_parked = false;
+    _parked--;
+}
+
+void VMWorld::wake(std::size_t index) {
+    RobotVM* const vm = _vms[index];
+    if (!vm->_parked)
+        return;
+    unpark(vm);
+    vm->wake();
+    _runnable[vm->_shard].push_back(vm);
+}
+
+std::size_t VMWorld::wakeParked() {
+    std::size_t woken = 0;
+    if (_parked == 0)
+        return woken;
+
+    for (unsigned int id = 0; id < VM_PORT_COUNT; id++) {
+        std::vector<RobotVM*>& on = _parkedOn[id];
+        if (on.empty())
+            continue;
+        const VMPort* const port = _ports.at(static_cast<byte_t>(id));
+        for (std::size_t i = 0; i < on.size(); ) {
+            RobotVM* const vm = on[i];
+            bool ready;
+            if (!port)
+                ready = true;   // closed since:  let it find out
+            else if (vm->_waitFor == VMWaitReason::RECV)
+                ready = !_deterministic && port->size() > 0;   // else handOut() wakes it
+            else if (vm->outbox())
+                ready = vm->outbox()->size() < vm->outbox()->capacity();
+            else
+                ready = port->size() < port->capacity();
+            if (ready) {
+                on[i] = on.back();
+                on.pop_back();
+                vm->_parked = false;
+                _runnable[vm->_shard].push_back(vm);
+                woken++;
+            } else {
+                i++;
+            }
+        }
+    }
+
+    // sleepers due this tick:  the one about to be run is number _ticks + 1
+    while (!_sleepers.empty() && _sleepers.front().first <= _ticks + 1) {
+        RobotVM* const vm = _sleepers.front().second;
+        std::pop_heap(_sleepers.begin(), _sleepers.end(), WakesLater());
+        _sleepers.pop_back();
+        vm->_parked = false;
+        vm->wake();
+        _runnable[vm->_shard].push_back(vm);
+        woken++;
+    }
+
+    _parked -= woken;
+    return woken;
+}
+
+unsigned long VMWorld::deliver() {
+    unsigned long n = 0;
+    for (const std::unique_ptr<VMOutbox>& outbox : _outboxes)
+        n += outbox->deliver(_ports);
+    return n;
+}
+
+void VMWorld::handOut() {
+    for (RobotVM* vm : _vms) {
+        if (!vm->_wait || vm->_waitFor != VMWaitReason::RECV)
+            continue;
+        VMPort* const port = _ports.at(vm->_waitPort);
+        word_t w;
+        if (!port || !port->tryRecv(w))
+            continue;
+        if (vm->_parked) {
+            unpark(vm);
+            _runnable[vm->_shard].push_back(vm);
+        }
+        vm->receive(w);
+    }
+}
+
+void VMWorld::setBudget(unsigned long budget) {
+    _budget = budget;
+    if (_deadline)
+        _deadline->setLimits(_deadline->minBudget(), budget);
+}
+
+void VMWorld::setTickDeadline(double seconds, double percentile, unsigned long minBudget) {
+    if (seconds > 0.0)
+        _deadline.reset(new TickBudgetController(seconds, minBudget, _budget, percentile));
+    else
+        _deadline.reset();
+}
+
+word_t VMWorld::sleepLeft(const RobotVM& vm) const {
+    if (!vm._parked || vm._waitFor != VMWaitReason::SLEEP)
+        return vm._sleep;
+    for (const std::pair<unsigned long, RobotVM*>& sleeper : _sleepers) {
+        if (sleeper.second == &vm)
+            return static_cast<word_t>(sleeper.first - _ticks);
+    }
+    return vm._sleep;
+}
+
+std::vector<word_t> VMWorld::sleepsLeft() const {
+    std::unordered_map<const RobotVM*, unsigned long> wakeAt;
+    for (const std::pair<unsigned long, RobotVM*>& sleeper : _sleepers)
+        wakeAt.emplace(sleeper.second, sleeper.first);
+    std::vector<word_t> left(_vms.size());
+    for (std::size_t i = 0; i < _vms.size(); i++) {
+        const RobotVM& vm = *_vms[i];
+        left[i] = vm._sleep;
+        if (vm._parked && vm._waitFor == VMWaitReason::SLEEP)
+            left[i] = static_cast<word_t>(wakeAt[&vm] - _ticks);
+    }
+    return left;
+}
+
+std::uint64_t VMWorld::stateHash() {
+    const std::vector<word_t> sleeps = sleepsLeft();
+    _hashes.resize(_vms.size());
+    _scheduler.run(_vms.size(), _batchSize, [&](std::size_t begin, std::size_t end, unsigned int) {
+        for (std::size_t i = begin; i < end; i++)
+            _hashes[i] = _vms[i]->stateHash(sleeps[i]);
+        return 0ul;
+    });
+    std::uint64_t h = VMStateHash::mix(0, _ticks);
+    for (std::uint64_t vm : _hashes)
+        h = VMStateHash::mix(h, vm);
+
+    // messages in flight, as a checkpoint keeps them
+    std::vector<word_t> words;
+    for (unsigned int id = 0; id < VM_PORT_COUNT; id++) {
+        const VMPort* const port = _ports.at(static_cast<byte_t>(id));
+        if (!port)
+            continue;
+        words.clear();
+        port->peek(words);
+        h = VMStateHash::mix(h, id);
+        h = VMStateHash::mix(h, port->capacity());
+        h = VMStateHash::mix(h, words.size());
+        for (word_t w : words)
+            h = VMStateHash::mix(h, w);
+    }
+    for (std::size_t i = 0; i < _outboxes.size(); i++) {
+        const std::vector<vm_message_t>& held = _outboxes[i]->messages();
+        if (held.empty())
+            continue;
+        h = VMStateHash::mix(h, i);
+        h = VMStateHash::mix(h, held.size());
+        for (const vm_message_t& msg : held)
+            h = VMStateHash::mix(h, static_cast<std::uint64_t>(msg.port) << 16 | msg.value);
+    }
+    return h;
+}
+
+std::uint64_t VMWorld::stateHash(std::size_t index) const {
+    return _vms[index]->stateHash(sleepLeft(*_vms[index]));
+}
+
+vm_tick_stats_t VMWorld::tick() {
+    typedef std::chrono::steady_clock clock;
+    const auto start = clock::now();
+
+    if (_reschedule) {
+        for (std::vector<RobotVM*>& shard : _runnable)
+            shard.clear();
+        for (RobotVM* vm : _vms) {
+            if (!vm->_parked)
+                _runnable[vm->_shard].push_back(vm);
+        }
+        _reschedule = false;
+    }
+
+    vm_tick_stats_t stats;
+    stats.woken = wakeParked();
+    _ticking.clear();
+    for (std::size_t s = 0; s < _runnable.size(); s++) {
+        _ticking.insert(_ticking.end(), _runnable[s].begin(), _runnable[s].end());
+        _tickShards[s] = _runnable[s].size();
+    }
+    stats.ran = _ticking.size();
+    const unsigned long budget = _deadline ? _deadline->budgetFor(_ticking.size()) : _budget;
+    stats.budget = budget;
+    stats.instructions = _scheduler.run(_tickShards, _batchSize,
+    [&](std::size_t begin, std::size_t end, unsigned int) {
+        unsigned long done = 0;
+        for (std::size_t i = begin; i < end; i++) {
+            unsigned long ran = 0;
+            _ticking[i]->runFor(budget, &ran);
+            done += ran;
+        }
+        return done;
+    });
+
+    if (_deterministic) {
+        stats.messages = deliver();
+        handOut();
+    }
+    stats.tick = ++_ticks;
+
+    // park whatever is left waiting, keeping the rest in order
+    for (std::vector<RobotVM*>& shard : _runnable) {
+        std::size_t kept = 0;
+        for (RobotVM* vm : shard) {
+            if (vm->isWaiting())
+                park(vm);
+            else
+                shard[kept++] = vm;
+        }
+        shard.resize(kept);
+    }
+    stats.parked = _parked;
+    if (_tickHashing)
+        stats.hash = stateHash();
+
+    stats.seconds = std::chrono::duration<double>(clock::now() - start).count();
+    if (_deadline)
+        _deadline->record(stats.seconds);
+    return stats;
+}
@@ -4,6 +4,8 @@
 #include "imgui.h"
 #include "imgui_impl_sdl.h"
 #include "RobotVM.h"
+#include "VMBenchmark.h"
+#include "VMSelfCheck.h"
 #include "VMAssembler.h"
 #include "VMInstr.h"
 #include "TextBuffer.h"
@@ -74,12 +76,25 @@ int WinMain(HINSTANCE hInst, HINSTANCE hPrevInst, LPSTR lpCmdLine, int nShowCmd)
 int main(int argc, char *argv[])
 #endif
 {
+#ifndef WIN32
+    // headless:  time the VM and leave before SDL ever comes up
+    if (argc > 1 && std::string(argv[1]) == "--bench") {
+        runBenchmarks(stdout);
+        return 0;
+    }
+    // or check every engine against stepRaw(), failing if any disagrees
+    if (argc > 1 && std::string(argv[1]) == "--check")
+        return runSelfChecks(stdout) == 0 ? 0 : 1;
+#endif
+
     std::string humanOpcodeStrings = printHumanOpcodeStrings();
 
 	initCodeSamples();
     std::shared_ptr<RobotVM> vmp(new RobotVM());
 
     RobotVM&         vm = *vmp;
+    VMTextTraceSink  vmtrace;   // dashboard wants the register dump on stdout
+    vm.setTraceSink(&vmtrace);
     VMInstrEmitter&   e = vm.emitter();
     VMAssembler asmblr( (std::shared_ptr<RobotVM>(vmp)), e );
 